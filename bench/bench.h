@@ -0,0 +1,36 @@
+#ifndef RTSP_DASH_BENCH_H
+#define RTSP_DASH_BENCH_H
+
+#include <gst/gst.h>
+#include <glib.h>
+#include <string>
+
+// Process and pipeline resources at one point in time
+struct ResourceSample {
+    guint64 rss_kb;
+    guint fds;
+    guint threads;
+    guint elements;
+    guint pads;
+};
+
+// Fills the process part of sample from /proc/self
+void sample_process(ResourceSample& sample);
+
+// Counts elements and pads of bin, recursively
+void sample_pipeline(GstElement *bin, ResourceSample& sample);
+
+// Creates a scratch output directory under $TMPDIR
+std::string make_output_dir(const gchar *prefix);
+
+// User plus system CPU time of all threads of the process
+double process_cpu_seconds();
+
+// Subcommands, each parses its own options and returns the exit code
+int run_soak(int argc, char *argv[]);
+int run_codecs(int argc, char *argv[]);
+int run_quality(int argc, char *argv[]);
+int run_denoise(int argc, char *argv[]);
+int run_overlay(int argc, char *argv[]);
+
+#endif // RTSP_DASH_BENCH_H
@@ -0,0 +1,238 @@
+#include "bench.h"
+#include "encoders.h"
+#include "scoring.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Encodes the same clip with every installed codec at a range of
+// bitrates and reports CPU cost, achieved bitrate and luma PSNR, then
+// how much bitrate H.265 and AV1 save over H.264 at equal PSNR. Feed it
+// a recording of the site's camera, test patterns flatter every codec.
+
+static gchar *input_uri = NULL;
+static gint width = 1280;
+static gint height = 720;
+static gint frames = 250;
+static gchar *bitrate_list = NULL;
+static gchar *codec_list = NULL;
+static gchar *csv_file = NULL;
+
+static GOptionEntry codecs_entries[] = {
+    { "input", 'i', 0, G_OPTION_ARG_STRING, &input_uri,
+      "Clip to encode, any URI uridecodebin plays (default: test pattern)", "URI" },
+    { "width", 0, 0, G_OPTION_ARG_INT, &width, "Rendition width (default: 1280)", "PX" },
+    { "height", 0, 0, G_OPTION_ARG_INT, &height, "Rendition height (default: 720)", "PX" },
+    { "frames", 'n', 0, G_OPTION_ARG_INT, &frames,
+      "Frames to encode at 25 fps (default: 250)", "N" },
+    { "bitrates", 'b', 0, G_OPTION_ARG_STRING, &bitrate_list,
+      "Comma separated bitrates (default: 500,1000,2000,4000)", "KBPS" },
+    { "codecs", 'c', 0, G_OPTION_ARG_STRING, &codec_list,
+      "Comma separated codecs (default: h264,h265,av1)", "CODECS" },
+    { "csv", 0, 0, G_OPTION_ARG_FILENAME, &csv_file,
+      "Also write the results to FILE", "FILE" },
+    { NULL }
+};
+
+struct CodecPoint {
+    VideoCodec codec;
+    int target_kbps;
+    double actual_kbps;
+    double cpu_cores; // CPU seconds per second of video
+    double encode_fps;
+    double psnr;      // 0 when the stream could not be decoded
+};
+
+// CPU and wall time of a run, including the source; callers subtract
+// the baseline
+static bool measure(const std::string& description, int kbps, double& cpu_seconds,
+                    double& wall_seconds, guint64 *encoded_bytes) {
+    double cpu_start = process_cpu_seconds();
+    gint64 wall_start = g_get_monotonic_time();
+    bool ok = run_encode_pipeline(description, kbps, NULL, encoded_bytes);
+    cpu_seconds = process_cpu_seconds() - cpu_start;
+    wall_seconds = (g_get_monotonic_time() - wall_start) / (double)G_USEC_PER_SEC;
+    return ok;
+}
+
+static bool parse_list(const gchar *text, const gchar *fallback, std::vector<std::string>& items) {
+    gchar **parts = g_strsplit(text ? text : fallback, ",", -1);
+    for (gchar **part = parts; *part; part++) {
+        if (*g_strstrip(*part)) {
+            items.push_back(*part);
+        }
+    }
+    g_strfreev(parts);
+    return !items.empty();
+}
+
+// Bitrate the codec needs for psnr, interpolated linearly in log(rate)
+// between its two neighbouring points; 0 outside its measured range
+static double rate_at_psnr(std::vector<CodecPoint> curve, double psnr) {
+    std::sort(curve.begin(), curve.end(),
+              [](const CodecPoint& a, const CodecPoint& b) { return a.psnr < b.psnr; });
+    for (gsize i = 1; i < curve.size(); i++) {
+        const CodecPoint& lo = curve[i - 1];
+        const CodecPoint& hi = curve[i];
+        if (psnr >= lo.psnr && psnr <= hi.psnr && hi.psnr > lo.psnr) {
+            double t = (psnr - lo.psnr) / (hi.psnr - lo.psnr);
+            return exp(log(lo.actual_kbps) + t * (log(hi.actual_kbps) - log(lo.actual_kbps)));
+        }
+    }
+    return 0;
+}
+
+static std::vector<CodecPoint> curve_of(const std::vector<CodecPoint>& points, VideoCodec codec) {
+    std::vector<CodecPoint> curve;
+    for (const CodecPoint& point : points) {
+        if (point.codec == codec && point.psnr > 0) {
+            curve.push_back(point);
+        }
+    }
+    return curve;
+}
+
+static void print_savings(const std::vector<CodecPoint>& points, VideoCodec codec) {
+    std::vector<CodecPoint> reference = curve_of(points, CODEC_H264);
+    std::vector<CodecPoint> curve = curve_of(points, codec);
+
+    double savings = 0;
+    guint matched = 0;
+    for (const CodecPoint& point : reference) {
+        double rate = rate_at_psnr(curve, point.psnr);
+        if (rate > 0) {
+            savings += 1.0 - rate / point.actual_kbps;
+            matched++;
+        }
+    }
+
+    if (matched == 0) {
+        g_print("%s: PSNR ranges do not overlap with h264, widen --bitrates\n",
+                video_codec_name(codec));
+        return;
+    }
+    g_print("%s: %.0f%% %s bitrate than h264 at equal PSNR (%u points)\n",
+            video_codec_name(codec), fabs(savings / matched) * 100,
+            savings >= 0 ? "less" : "more", matched);
+}
+
+int run_codecs(int argc, char *argv[]) {
+    GOptionContext *context = g_option_context_new("- codec cost benchmark");
+    g_option_context_add_main_entries(context, codecs_entries, NULL);
+
+    GError *err = NULL;
+    if (!g_option_context_parse(context, &argc, &argv, &err)) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    std::vector<std::string> bitrate_items, codec_items;
+    parse_list(bitrate_list, "500,1000,2000,4000", bitrate_items);
+    parse_list(codec_list, "h264,h265,av1", codec_items);
+
+    std::vector<int> bitrates;
+    for (const std::string& item : bitrate_items) {
+        int kbps = atoi(item.c_str());
+        if (kbps <= 0) {
+            g_printerr("Invalid bitrate '%s'\n", item.c_str());
+            return 1;
+        }
+        bitrates.push_back(kbps);
+    }
+
+    std::vector<VideoCodec> codecs;
+    for (const std::string& item : codec_items) {
+        VideoCodec codec;
+        if (!parse_video_codec(item, codec)) {
+            return 1;
+        }
+        if (!find_video_encoder(codec)) {
+            g_print("Skipping %s, no encoder installed\n", item.c_str());
+            continue;
+        }
+        codecs.push_back(codec);
+    }
+
+    // Decoding and scaling the source is not the encoder's cost
+    std::string source = clip_description(input_uri, width, height, frames);
+    double baseline_cpu, baseline_wall;
+    if (!measure(source + " ! fakesink", 0, baseline_cpu, baseline_wall, NULL)) {
+        return 1;
+    }
+    double duration = (double)frames / SCORING_FRAMERATE;
+
+    g_print("%d frames of %dx%d, source costs %.2f cores\n\n",
+            frames, width, height, baseline_cpu / duration);
+    g_print("%-6s %8s %8s %8s %8s %8s\n", "codec", "target", "kbps", "cores", "fps", "psnr");
+
+    std::vector<CodecPoint> points;
+    for (VideoCodec codec : codecs) {
+        for (int kbps : bitrates) {
+            gchar *encode = g_strdup_printf("%s name=encoder ! %s", find_video_encoder(codec),
+                                            video_parser_factory(codec));
+            CodecPoint point = CodecPoint();
+            point.codec = codec;
+            point.target_kbps = kbps;
+
+            // Encode only, for the CPU cost and the bitrate reached
+            guint64 bytes = 0;
+            double cpu, wall;
+            bool ok = measure(source + " ! " + encode + " ! fakesink name=encoded",
+                              kbps, cpu, wall, &bytes);
+
+            // Encode and decode again next to the source for the quality
+            FrameComparator comparator;
+            if (ok) {
+                std::string compare = source +
+                    " ! tee name=t t. ! queue ! fakesink name=reference"
+                    " t. ! queue ! " + encode + " ! decodebin ! videoconvert"
+                    " ! video/x-raw,format=I420 ! fakesink name=decoded";
+                run_encode_pipeline(compare, kbps, &comparator, NULL);
+            }
+            g_free(encode);
+
+            if (!ok) {
+                g_print("%-6s %8d   failed\n", video_codec_name(codec), kbps);
+                continue;
+            }
+
+            point.actual_kbps = bytes * 8 / 1000.0 / duration;
+            point.cpu_cores = std::max(0.0, cpu - baseline_cpu) / duration;
+            point.encode_fps = frames / wall;
+            point.psnr = comparator.mean_psnr();
+            points.push_back(point);
+
+            g_print("%-6s %8d %8.0f %8.2f %8.1f %8.2f\n", video_codec_name(codec), kbps,
+                    point.actual_kbps, point.cpu_cores, point.encode_fps, point.psnr);
+        }
+    }
+
+    g_print("\n");
+    for (VideoCodec codec : codecs) {
+        if (codec != CODEC_H264) {
+            print_savings(points, codec);
+        }
+    }
+
+    if (csv_file) {
+        FILE *csv = fopen(csv_file, "w");
+        if (!csv) {
+            g_printerr("Failed to open %s\n", csv_file);
+            return 1;
+        }
+        fprintf(csv, "codec,target_kbps,kbps,cores,fps,psnr\n");
+        for (const CodecPoint& point : points) {
+            fprintf(csv, "%s,%d,%.1f,%.3f,%.1f,%.3f\n", video_codec_name(point.codec),
+                    point.target_kbps, point.actual_kbps, point.cpu_cores,
+                    point.encode_fps, point.psnr);
+        }
+        fclose(csv);
+    }
+    return 0;
+}
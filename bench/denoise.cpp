@@ -0,0 +1,196 @@
+#include "bench.h"
+#include "denoise.h"
+#include "scoring.h"
+
+#include <gst/video/video.h>
+#include <cmath>
+#include <vector>
+
+// Encodes a clip at a constant QP with and without the temporal
+// denoiser in front of the encoder. At equal QP the encoder spends
+// whatever bits the content needs, so the size difference is what the
+// noise cost and the filter's time is what removing it costs.
+
+static gchar *input_uri = NULL;
+static gint width = 1280;
+static gint height = 720;
+static gint frames = 250;
+static gint qp = 28;
+static gdouble added_noise = -1;
+
+static GOptionEntry denoise_entries[] = {
+    { "input", 'i', 0, G_OPTION_ARG_STRING, &input_uri,
+      "Night-time footage, any URI uridecodebin plays (default: test pattern)", "URI" },
+    { "width", 0, 0, G_OPTION_ARG_INT, &width, "Frame width (default: 1280)", "PX" },
+    { "height", 0, 0, G_OPTION_ARG_INT, &height, "Frame height (default: 720)", "PX" },
+    { "frames", 'n', 0, G_OPTION_ARG_INT, &frames,
+      "Frames to encode at 25 fps (default: 250)", "N" },
+    { "qp", 'q', 0, G_OPTION_ARG_INT, &qp, "Constant H.264 QP (default: 28)", "QP" },
+    { "noise", 0, 0, G_OPTION_ARG_DOUBLE, &added_noise,
+      "Gaussian sensor noise added before the filter, sigma in 8-bit levels "
+      "(default: 0, 6 for the test pattern)", "SIGMA" },
+    { NULL }
+};
+
+// Runs on the identity in front of the encoder
+struct Prefilter {
+    std::vector<gint8> noise; // empty adds none
+    bool denoise;
+    TemporalDenoiser denoiser;
+    GstVideoInfo info;
+    bool info_valid;
+    guint filtered;
+    gint64 filter_us;
+};
+
+static void add_noise(const std::vector<gint8>& noise, guint8 *data, gsize size) {
+    // A random window of the table per frame is random enough
+    gsize offset = g_random_int_range(0, noise.size());
+    for (gsize i = 0; i < size; i++) {
+        int value = data[i] + noise[(offset + i) % noise.size()];
+        data[i] = (guint8)CLAMP(value, 0, 255);
+    }
+}
+
+static GstPadProbeReturn on_prefilter(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    Prefilter *prefilter = static_cast<Prefilter*>(user_data);
+
+    if (!prefilter->info_valid) {
+        GstCaps *caps = gst_pad_get_current_caps(pad);
+        prefilter->info_valid = caps && gst_video_info_from_caps(&prefilter->info, caps);
+        if (caps) {
+            gst_caps_unref(caps);
+        }
+        if (!prefilter->info_valid) {
+            return GST_PAD_PROBE_OK;
+        }
+    }
+
+    GstBuffer *buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READWRITE)) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (!prefilter->noise.empty()) {
+        add_noise(prefilter->noise, map.data, map.size);
+    }
+    if (prefilter->denoise) {
+        gint64 started_us = g_get_monotonic_time();
+        if (prefilter->denoiser.estimate_due()) {
+            prefilter->denoiser.observe(map.data, &prefilter->info);
+        }
+        if (prefilter->denoiser.filter(map.data, &prefilter->info)) {
+            prefilter->filtered++;
+        }
+        prefilter->filter_us += g_get_monotonic_time() - started_us;
+    }
+    gst_buffer_unmap(buffer, &map);
+    return GST_PAD_PROBE_OK;
+}
+
+// Encoded bytes and process CPU seconds of one run
+static bool run_prefiltered(const std::string& description, Prefilter& prefilter,
+                            guint64& bytes, double& cpu_seconds) {
+    GError *err = NULL;
+    GstElement *pipeline = gst_parse_launch(description.c_str(), &err);
+    if (!pipeline) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return false;
+    }
+
+    GstElement *identity = gst_bin_get_by_name(GST_BIN(pipeline), "prefilter");
+    GstPad *pad = gst_element_get_static_pad(identity, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_prefilter, &prefilter, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(identity);
+
+    double cpu_start = process_cpu_seconds();
+    bytes = 0;
+    bool ok = run_encode_pipeline(pipeline, 0, NULL, &bytes);
+    cpu_seconds = process_cpu_seconds() - cpu_start;
+    return ok;
+}
+
+int run_denoise(int argc, char *argv[]) {
+    GOptionContext *context = g_option_context_new("- temporal denoise cost and bitrate saved");
+    g_option_context_add_main_entries(context, denoise_entries, NULL);
+
+    GError *err = NULL;
+    if (!g_option_context_parse(context, &argc, &argv, &err)) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    GstElementFactory *factory = gst_element_factory_find("openh264enc");
+    if (!factory) {
+        g_printerr("openh264enc is not installed\n");
+        return 1;
+    }
+    gst_object_unref(factory);
+
+    if (added_noise < 0) {
+        added_noise = input_uri ? 0 : 6;
+    }
+
+    // Box-Muller, 64k samples
+    std::vector<gint8> noise;
+    for (int i = 0; added_noise > 0 && i < 65536; i++) {
+        double u = 1.0 - g_random_double();
+        double sample = added_noise * sqrt(-2 * log(u)) * cos(2 * G_PI * g_random_double());
+        noise.push_back((gint8)CLAMP(lround(sample), -127, 127));
+    }
+
+    std::string source = clip_description(input_uri, width, height, frames) +
+                         " ! identity name=prefilter";
+    gchar *encode = g_strdup_printf(" ! openh264enc rate-control=off qp-min=%d qp-max=%d"
+                                    " ! h264parse ! fakesink name=encoded", qp, qp);
+    double duration = (double)frames / SCORING_FRAMERATE;
+
+    DenoiseConfig always;
+    always.mode = DENOISE_ON;
+
+    // Decoding, scaling and the added noise are the same in both runs
+    Prefilter runs[3];
+    guint64 bytes[3];
+    double cpu[3];
+    const std::string descriptions[3] = {
+        source + " ! fakesink", source + encode, source + encode
+    };
+    bool ok = true;
+    for (int i = 0; ok && i < 3; i++) {
+        runs[i].noise = noise;
+        runs[i].denoise = i == 2;
+        runs[i].denoiser.configure(always);
+        runs[i].info_valid = false;
+        runs[i].filtered = 0;
+        runs[i].filter_us = 0;
+        ok = run_prefiltered(descriptions[i], runs[i], bytes[i], cpu[i]);
+    }
+    g_free(encode);
+    if (!ok) {
+        return 1;
+    }
+
+    double plain_kbps = bytes[1] * 8 / 1000.0 / duration;
+    double denoised_kbps = bytes[2] * 8 / 1000.0 / duration;
+    double filter_ms = runs[2].filter_us / 1000.0 / MAX(runs[2].filtered, 1u);
+
+    g_print("%d frames of %dx%d at QP %d, %.1f levels of added noise\n",
+            frames, width, height, qp, added_noise);
+    g_print("estimated noise level   %8.2f\n", runs[2].denoiser.noise_level());
+    g_print("without denoise         %8.0f kbps %8.2f cores\n",
+            plain_kbps, (cpu[1] - cpu[0]) / duration);
+    g_print("with denoise            %8.0f kbps %8.2f cores\n",
+            denoised_kbps, (cpu[2] - cpu[0]) / duration);
+    g_print("denoise filter          %8.2f ms/frame, %.1f%% of a core at 25 fps\n",
+            filter_ms, filter_ms * SCORING_FRAMERATE / 10);
+    g_print("bitrate saved           %8.1f%%\n",
+            plain_kbps > 0 ? (1 - denoised_kbps / plain_kbps) * 100 : 0.0);
+    return 0;
+}
@@ -0,0 +1,218 @@
+#include "bench.h"
+#include "encoders.h"
+#include "scoring.h"
+#include "streamer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Runs footage through every rendition of a ladder at a sweep of
+// bitrates around the configured one and scores each encode against the
+// source scaled to the rendition size. The rate-distortion curves show
+// where more bitrate stops buying quality.
+
+static gchar *input_uri = NULL;
+static gchar *config_file = NULL;
+static gchar *camera_id = NULL;
+static gchar *ladder_text = NULL;
+static gint frames = 250;
+static gchar *step_list = NULL;
+static gboolean use_vmaf = FALSE;
+static gchar *vmaf_model = NULL;
+static gdouble saturation_db = 0.5;
+static gchar *csv_file = NULL;
+
+static GOptionEntry quality_entries[] = {
+    { "input", 'i', 0, G_OPTION_ARG_STRING, &input_uri,
+      "Recorded camera footage, any URI uridecodebin plays (default: test pattern)", "URI" },
+    { "config", 'c', 0, G_OPTION_ARG_FILENAME, &config_file,
+      "Take the ladder from a camera configuration file", "FILE" },
+    { "camera", 0, 0, G_OPTION_ARG_STRING, &camera_id,
+      "Camera of --config (default: the first)", "ID" },
+    { "renditions", 'r', 0, G_OPTION_ARG_STRING, &ladder_text,
+      "Ladder as in the config file, e.g. hd:1280x720@3000;sd:640x360@800", "LADDER" },
+    { "frames", 'n', 0, G_OPTION_ARG_INT, &frames,
+      "Frames to encode at 25 fps (default: 250)", "N" },
+    { "steps", 's', 0, G_OPTION_ARG_STRING, &step_list,
+      "Bitrates to try as fractions of the configured one "
+      "(default: 0.25,0.5,0.75,1,1.5)", "LIST" },
+    { "vmaf", 0, 0, G_OPTION_ARG_NONE, &use_vmaf,
+      "Also score with the vmaf element when it is installed", NULL },
+    { "vmaf-model", 0, 0, G_OPTION_ARG_FILENAME, &vmaf_model,
+      "VMAF model file (default: the element's)", "FILE" },
+    { "saturation-db", 0, 0, G_OPTION_ARG_DOUBLE, &saturation_db,
+      "PSNR gain per step below which quality counts as saturated (default: 0.5)", "DB" },
+    { "csv", 0, 0, G_OPTION_ARG_FILENAME, &csv_file,
+      "Also write the rate-distortion points to FILE", "FILE" },
+    { NULL }
+};
+
+struct RatePoint {
+    int target_kbps;
+    double kbps;
+    double psnr;
+    double ssim;
+    double vmaf; // -1 when not measured
+};
+
+static bool load_ladder(std::vector<RenditionConfig>& ladder) {
+    if (ladder_text) {
+        gchar **entries = g_strsplit(ladder_text, ";", -1);
+        bool ok = true;
+        for (gchar **entry = entries; ok && *entry; entry++) {
+            RenditionConfig rendition;
+            ok = parse_rendition(g_strstrip(*entry), rendition);
+            ladder.push_back(rendition);
+        }
+        g_strfreev(entries);
+        return ok;
+    }
+
+    if (config_file) {
+        std::vector<CameraConfig> cameras;
+        GeneralConfig general;
+        if (!load_camera_config(config_file, cameras, general)) {
+            return false;
+        }
+        for (const CameraConfig& camera : cameras) {
+            if (!camera_id || camera.id == camera_id) {
+                ladder = camera.renditions;
+                break;
+            }
+        }
+        if (camera_id && ladder.empty()) {
+            g_printerr("No camera %s with renditions in %s\n", camera_id, config_file);
+            return false;
+        }
+    }
+
+    if (ladder.empty()) {
+        ladder = RTSPDashStreamer::default_ladder();
+    }
+    return true;
+}
+
+static void print_saturation(const RenditionConfig& rendition, const std::vector<RatePoint>& curve) {
+    for (gsize i = 0; i + 1 < curve.size(); i++) {
+        if (curve[i + 1].psnr - curve[i].psnr < saturation_db) {
+            g_print("%s: quality saturates at about %d kbps (configured %d kbps), "
+                    "%d kbps more buy %.2f dB\n",
+                    rendition.name.c_str(), curve[i].target_kbps, rendition.bitrate,
+                    curve[i + 1].target_kbps - curve[i].target_kbps,
+                    curve[i + 1].psnr - curve[i].psnr);
+            return;
+        }
+    }
+    g_print("%s: still gaining %.1f dB or more per step at %d kbps\n",
+            rendition.name.c_str(), saturation_db,
+            curve.empty() ? rendition.bitrate : curve.back().target_kbps);
+}
+
+int run_quality(int argc, char *argv[]) {
+    GOptionContext *context = g_option_context_new("- rate-distortion benchmark of a ladder");
+    g_option_context_add_main_entries(context, quality_entries, NULL);
+
+    GError *err = NULL;
+    if (!g_option_context_parse(context, &argc, &argv, &err)) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    std::vector<RenditionConfig> ladder;
+    if (!load_ladder(ladder)) {
+        return 1;
+    }
+
+    std::vector<double> steps;
+    gchar **parts = g_strsplit(step_list ? step_list : "0.25,0.5,0.75,1,1.5", ",", -1);
+    for (gchar **part = parts; *part; part++) {
+        double step = g_ascii_strtod(*part, NULL);
+        if (step > 0) {
+            steps.push_back(step);
+        }
+    }
+    g_strfreev(parts);
+    std::sort(steps.begin(), steps.end());
+
+    bool vmaf = false;
+    if (use_vmaf) {
+        GstElementFactory *factory = gst_element_factory_find("vmaf");
+        vmaf = factory != NULL;
+        if (factory) {
+            gst_object_unref(factory);
+        } else {
+            g_print("vmaf element not installed, scoring PSNR and SSIM only\n");
+        }
+    }
+    if (!input_uri) {
+        g_print("No --input, a test pattern says little about camera footage\n");
+    }
+
+    FILE *csv = csv_file ? fopen(csv_file, "w") : NULL;
+    if (csv) {
+        fprintf(csv, "rendition,codec,width,height,target_kbps,kbps,psnr,ssim,vmaf\n");
+    }
+
+    double duration = (double)frames / SCORING_FRAMERATE;
+    std::vector<std::pair<RenditionConfig, std::vector<RatePoint>>> curves;
+
+    for (const RenditionConfig& rendition : ladder) {
+        if (!find_video_encoder(rendition.codec)) {
+            g_print("Skipping %s, no %s encoder installed\n",
+                    rendition.name.c_str(), video_codec_name(rendition.codec));
+            continue;
+        }
+
+        g_print("\n%s %dx%d %s, configured %d kbps\n", rendition.name.c_str(),
+                rendition.width, rendition.height, video_codec_name(rendition.codec),
+                rendition.bitrate);
+        g_print("%8s %8s %8s %8s %8s\n", "target", "kbps", "psnr", "ssim", "vmaf");
+
+        std::vector<RatePoint> curve;
+        for (double step : steps) {
+            RatePoint point = RatePoint();
+            point.target_kbps = (int)lround(rendition.bitrate * step);
+
+            FrameComparator comparator;
+            guint64 bytes = 0;
+            if (!run_encode_pipeline(rate_distortion_pipeline(input_uri, rendition, frames,
+                                                              vmaf, vmaf_model), point.target_kbps,
+                                     &comparator, &bytes) || comparator.frames() == 0) {
+                g_print("%8d   failed\n", point.target_kbps);
+                continue;
+            }
+
+            point.kbps = bytes * 8 / 1000.0 / duration;
+            point.psnr = comparator.mean_psnr();
+            point.ssim = comparator.mean_ssim();
+            point.vmaf = comparator.mean_vmaf();
+            curve.push_back(point);
+
+            g_print("%8d %8.0f %8.2f %8.4f %8.2f\n", point.target_kbps, point.kbps,
+                    point.psnr, point.ssim, point.vmaf);
+            if (csv) {
+                fprintf(csv, "%s,%s,%d,%d,%d,%.1f,%.3f,%.5f,%.3f\n", rendition.name.c_str(),
+                        video_codec_name(rendition.codec), rendition.width, rendition.height,
+                        point.target_kbps, point.kbps, point.psnr, point.ssim, point.vmaf);
+                fflush(csv);
+            }
+        }
+        curves.push_back(std::make_pair(rendition, curve));
+    }
+
+    g_print("\n");
+    for (const auto& curve : curves) {
+        print_saturation(curve.first, curve.second);
+    }
+
+    if (csv) {
+        fclose(csv);
+    }
+    return 0;
+}
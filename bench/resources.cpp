@@ -0,0 +1,119 @@
+#include "bench.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sys/resource.h>
+#include <unistd.h>
+
+void sample_process(ResourceSample& sample) {
+    // Resident pages are the second field of statm
+    unsigned long size = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%lu %lu", &size, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+    sample.rss_kb = (guint64)resident * sysconf(_SC_PAGESIZE) / 1024;
+
+    sample.fds = 0;
+    GDir *dir = g_dir_open("/proc/self/fd", 0, NULL);
+    if (dir) {
+        while (g_dir_read_name(dir)) {
+            sample.fds++;
+        }
+        g_dir_close(dir);
+        // The directory handle itself
+        sample.fds--;
+    }
+
+    sample.threads = 0;
+    gchar *status = NULL;
+    if (g_file_get_contents("/proc/self/status", &status, NULL, NULL)) {
+        const gchar *line = strstr(status, "\nThreads:");
+        if (line) {
+            sample.threads = strtoul(line + strlen("\nThreads:"), NULL, 10);
+        }
+        g_free(status);
+    }
+}
+
+static guint count_pads(GstElement *element) {
+    guint pads = 0;
+    GstIterator *it = gst_element_iterate_pads(element);
+    GValue item = G_VALUE_INIT;
+    bool done = false;
+
+    while (!done) {
+        switch (gst_iterator_next(it, &item)) {
+            case GST_ITERATOR_OK:
+                pads++;
+                g_value_reset(&item);
+                break;
+            case GST_ITERATOR_RESYNC:
+                pads = 0;
+                gst_iterator_resync(it);
+                break;
+            default:
+                done = true;
+                break;
+        }
+    }
+
+    g_value_unset(&item);
+    gst_iterator_free(it);
+    return pads;
+}
+
+void sample_pipeline(GstElement *bin, ResourceSample& sample) {
+    sample.elements = 1;
+    sample.pads = count_pads(bin);
+
+    GstIterator *it = gst_bin_iterate_recurse(GST_BIN(bin));
+    GValue item = G_VALUE_INIT;
+    bool done = false;
+
+    while (!done) {
+        switch (gst_iterator_next(it, &item)) {
+            case GST_ITERATOR_OK: {
+                GstElement *element = GST_ELEMENT(g_value_get_object(&item));
+                sample.elements++;
+                sample.pads += count_pads(element);
+                g_value_reset(&item);
+                break;
+            }
+            case GST_ITERATOR_RESYNC:
+                // The tree changed under us, start over
+                sample.elements = 1;
+                sample.pads = count_pads(bin);
+                gst_iterator_resync(it);
+                break;
+            default:
+                done = true;
+                break;
+        }
+    }
+
+    g_value_unset(&item);
+    gst_iterator_free(it);
+}
+
+std::string make_output_dir(const gchar *prefix) {
+    gchar *templ = g_strdup_printf("%s-XXXXXX", prefix);
+    gchar *path = g_dir_make_tmp(templ, NULL);
+    g_free(templ);
+
+    std::string dir = path ? path : "/tmp";
+    g_free(path);
+    return dir;
+}
+
+double process_cpu_seconds() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
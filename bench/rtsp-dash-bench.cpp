@@ -0,0 +1,50 @@
+#include "bench.h"
+
+#include <cstring>
+
+struct Subcommand {
+    const gchar *name;
+    int (*run)(int argc, char *argv[]);
+    const gchar *description;
+};
+
+static const Subcommand subcommands[] = {
+    { "soak", run_soak,
+      "Reconnect thousands of times and fail if resources grow" },
+    { "codecs", run_codecs,
+      "Compare CPU cost and bitrate of H.264, H.265 and AV1 renditions" },
+    { "quality", run_quality,
+      "Rate-distortion curves (PSNR, SSIM, VMAF) of a ladder on recorded footage" },
+    { "denoise", run_denoise,
+      "CPU cost of the temporal denoiser against the bitrate it saves" },
+    { "overlay", run_overlay,
+      "Per-frame cost of the privacy masks and timestamp overlay" },
+};
+
+static void print_usage(const gchar *program) {
+    g_print("Usage: %s <benchmark> [options]\n\n", program);
+    for (const Subcommand& subcommand : subcommands) {
+        g_print("  %-10s %s\n", subcommand.name, subcommand.description);
+    }
+    g_print("\nRun %s <benchmark> --help for its options\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    gst_init(&argc, &argv);
+
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    for (const Subcommand& subcommand : subcommands) {
+        if (strcmp(argv[1], subcommand.name) == 0) {
+            // The subcommand sees itself as argv[0]
+            return subcommand.run(argc - 1, argv + 1);
+        }
+    }
+
+    g_printerr("Unknown benchmark '%s'\n", argv[1]);
+    print_usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,267 @@
+#include "bench.h"
+#include "streamer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#ifdef HAVE_RTSP_SERVER
+#include <gst/rtsp-server/rtsp-server.h>
+#endif
+
+// Forces reconnect cycles through reconnect_rtsp_source -> pad-added ->
+// create_rtsp_decode_chain and checks that process and pipeline
+// resources settle instead of growing with the number of cycles.
+
+static gint cycles = 2000;
+static gint sample_every = 50;
+static gint port = 8554;
+static gchar *external_uri = NULL;
+static gchar *csv_file = NULL;
+static gdouble rss_tolerance = 0.05;
+
+static GOptionEntry soak_entries[] = {
+    { "cycles", 'n', 0, G_OPTION_ARG_INT, &cycles,
+      "Number of reconnect cycles (default: 2000)", "N" },
+    { "sample-every", 0, 0, G_OPTION_ARG_INT, &sample_every,
+      "Cycles between resource samples (default: 50)", "N" },
+    { "port", 'p', 0, G_OPTION_ARG_INT, &port,
+      "Port of the built-in RTSP stand-in (default: 8554)", "PORT" },
+    { "uri", 'u', 0, G_OPTION_ARG_STRING, &external_uri,
+      "Use an external RTSP server instead of the built-in one", "URI" },
+    { "csv", 0, 0, G_OPTION_ARG_FILENAME, &csv_file,
+      "Also write the samples to FILE", "FILE" },
+    { "rss-tolerance", 0, 0, G_OPTION_ARG_DOUBLE, &rss_tolerance,
+      "Allowed relative RSS growth (default: 0.05)", "FRACTION" },
+    { NULL }
+};
+
+#ifdef HAVE_RTSP_SERVER
+struct StandIn {
+    GMainContext *context;
+    GMainLoop *loop;
+    GThread *thread;
+};
+
+static gpointer stand_in_thread(gpointer user_data) {
+    StandIn *stand_in = static_cast<StandIn*>(user_data);
+    g_main_context_push_thread_default(stand_in->context);
+    g_main_loop_run(stand_in->loop);
+    g_main_context_pop_thread_default(stand_in->context);
+    return NULL;
+}
+
+// Small H.264 test stream served on its own thread
+static bool start_stand_in(StandIn& stand_in, std::string& uri) {
+    GstRTSPServer *server = gst_rtsp_server_new();
+    gchar *service = g_strdup_printf("%d", port);
+    g_object_set(server, "address", "127.0.0.1", "service", service, NULL);
+    g_free(service);
+
+    GstRTSPMediaFactory *factory = gst_rtsp_media_factory_new();
+    gst_rtsp_media_factory_set_launch(factory,
+        "( videotestsrc is-live=true pattern=ball "
+        "! video/x-raw,width=640,height=360,framerate=25/1 "
+        "! openh264enc gop-size=25 ! rtph264pay name=pay0 pt=96 config-interval=1 )");
+
+    GstRTSPMountPoints *mounts = gst_rtsp_server_get_mount_points(server);
+    gst_rtsp_mount_points_add_factory(mounts, "/soak", factory);
+    g_object_unref(mounts);
+
+    stand_in.context = g_main_context_new();
+    stand_in.loop = g_main_loop_new(stand_in.context, FALSE);
+    if (gst_rtsp_server_attach(server, stand_in.context) == 0) {
+        g_printerr("Failed to start RTSP stand-in on port %d\n", port);
+        g_object_unref(server);
+        return false;
+    }
+    g_object_unref(server);
+
+    stand_in.thread = g_thread_new("rtsp-stand-in", stand_in_thread, &stand_in);
+    uri = "rtsp://127.0.0.1:" + std::to_string(port) + "/soak";
+    return true;
+}
+
+static void stop_stand_in(StandIn& stand_in) {
+    g_main_loop_quit(stand_in.loop);
+    g_thread_join(stand_in.thread);
+    g_main_loop_unref(stand_in.loop);
+    g_main_context_unref(stand_in.context);
+}
+#endif
+
+static gpointer streamer_thread(gpointer user_data) {
+    static_cast<RTSPDashStreamer*>(user_data)->run();
+    return NULL;
+}
+
+// Waits until the streamer has completed more than connections sessions
+static bool wait_connected(RTSPDashStreamer& streamer, guint64 connections, gint64 timeout_us) {
+    gint64 deadline = g_get_monotonic_time() + timeout_us;
+    while (streamer.get_counters().connections <= connections) {
+        if (g_get_monotonic_time() > deadline) {
+            return false;
+        }
+        g_usleep(G_USEC_PER_SEC / 100);
+    }
+    return true;
+}
+
+template <typename T>
+static T max_of(const std::vector<ResourceSample>& samples, gsize from, gsize to,
+                T ResourceSample::*field) {
+    T value = 0;
+    for (gsize i = from; i < to; i++) {
+        value = std::max(value, samples[i].*field);
+    }
+    return value;
+}
+
+static double mean_rss(const std::vector<ResourceSample>& samples, gsize from, gsize to) {
+    double sum = 0;
+    for (gsize i = from; i < to; i++) {
+        sum += samples[i].rss_kb;
+    }
+    return to > from ? sum / (to - from) : 0;
+}
+
+// Compares the last quarter of the run against the first quarter, which
+// also absorbs one-time allocations of the first reconnects
+static bool check_growth(const std::vector<ResourceSample>& samples) {
+    gsize quarter = samples.size() / 4;
+    gsize tail = samples.size() - quarter;
+    bool ok = true;
+
+    struct { const gchar *name; guint ResourceSample::*field; } counts[] = {
+        { "elements", &ResourceSample::elements },
+        { "pads", &ResourceSample::pads },
+        { "fds", &ResourceSample::fds },
+        { "threads", &ResourceSample::threads },
+    };
+
+    for (auto& count : counts) {
+        guint head_max = max_of(samples, 0, quarter, count.field);
+        guint tail_max = max_of(samples, tail, samples.size(), count.field);
+        bool grew = tail_max > head_max;
+        g_print("%-8s first quarter max %6u, last quarter max %6u  %s\n",
+                count.name, head_max, tail_max, grew ? "GREW" : "ok");
+        ok = ok && !grew;
+    }
+
+    double head_rss = mean_rss(samples, 0, quarter);
+    double tail_rss = mean_rss(samples, tail, samples.size());
+    bool rss_grew = tail_rss > head_rss * (1.0 + rss_tolerance);
+    g_print("%-8s first quarter mean %6.0f kB, last quarter mean %6.0f kB  %s\n",
+            "rss", head_rss, tail_rss, rss_grew ? "GREW" : "ok");
+
+    return ok && !rss_grew;
+}
+
+int run_soak(int argc, char *argv[]) {
+    GOptionContext *context = g_option_context_new("- reconnect soak benchmark");
+    g_option_context_add_main_entries(context, soak_entries, NULL);
+
+    GError *err = NULL;
+    if (!g_option_context_parse(context, &argc, &argv, &err)) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    std::string uri;
+#ifdef HAVE_RTSP_SERVER
+    StandIn stand_in;
+    if (!external_uri && !start_stand_in(stand_in, uri)) {
+        return 1;
+    }
+#else
+    if (!external_uri) {
+        g_printerr("Built without gst-rtsp-server, pass --uri of a local RTSP server\n");
+        return 1;
+    }
+#endif
+    if (external_uri) {
+        uri = external_uri;
+    }
+
+    // One cheap rendition keeps the CPU out of the picture
+    CameraConfig camera;
+    camera.id = "soak";
+    camera.rtsp_uri = uri;
+    camera.output_path = make_output_dir("rtsp-dash-soak");
+    camera.renditions.push_back({"soak", 320, 180, 300, CODEC_H264});
+
+    RTSPDashStreamer streamer(camera);
+    if (!streamer.initialize() || !streamer.start()) {
+        g_printerr("Failed to start streamer\n");
+        return 1;
+    }
+    GThread *thread = g_thread_new("soak-streamer", streamer_thread, &streamer);
+
+    FILE *csv = csv_file ? fopen(csv_file, "w") : NULL;
+    if (csv) {
+        fprintf(csv, "cycle,rss_kb,fds,threads,elements,pads\n");
+    }
+
+    g_print("Soaking %d reconnect cycles against %s\n", cycles, uri.c_str());
+    g_print("%8s %10s %6s %8s %9s %6s\n", "cycle", "rss_kb", "fds", "threads", "elements", "pads");
+
+    std::vector<ResourceSample> samples;
+    guint failed_cycles = 0;
+    bool connected = wait_connected(streamer, 0, 20 * G_USEC_PER_SEC);
+
+    for (gint cycle = 1; connected && cycle <= cycles; cycle++) {
+        guint64 connections = streamer.get_counters().connections;
+        streamer.request_reconnect();
+        if (!wait_connected(streamer, connections, 15 * G_USEC_PER_SEC)) {
+            // Give the retry logic one more chance before giving up
+            failed_cycles++;
+            connected = wait_connected(streamer, connections, 30 * G_USEC_PER_SEC);
+        }
+
+        if (cycle % sample_every == 0) {
+            // Let the new session settle before counting
+            g_usleep(G_USEC_PER_SEC);
+
+            ResourceSample sample = ResourceSample();
+            sample_process(sample);
+            sample_pipeline(streamer.get_pipeline(), sample);
+            samples.push_back(sample);
+
+            g_print("%8d %10" G_GUINT64_FORMAT " %6u %8u %9u %6u\n", cycle,
+                    sample.rss_kb, sample.fds, sample.threads, sample.elements, sample.pads);
+            if (csv) {
+                fprintf(csv, "%d,%" G_GUINT64_FORMAT ",%u,%u,%u,%u\n", cycle,
+                        sample.rss_kb, sample.fds, sample.threads, sample.elements, sample.pads);
+                fflush(csv);
+            }
+        }
+    }
+
+    streamer.stop();
+    g_thread_join(thread);
+    if (csv) {
+        fclose(csv);
+    }
+#ifdef HAVE_RTSP_SERVER
+    if (!external_uri) {
+        stop_stand_in(stand_in);
+    }
+#endif
+
+    if (!connected) {
+        g_printerr("Stream did not come back, aborting after %zu samples\n", samples.size());
+        return 1;
+    }
+    if (samples.size() < 4) {
+        g_printerr("Need at least 4 samples, raise --cycles or lower --sample-every\n");
+        return 1;
+    }
+
+    g_print("\n%u of %d cycles timed out\n", failed_cycles, cycles);
+    bool ok = check_growth(samples) && failed_cycles * 100 <= (guint)cycles;
+    g_print("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
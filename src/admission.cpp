@@ -0,0 +1,283 @@
+#include "admission.h"
+
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Thread names are limited to 15 characters, "rdash-" and the id fit
+static const gchar THREAD_PREFIX[] = "rdash-";
+
+// CPU times tick at 100 Hz, so a few seconds keep the error small
+static const gint64 SAMPLE_INTERVAL_US = 10 * G_USEC_PER_SEC;
+
+// A new measurement moves the model by this much
+static const double MODEL_WEIGHT = 0.3;
+
+AdmissionControl& AdmissionControl::get() {
+    static AdmissionControl instance;
+    return instance;
+}
+
+void AdmissionControl::set_headroom(double fraction) {
+    std::lock_guard<std::mutex> guard(lock);
+    headroom = MIN(fraction, 0.95);
+}
+
+double AdmissionControl::project_locked(const std::string& key, double pixel_rate) {
+    auto cost = model.find(key);
+    return cost == model.end() ? 0 : cost->second.ns_per_pixel * pixel_rate / 1e9;
+}
+
+double AdmissionControl::project(const std::string& key, double pixel_rate,
+                                 double seed_ns_per_pixel) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto cost = model.find(key);
+    double ns_per_pixel = cost == model.end() ? seed_ns_per_pixel : cost->second.ns_per_pixel;
+    return ns_per_pixel * pixel_rate / 1e9;
+}
+
+double AdmissionControl::capacity_locked() {
+    return g_get_num_processors() * (1.0 - MAX(headroom, 0.0));
+}
+
+double AdmissionControl::projected_total_locked() {
+    double total = 0;
+    for (const auto& entry : reservations) {
+        total += project_locked(entry.second.key, entry.second.pixel_rate);
+    }
+    return total;
+}
+
+bool AdmissionControl::fits(double cores) {
+    std::lock_guard<std::mutex> guard(lock);
+    return headroom < 0 || projected_total_locked() + cores <= capacity_locked();
+}
+
+guint AdmissionControl::reserve(const std::string& key, double pixel_rate,
+                                double seed_ns_per_pixel) {
+    std::lock_guard<std::mutex> guard(lock);
+    Cost seed = { seed_ns_per_pixel, false };
+    model.insert(std::make_pair(key, seed));
+
+    guint id = next_id++;
+    Reservation& reservation = reservations[id];
+    reservation.key = key;
+    reservation.pixel_rate = pixel_rate;
+    reservation.pixels = reservation.pixels_sampled = 0;
+    reservation.ticks = 0;
+    reservation.measured_cores = -1;
+    return id;
+}
+
+void AdmissionControl::release(guint id) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto reservation = reservations.find(id);
+    if (reservation == reservations.end()) {
+        return;
+    }
+    for (int tid : reservation->second.threads) {
+        restore_thread_locked(id, tid);
+    }
+    reservations.erase(reservation);
+}
+
+void AdmissionControl::update(guint id, guint64 pixels, double pixel_rate) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto reservation = reservations.find(id);
+    if (reservation != reservations.end()) {
+        reservation->second.pixels = pixels;
+        reservation->second.pixel_rate = pixel_rate;
+    }
+}
+
+void AdmissionControl::tag_thread(guint id) {
+    std::lock_guard<std::mutex> guard(lock);
+    int tid = syscall(SYS_gettid);
+
+    // The name before the first tag is the one to restore, a thread
+    // retagged for another reservation is that one's now
+    if (!thread_names.count(tid)) {
+        gchar previous[16] = "";
+        prctl(PR_GET_NAME, previous, 0, 0, 0);
+        thread_names[tid] = previous;
+    }
+    for (auto& entry : reservations) {
+        std::vector<int>& threads = entry.second.threads;
+        threads.erase(std::remove(threads.begin(), threads.end(), tid), threads.end());
+    }
+
+    auto reservation = reservations.find(id);
+    if (reservation != reservations.end()) {
+        for (int thread : reservation->second.threads) {
+            restore_thread_locked(id, thread);
+        }
+        reservation->second.threads.assign(1, tid);
+    }
+
+    gchar name[16];
+    g_snprintf(name, sizeof(name), "%s%u", THREAD_PREFIX, id);
+    prctl(PR_SET_NAME, name, 0, 0, 0);
+}
+
+void AdmissionControl::restore_thread_locked(guint id, int tid) {
+    auto previous = thread_names.find(tid);
+    if (previous == thread_names.end()) {
+        return;
+    }
+
+    // Only while it still carries our tag: a thread tagged since belongs
+    // to another reservation, one that exited may have a reused id
+    gchar *path = g_strdup_printf("/proc/self/task/%d/comm", tid);
+    gchar *current = NULL;
+    gchar tag[16];
+    g_snprintf(tag, sizeof(tag), "%s%u", THREAD_PREFIX, id);
+    if (g_file_get_contents(path, &current, NULL, NULL) &&
+        g_strcmp0(g_strchomp(current), tag) == 0) {
+        // In place, g_file_set_contents() would rename over it
+        int fd = open(path, O_WRONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            if (write(fd, previous->second.c_str(), previous->second.size()) < 0) {
+                g_printerr("Failed to restore the name of thread %d: %s\n", tid, g_strerror(errno));
+            }
+            close(fd);
+        }
+    }
+    g_free(current);
+    g_free(path);
+    thread_names.erase(previous);
+}
+
+// Name and user plus system time of a thread from its stat file
+static bool read_thread_stat(const gchar *tid, std::string& name, guint64& ticks) {
+    gchar *path = g_strdup_printf("/proc/self/task/%s/stat", tid);
+    gchar *contents = NULL;
+    bool ok = g_file_get_contents(path, &contents, NULL, NULL);
+    g_free(path);
+    if (!ok) {
+        return false;
+    }
+
+    // The name is in parentheses and may contain both, so the fields
+    // are counted from the last ')': state is the first, utime the 12th
+    const gchar *open = strchr(contents, '(');
+    const gchar *close = strrchr(contents, ')');
+    ok = open && close && close > open;
+    if (ok) {
+        name.assign(open + 1, close - open - 1);
+        gchar **fields = g_strsplit(close + 2, " ", 14);
+        ok = g_strv_length(fields) >= 14;
+        if (ok) {
+            ticks = g_ascii_strtoull(fields[11], NULL, 10) + g_ascii_strtoull(fields[12], NULL, 10);
+        }
+        g_strfreev(fields);
+    }
+    g_free(contents);
+    return ok;
+}
+
+void AdmissionControl::sample() {
+    std::lock_guard<std::mutex> guard(lock);
+    gint64 now = g_get_monotonic_time();
+    if (sampled_us && now - sampled_us < SAMPLE_INTERVAL_US) {
+        return;
+    }
+    double seconds = sampled_us ? (now - sampled_us) / (double)G_USEC_PER_SEC : 0;
+    sampled_us = now;
+
+    // Threads that are new since the last sample ran only since then
+    std::map<int, guint64> seen;
+    GDir *dir = g_dir_open("/proc/self/task", 0, NULL);
+    const gchar *tid;
+    while (dir && (tid = g_dir_read_name(dir))) {
+        std::string name;
+        guint64 ticks;
+        if (!read_thread_stat(tid, name, ticks)) {
+            continue;
+        }
+        int key = atoi(tid);
+        auto last = thread_ticks.find(key);
+        guint64 delta = last != thread_ticks.end() && last->second <= ticks
+            ? ticks - last->second : ticks;
+        seen[key] = ticks;
+
+        if (g_str_has_prefix(name.c_str(), THREAD_PREFIX)) {
+            auto reservation = reservations.find(atoi(name.c_str() + strlen(THREAD_PREFIX)));
+            if (reservation != reservations.end()) {
+                reservation->second.ticks += delta;
+            }
+        }
+    }
+    if (dir) {
+        g_dir_close(dir);
+    }
+    thread_ticks.swap(seen);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    gint64 cpu_us = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC +
+                    usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    if (seconds > 0) {
+        process_cores = (cpu_us - process_cpu_us) / (seconds * G_USEC_PER_SEC);
+    }
+    process_cpu_us = cpu_us;
+
+    double tick_ns = 1e9 / sysconf(_SC_CLK_TCK);
+    for (auto& entry : reservations) {
+        Reservation& reservation = entry.second;
+        guint64 pixels = reservation.pixels - MIN(reservation.pixels_sampled, reservation.pixels);
+        double ns = reservation.ticks * tick_ns;
+        reservation.pixels_sampled = reservation.pixels;
+        reservation.ticks = 0;
+        if (seconds <= 0) {
+            continue;
+        }
+        reservation.measured_cores = ns / (seconds * 1e9);
+
+        // Idle work, e.g. a branch waiting for its first frame, says
+        // nothing about the cost of a pixel
+        if (pixels == 0 || ns <= 0) {
+            continue;
+        }
+        Cost& cost = model[reservation.key];
+        double measured = ns / pixels;
+        cost.ns_per_pixel = cost.measured
+            ? cost.ns_per_pixel + MODEL_WEIGHT * (measured - cost.ns_per_pixel)
+            : measured;
+        cost.measured = true;
+    }
+}
+
+double AdmissionControl::projected_cores(guint id) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto reservation = reservations.find(id);
+    return reservation == reservations.end() ? 0
+        : project_locked(reservation->second.key, reservation->second.pixel_rate);
+}
+
+double AdmissionControl::measured_cores(guint id) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto reservation = reservations.find(id);
+    return reservation == reservations.end() ? -1 : reservation->second.measured_cores;
+}
+
+double AdmissionControl::projected_total() {
+    std::lock_guard<std::mutex> guard(lock);
+    return projected_total_locked();
+}
+
+double AdmissionControl::measured_total() {
+    std::lock_guard<std::mutex> guard(lock);
+    return process_cores;
+}
+
+double AdmissionControl::capacity() {
+    std::lock_guard<std::mutex> guard(lock);
+    return capacity_locked();
+}
@@ -0,0 +1,101 @@
+#ifndef RTSP_DASH_ADMISSION_H
+#define RTSP_DASH_ADMISSION_H
+
+#include <glib.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// CPU cost model of the work in this process, and admission control on
+// top of it. Every camera input (decode and prefilters) and every
+// rendition holds a reservation. The streaming thread of a reservation is
+// named after it before its elements open, so the worker threads an
+// encoder or decoder starts inherit the name and count towards it too.
+// Streaming threads come from a pool and run other tasks later, so they
+// get their own name back when the reservation is released.
+// Sampling /proc/self/task yields nanoseconds per pixel for each cost
+// key, e.g. an encoder factory with its fixed live settings, and that
+// projects the load of new work before it is started. Keys not measured
+// yet use the seed their first user passed.
+class AdmissionControl {
+public:
+    // Shared by every streamer of the process
+    static AdmissionControl& get();
+
+    // Fraction of the CPUs kept free; negative disables admission, the
+    // load is measured either way
+    void set_headroom(double fraction);
+
+    // Cores pixel_rate (pixels per second) of key would take
+    double project(const std::string& key, double pixel_rate, double seed_ns_per_pixel);
+
+    // Whether cores more stay within the capacity
+    bool fits(double cores);
+
+    // Books work, returns the reservation id the threads are tagged with.
+    // Releasing it renames its tagged threads back.
+    guint reserve(const std::string& key, double pixel_rate, double seed_ns_per_pixel);
+    void release(guint id);
+
+    // Pixels processed so far and the current rate, before sample()
+    void update(guint id, guint64 pixels, double pixel_rate);
+
+    // Names the calling thread after the reservation; threads it starts
+    // from now on inherit the name. A thread tagged for the reservation
+    // before, e.g. the streaming thread of the last RTSP session, gets its
+    // own name back.
+    void tag_thread(guint id);
+
+    // Reads the CPU times of the process's threads, at most every
+    // SAMPLE_INTERVAL, and refines the model
+    void sample();
+
+    // Cores of a reservation: projected from the model, and measured over
+    // the last sample interval (negative until measured)
+    double projected_cores(guint id);
+    double measured_cores(guint id);
+
+    // Whole process: every reservation projected, all threads measured
+    double projected_total();
+    double measured_total();
+    double capacity();
+
+private:
+    struct Cost {
+        double ns_per_pixel;
+        bool measured;
+    };
+
+    struct Reservation {
+        std::string key;
+        double pixel_rate;
+        guint64 pixels;
+        guint64 pixels_sampled;
+        guint64 ticks; // CPU time since the last sample
+        double measured_cores;
+        std::vector<int> threads; // tagged, see tag_thread()
+    };
+
+    std::mutex lock;
+    double headroom = -1;
+    std::map<std::string, Cost> model;
+    std::map<guint, Reservation> reservations;
+    guint next_id = 1;
+
+    // Names of the tagged threads before their first tag
+    std::map<int, std::string> thread_names;
+
+    // Per thread CPU time at the last sample, in clock ticks
+    std::map<int, guint64> thread_ticks;
+    gint64 sampled_us = 0;
+    gint64 process_cpu_us = 0;
+    double process_cores = -1;
+
+    void restore_thread_locked(guint id, int tid);
+    double project_locked(const std::string& key, double pixel_rate);
+    double projected_total_locked();
+    double capacity_locked();
+};
+
+#endif // RTSP_DASH_ADMISSION_H
@@ -0,0 +1,185 @@
+#include "calibration.h"
+#include "encoders.h"
+#include "scoring.h"
+#include "streamer.h"
+
+#include <glib/gstdio.h>
+#include <cmath>
+
+// Copies the camera's video, as sent, into a Matroska file. rtspsrc
+// never ends by itself, so EOS is sent after seconds and the file is
+// complete once it reaches the sink.
+static bool record_camera(const CameraConfig& camera, int seconds, const gchar *path) {
+    std::string description = "rtspsrc name=src location=\"" + camera.rtsp_uri + "\"";
+    const gchar *protocols = transport_policy_protocols(camera.transport);
+    if (protocols) {
+        description += std::string(" protocols=") + protocols;
+    }
+    description += " ! application/x-rtp,media=video ! parsebin ! matroskamux"
+                   " ! filesink location=\"" + std::string(path) + "\"";
+
+    GError *err = NULL;
+    GstElement *pipeline = gst_parse_launch(description.c_str(), &err);
+    if (!pipeline) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return false;
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    GstBus *bus = gst_element_get_bus(pipeline);
+    gint64 deadline = g_get_monotonic_time() + (gint64)seconds * G_USEC_PER_SEC;
+    bool stopping = false;
+    bool ok = false;
+    bool done = false;
+    while (!done) {
+        GstClockTime timeout = GST_CLOCK_TIME_NONE;
+        if (!stopping) {
+            gint64 remaining = deadline - g_get_monotonic_time();
+            timeout = remaining > 0 ? remaining * GST_USECOND : 0;
+        }
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, timeout,
+            (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+        if (!msg) {
+            gst_element_send_event(pipeline, gst_event_new_eos());
+            stopping = true;
+            continue;
+        }
+        switch (GST_MESSAGE_TYPE(msg)) {
+            case GST_MESSAGE_EOS:
+                ok = stopping;
+                done = true;
+                break;
+            case GST_MESSAGE_ERROR: {
+                gchar *debug = NULL;
+                gst_message_parse_error(msg, &err, &debug);
+                g_printerr("Recording %s failed: %s\n", camera.id.c_str(), err->message);
+                g_error_free(err);
+                g_free(debug);
+                done = true;
+                break;
+            }
+            default:
+                break;
+        }
+        gst_message_unref(msg);
+    }
+    gst_object_unref(bus);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    if (ok) {
+        g_print("Camera %s: recorded %d s\n", camera.id.c_str(), seconds);
+    } else if (stopping) {
+        g_printerr("Camera %s ended before %d s were recorded\n", camera.id.c_str(), seconds);
+    }
+    return ok;
+}
+
+struct CalibrationPoint {
+    int kbps;          // target
+    double actual_kbps;
+    double psnr;
+    double ssim;
+};
+
+static bool encode_point(const gchar *uri, const RenditionConfig& rendition, int frames,
+                         int kbps, CalibrationPoint& point) {
+    FrameComparator comparator;
+    guint64 bytes = 0;
+    if (!run_encode_pipeline(rate_distortion_pipeline(uri, rendition, frames, false, NULL),
+                             kbps, &comparator, &bytes) || comparator.frames() == 0) {
+        return false;
+    }
+
+    point.kbps = kbps;
+    point.actual_kbps = bytes * 8 / 1000.0 / ((double)comparator.frames() / SCORING_FRAMERATE);
+    point.psnr = comparator.mean_psnr();
+    point.ssim = comparator.mean_ssim();
+    return true;
+}
+
+// Lowest step within the allowed loss of the configured bitrate, which
+// the ladder is never raised above
+static bool calibrate_rendition(const gchar *uri, const RenditionConfig& rendition, int frames,
+                                const CalibrationOptions& options, RenditionConfig& result,
+                                double& bits_per_pixel) {
+    CalibrationPoint reference;
+    if (!encode_point(uri, rendition, frames, rendition.bitrate, reference)) {
+        g_printerr("Failed to encode %s at %d kbps\n", rendition.name.c_str(), rendition.bitrate);
+        return false;
+    }
+    g_print("  %s: %d kbps %.2f dB %.4f SSIM (configured)\n", rendition.name.c_str(),
+            reference.kbps, reference.psnr, reference.ssim);
+
+    CalibrationPoint chosen = reference;
+    for (double step : options.steps) {
+        int kbps = (int)lround(rendition.bitrate * step);
+        if (kbps >= rendition.bitrate) {
+            break;
+        }
+
+        CalibrationPoint point;
+        if (!encode_point(uri, rendition, frames, kbps, point)) {
+            continue;
+        }
+        g_print("  %s: %d kbps %.2f dB %.4f SSIM\n", rendition.name.c_str(),
+                point.kbps, point.psnr, point.ssim);
+        if (point.psnr >= reference.psnr - options.max_psnr_loss &&
+            point.ssim >= reference.ssim - options.max_ssim_loss) {
+            chosen = point;
+            break;
+        }
+    }
+
+    result = rendition;
+    result.bitrate = chosen.kbps;
+    bits_per_pixel = chosen.actual_kbps * 1000.0 /
+                     ((double)rendition.width * rendition.height * SCORING_FRAMERATE);
+    return true;
+}
+
+bool calibrate_ladder(const CameraConfig& camera, const CalibrationOptions& options,
+                      std::vector<RenditionConfig>& ladder,
+                      std::vector<double>& bits_per_pixel) {
+    std::vector<RenditionConfig> configured = camera.renditions;
+    if (configured.empty()) {
+        configured = RTSPDashStreamer::default_ladder();
+    }
+
+    GError *err = NULL;
+    gchar *path = NULL;
+    gint fd = g_file_open_tmp("rtsp-dash-calibrate-XXXXXX.mkv", &path, &err);
+    if (fd < 0) {
+        g_printerr("Failed to create a recording file: %s\n", err->message);
+        g_error_free(err);
+        return false;
+    }
+    g_close(fd, NULL);
+
+    bool ok = record_camera(camera, options.seconds, path);
+    gchar *uri = ok ? g_filename_to_uri(path, NULL, NULL) : NULL;
+    int frames = options.seconds * SCORING_FRAMERATE;
+
+    ladder.clear();
+    bits_per_pixel.clear();
+    for (gsize i = 0; ok && i < configured.size(); i++) {
+        const RenditionConfig& rendition = configured[i];
+        RenditionConfig calibrated;
+        double complexity = 0;
+        if (!find_video_encoder(rendition.codec)) {
+            g_printerr("No %s encoder installed for %s\n",
+                       video_codec_name(rendition.codec), rendition.name.c_str());
+            ok = false;
+        } else {
+            ok = calibrate_rendition(uri, rendition, frames, options, calibrated, complexity);
+        }
+        ladder.push_back(calibrated);
+        bits_per_pixel.push_back(complexity);
+    }
+
+    g_free(uri);
+    g_unlink(path);
+    g_free(path);
+    return ok;
+}
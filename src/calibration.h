@@ -0,0 +1,26 @@
+#ifndef RTSP_DASH_CALIBRATION_H
+#define RTSP_DASH_CALIBRATION_H
+
+#include "config.h"
+
+#include <vector>
+
+// Bitrates fitted to what a camera actually sees: a parking lot at night
+// looks the same at half the bitrate a busy street needs.
+struct CalibrationOptions {
+    int seconds = 60; // camera footage recorded and encoded
+    // Fractions of the configured bitrate tried, lowest first
+    std::vector<double> steps = { 0.4, 0.55, 0.7, 0.85, 1.0 };
+    double max_psnr_loss = 0.3;   // dB below the configured bitrate
+    double max_ssim_loss = 0.005;
+};
+
+// Records the first options.seconds of camera, encodes every rendition
+// of its ladder at each step and keeps the lowest bitrate whose quality
+// stays within the allowed loss of the configured one. bits_per_pixel
+// gets the complexity measured at the chosen bitrate of every rendition.
+bool calibrate_ladder(const CameraConfig& camera, const CalibrationOptions& options,
+                      std::vector<RenditionConfig>& ladder,
+                      std::vector<double>& bits_per_pixel);
+
+#endif // RTSP_DASH_CALIBRATION_H
@@ -0,0 +1,613 @@
+#include "config.h"
+
+#include <glib.h>
+#include <cstdio>
+#include <cstring>
+
+bool parse_frame_region(const std::string& text, FrameRegion& region) {
+    int consumed = 0;
+    if (sscanf(text.c_str(), "%dx%d+%d+%d%n", &region.width, &region.height,
+               &region.x, &region.y, &consumed) != 4 ||
+        text[consumed] || region.width <= 0 || region.height <= 0 || region.x < 0 || region.y < 0) {
+        g_printerr("Invalid region '%s', expected WIDTHxHEIGHT+X+Y\n", text.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool parse_rendition(const std::string& text, RenditionConfig& rendition) {
+    char name[64];
+    int width, height, bitrate;
+    int consumed = 0;
+
+    if (sscanf(text.c_str(), "%63[^:]:%dx%d@%d%n", name, &width, &height, &bitrate, &consumed) != 4 ||
+        width <= 0 || height <= 0 || bitrate <= 0) {
+        g_printerr("Invalid rendition '%s', expected name:WIDTHxHEIGHT@KBPS[:CODEC][:crop=WxH+X+Y]\n",
+                   text.c_str());
+        return false;
+    }
+
+    // Optional codec and crop region, in any order
+    VideoCodec codec = CODEC_H264;
+    FrameRegion crop = FrameRegion();
+    const char *rest = text.c_str() + consumed;
+    bool ok = !*rest || *rest == ':';
+    gchar **options = g_strsplit(*rest ? rest + 1 : rest, ":", -1);
+    for (gchar **option = options; ok && *option; option++) {
+        if (g_str_has_prefix(*option, "crop=")) {
+            ok = parse_frame_region(*option + strlen("crop="), crop);
+        } else {
+            ok = parse_video_codec(*option, codec);
+        }
+    }
+    g_strfreev(options);
+    if (!ok) {
+        g_printerr("Invalid rendition '%s', expected name:WIDTHxHEIGHT@KBPS[:CODEC][:crop=WxH+X+Y]\n",
+                   text.c_str());
+        return false;
+    }
+
+    rendition.name = name;
+    rendition.width = width;
+    rendition.height = height;
+    rendition.bitrate = bitrate;
+    rendition.codec = codec;
+    rendition.crop = crop;
+    return true;
+}
+
+std::string format_rendition(const RenditionConfig& rendition) {
+    gchar *text = g_strdup_printf("%s:%dx%d@%d", rendition.name.c_str(),
+                                  rendition.width, rendition.height, rendition.bitrate);
+    std::string result = text;
+    g_free(text);
+    if (rendition.codec != CODEC_H264) {
+        result += std::string(":") + video_codec_name(rendition.codec);
+    }
+    if (rendition.crop.width > 0) {
+        gchar *crop = g_strdup_printf(":crop=%dx%d+%d+%d", rendition.crop.width,
+                                      rendition.crop.height, rendition.crop.x, rendition.crop.y);
+        result += crop;
+        g_free(crop);
+    }
+    return result;
+}
+
+bool parse_video_codec(const std::string& text, VideoCodec& codec) {
+    if (text == "h264") {
+        codec = CODEC_H264;
+    } else if (text == "h265" || text == "hevc") {
+        codec = CODEC_H265;
+    } else if (text == "av1") {
+        codec = CODEC_AV1;
+    } else {
+        g_printerr("Invalid codec '%s', expected h264, h265 or av1\n", text.c_str());
+        return false;
+    }
+    return true;
+}
+
+const char *video_codec_name(VideoCodec codec) {
+    switch (codec) {
+        case CODEC_H265:
+            return "h265";
+        case CODEC_AV1:
+            return "av1";
+        default:
+            return "h264";
+    }
+}
+
+static const struct {
+    const char *name;
+    TransportPolicy policy;
+    const char *protocols;
+} transport_policies[] = {
+    { "auto", TRANSPORT_AUTO, NULL },
+    { "multicast", TRANSPORT_MULTICAST, "udp-mcast+tcp" },
+    { "multicast-only", TRANSPORT_MULTICAST_ONLY, "udp-mcast" },
+    { "udp", TRANSPORT_UDP, "udp+tcp" },
+    { "tcp", TRANSPORT_TCP, "tcp" },
+};
+
+bool parse_transport_policy(const std::string& text, TransportPolicy& policy) {
+    for (const auto& entry : transport_policies) {
+        if (text == entry.name) {
+            policy = entry.policy;
+            return true;
+        }
+    }
+
+    g_printerr("Invalid transport '%s', expected auto, multicast, multicast-only, udp or tcp\n",
+               text.c_str());
+    return false;
+}
+
+const char *transport_policy_protocols(TransportPolicy policy) {
+    for (const auto& entry : transport_policies) {
+        if (entry.policy == policy) {
+            return entry.protocols;
+        }
+    }
+    return NULL;
+}
+
+const char *rtp_transport_name(RtpTransport transport) {
+    switch (transport) {
+        case RTP_TRANSPORT_UDP_MCAST:
+            return "udp-mcast";
+        case RTP_TRANSPORT_UDP:
+            return "udp";
+        case RTP_TRANSPORT_TCP:
+            return "tcp";
+        default:
+            return "none";
+    }
+}
+
+bool parse_thumbnail_format(const std::string& text, ThumbnailFormat& format) {
+    if (text == "jpeg" || text == "jpg") {
+        format = THUMBNAIL_JPEG;
+    } else if (text == "webp") {
+        format = THUMBNAIL_WEBP;
+    } else {
+        g_printerr("Invalid thumbnail-format '%s', expected jpeg or webp\n", text.c_str());
+        return false;
+    }
+    return true;
+}
+
+const char *thumbnail_format_extension(ThumbnailFormat format) {
+    return format == THUMBNAIL_WEBP ? "webp" : "jpg";
+}
+
+bool parse_denoise_mode(const std::string& text, DenoiseMode& mode) {
+    if (text == "off" || text == "false") {
+        mode = DENOISE_OFF;
+    } else if (text == "auto") {
+        mode = DENOISE_AUTO;
+    } else if (text == "on" || text == "true") {
+        mode = DENOISE_ON;
+    } else {
+        g_printerr("Invalid denoise '%s', expected off, auto or on\n", text.c_str());
+        return false;
+    }
+    return true;
+}
+
+const char *denoise_mode_name(DenoiseMode mode) {
+    switch (mode) {
+        case DENOISE_AUTO:
+            return "auto";
+        case DENOISE_ON:
+            return "on";
+        default:
+            return "off";
+    }
+}
+
+static int get_integer(GKeyFile *key_file, const gchar *group, const gchar *key,
+                       int default_value) {
+    if (!g_key_file_has_key(key_file, group, key, NULL)) {
+        return default_value;
+    }
+    return g_key_file_get_integer(key_file, group, key, NULL);
+}
+
+static bool get_boolean(GKeyFile *key_file, const gchar *group, const gchar *key,
+                        bool default_value) {
+    if (!g_key_file_has_key(key_file, group, key, NULL)) {
+        return default_value;
+    }
+    return g_key_file_get_boolean(key_file, group, key, NULL);
+}
+
+static bool load_camera(GKeyFile *key_file, const gchar *group,
+                        const std::string& output_root, CameraConfig& camera) {
+    camera.id = group + strlen("camera ");
+
+    gchar *uri = g_key_file_get_string(key_file, group, "uri", NULL);
+    if (!uri) {
+        g_printerr("Camera %s has no uri\n", camera.id.c_str());
+        return false;
+    }
+    camera.rtsp_uri = uri;
+    g_free(uri);
+
+    gchar *backup_uri = g_key_file_get_string(key_file, group, "backup-uri", NULL);
+    if (backup_uri) {
+        camera.backup_rtsp_uri = backup_uri;
+        g_free(backup_uri);
+    }
+
+    gchar *output = g_key_file_get_string(key_file, group, "output", NULL);
+    if (output) {
+        camera.output_path = output;
+        g_free(output);
+    } else if (!output_root.empty()) {
+        camera.output_path = output_root + "/" + camera.id;
+    } else {
+        g_printerr("Camera %s has no output and [general] has no output root\n",
+                   camera.id.c_str());
+        return false;
+    }
+
+    camera.latency_ms = get_integer(key_file, group, "latency", camera.latency_ms);
+    camera.min_latency_ms = get_integer(key_file, group, "latency-min", camera.min_latency_ms);
+    camera.max_latency_ms = get_integer(key_file, group, "latency-max", camera.max_latency_ms);
+    camera.adaptive_latency = get_boolean(key_file, group, "adaptive-latency",
+                                          camera.adaptive_latency);
+    if (camera.min_latency_ms > camera.max_latency_ms ||
+        camera.latency_ms < camera.min_latency_ms ||
+        camera.latency_ms > camera.max_latency_ms) {
+        g_printerr("Camera %s: latency must lie within latency-min and latency-max\n",
+                   camera.id.c_str());
+        return false;
+    }
+
+    camera.audio = get_boolean(key_file, group, "audio", camera.audio);
+    camera.audio_rate = get_integer(key_file, group, "audio-rate", camera.audio_rate);
+    camera.audio_channels = get_integer(key_file, group, "audio-channels", camera.audio_channels);
+    camera.audio_bitrate = get_integer(key_file, group, "audio-bitrate", camera.audio_bitrate);
+    if (camera.audio_rate <= 0 || camera.audio_bitrate <= 0 ||
+        camera.audio_channels < 1 || camera.audio_channels > 2) {
+        g_printerr("Camera %s: invalid audio-rate, audio-channels or audio-bitrate\n",
+                   camera.id.c_str());
+        return false;
+    }
+
+    gchar *transport = g_key_file_get_string(key_file, group, "transport", NULL);
+    if (transport) {
+        bool valid = parse_transport_policy(g_strstrip(transport), camera.transport);
+        g_free(transport);
+        if (!valid) {
+            return false;
+        }
+    }
+
+    gchar *iface = g_key_file_get_string(key_file, group, "multicast-iface", NULL);
+    if (iface) {
+        camera.multicast_iface = iface;
+        g_free(iface);
+    }
+
+    ThumbnailConfig& thumbnail = camera.thumbnail;
+    thumbnail.interval = get_integer(key_file, group, "thumbnail-interval", thumbnail.interval);
+    thumbnail.width = get_integer(key_file, group, "thumbnail-width", thumbnail.width);
+    if (thumbnail.interval < 0 || thumbnail.width <= 0) {
+        g_printerr("Camera %s: invalid thumbnail-interval or thumbnail-width\n",
+                   camera.id.c_str());
+        return false;
+    }
+
+    gchar *format = g_key_file_get_string(key_file, group, "thumbnail-format", NULL);
+    if (format) {
+        bool valid = parse_thumbnail_format(g_strstrip(format), thumbnail.format);
+        g_free(format);
+        if (!valid) {
+            return false;
+        }
+    }
+
+    // Next to the manifests unless configured otherwise
+    gchar *thumbnail_path = g_key_file_get_string(key_file, group, "thumbnail", NULL);
+    if (thumbnail_path) {
+        thumbnail.path = thumbnail_path;
+        g_free(thumbnail_path);
+    } else if (thumbnail.interval > 0) {
+        thumbnail.path = camera.output_path + "/thumbnail." +
+                         thumbnail_format_extension(thumbnail.format);
+    }
+
+    gchar *trickplay = g_key_file_get_string(key_file, group, "trickplay", NULL);
+    if (trickplay) {
+        camera.trickplay = g_strstrip(trickplay);
+        g_free(trickplay);
+    }
+
+    gchar *denoise = g_key_file_get_string(key_file, group, "denoise", NULL);
+    if (denoise) {
+        bool valid = parse_denoise_mode(g_strstrip(denoise), camera.denoise.mode);
+        g_free(denoise);
+        if (!valid) {
+            return false;
+        }
+    }
+    gchar **masks = g_key_file_get_string_list(key_file, group, "privacy-masks", NULL, NULL);
+    if (masks) {
+        for (gchar **entry = masks; *entry; entry++) {
+            FrameRegion mask;
+            if (!parse_frame_region(g_strstrip(*entry), mask)) {
+                g_strfreev(masks);
+                return false;
+            }
+            camera.privacy_masks.push_back(mask);
+        }
+        g_strfreev(masks);
+    }
+
+    camera.timestamp = get_boolean(key_file, group, "timestamp", camera.timestamp);
+    gchar *overlay_text = g_key_file_get_string(key_file, group, "overlay-text", NULL);
+    if (overlay_text) {
+        camera.overlay_text = overlay_text;
+        g_free(overlay_text);
+    } else {
+        camera.overlay_text = camera.id;
+    }
+
+    camera.on_demand = get_boolean(key_file, group, "on-demand", camera.on_demand);
+    camera.demand_idle = get_integer(key_file, group, "demand-idle", camera.demand_idle);
+    if (camera.demand_idle <= 0) {
+        g_printerr("Camera %s: demand-idle must be positive\n", camera.id.c_str());
+        return false;
+    }
+
+    if (g_key_file_has_key(key_file, group, "denoise-threshold", NULL)) {
+        camera.denoise.threshold = g_key_file_get_double(key_file, group, "denoise-threshold", NULL);
+        if (camera.denoise.threshold <= 0) {
+            g_printerr("Camera %s: denoise-threshold must be positive\n", camera.id.c_str());
+            return false;
+        }
+    }
+
+    gchar **renditions = g_key_file_get_string_list(key_file, group, "renditions", NULL, NULL);
+    if (renditions) {
+        for (gchar **entry = renditions; *entry; entry++) {
+            RenditionConfig rendition;
+            if (!parse_rendition(g_strstrip(*entry), rendition)) {
+                g_strfreev(renditions);
+                return false;
+            }
+            camera.renditions.push_back(rendition);
+        }
+        g_strfreev(renditions);
+    }
+
+    return true;
+}
+
+static std::vector<std::string> format_ladder(const std::vector<RenditionConfig>& ladder) {
+    std::vector<std::string> entries;
+    for (const RenditionConfig& rendition : ladder) {
+        entries.push_back(format_rendition(rendition));
+    }
+    return entries;
+}
+
+// A calibrated ladder only applies to the ladder it was measured for
+static void load_calibrated_ladder(GKeyFile *store, CameraConfig& camera) {
+    std::string group = "camera " + camera.id;
+    if (!g_key_file_has_group(store, group.c_str())) {
+        return;
+    }
+
+    gchar **configured = g_key_file_get_string_list(store, group.c_str(), "configured", NULL, NULL);
+    std::vector<std::string> measured;
+    for (gchar **entry = configured; entry && *entry; entry++) {
+        measured.push_back(g_strstrip(*entry));
+    }
+    g_strfreev(configured);
+    if (measured != format_ladder(camera.renditions)) {
+        g_printerr("Camera %s: ladder changed since calibration, run --calibrate again\n",
+                   camera.id.c_str());
+        return;
+    }
+
+    gchar **renditions = g_key_file_get_string_list(store, group.c_str(), "renditions", NULL, NULL);
+    std::vector<RenditionConfig> ladder;
+    bool ok = renditions != NULL;
+    for (gchar **entry = renditions; ok && *entry; entry++) {
+        RenditionConfig rendition;
+        ok = parse_rendition(g_strstrip(*entry), rendition);
+        ladder.push_back(rendition);
+    }
+    g_strfreev(renditions);
+
+    if (ok) {
+        camera.calibrated_renditions = ladder;
+    }
+}
+
+bool save_calibrated_ladder(const std::string& ladder_store, const CameraConfig& camera,
+                            const std::vector<RenditionConfig>& ladder,
+                            const std::vector<double>& bits_per_pixel) {
+    if (ladder_store.empty()) {
+        g_printerr("No ladder-store in [general] to save the ladder of %s\n", camera.id.c_str());
+        return false;
+    }
+
+    // Other cameras' entries and comments are kept
+    GKeyFile *store = g_key_file_new();
+    g_key_file_load_from_file(store, ladder_store.c_str(), G_KEY_FILE_KEEP_COMMENTS, NULL);
+
+    std::string group = "camera " + camera.id;
+    g_key_file_remove_group(store, group.c_str(), NULL);
+
+    std::vector<std::string> entries[] = { format_ladder(camera.renditions), format_ladder(ladder) };
+    const gchar *keys[] = { "configured", "renditions" };
+    for (int i = 0; i < 2; i++) {
+        std::vector<const gchar*> list;
+        for (const std::string& entry : entries[i]) {
+            list.push_back(entry.c_str());
+        }
+        g_key_file_set_string_list(store, group.c_str(), keys[i],
+                                   list.empty() ? NULL : &list[0], list.size());
+    }
+    g_key_file_set_double_list(store, group.c_str(), "bits-per-pixel",
+                               const_cast<gdouble*>(bits_per_pixel.data()), bits_per_pixel.size());
+
+    GDateTime *now = g_date_time_new_now_utc();
+    gchar *calibrated = g_date_time_format(now, "%Y-%m-%dT%H:%M:%SZ");
+    g_key_file_set_string(store, group.c_str(), "calibrated", calibrated);
+    g_free(calibrated);
+    g_date_time_unref(now);
+
+    GError *err = NULL;
+    bool ok = g_key_file_save_to_file(store, ladder_store.c_str(), &err);
+    if (!ok) {
+        g_printerr("Failed to save %s: %s\n", ladder_store.c_str(), err->message);
+        g_error_free(err);
+    }
+    g_key_file_free(store);
+    return ok;
+}
+
+static bool load_mosaic(GKeyFile *key_file, const std::string& output_root,
+                        const std::vector<CameraConfig>& cameras, MosaicConfig& mosaic) {
+    const gchar *group = "mosaic";
+
+    gchar **ids = g_key_file_get_string_list(key_file, group, "cameras", NULL, NULL);
+    if (ids) {
+        for (gchar **id = ids; *id; id++) {
+            mosaic.cameras.push_back(g_strstrip(*id));
+        }
+        g_strfreev(ids);
+    } else {
+        for (const CameraConfig& camera : cameras) {
+            mosaic.cameras.push_back(camera.id);
+        }
+    }
+    for (const std::string& id : mosaic.cameras) {
+        bool known = false;
+        for (const CameraConfig& camera : cameras) {
+            known = known || camera.id == id;
+        }
+        if (!known) {
+            g_printerr("Mosaic camera %s is not configured\n", id.c_str());
+            return false;
+        }
+    }
+
+    gchar *output = g_key_file_get_string(key_file, group, "output", NULL);
+    if (output) {
+        mosaic.output_path = output;
+        g_free(output);
+    } else if (!output_root.empty()) {
+        mosaic.output_path = output_root + "/mosaic";
+    } else {
+        g_printerr("[mosaic] has no output and [general] has no output root\n");
+        return false;
+    }
+
+    // Tiles hold whole chroma samples
+    gchar *tile = g_key_file_get_string(key_file, group, "tile", NULL);
+    if (tile) {
+        int consumed = 0;
+        bool valid = sscanf(tile, "%dx%d%n", &mosaic.tile_width, &mosaic.tile_height,
+                            &consumed) == 2 && !tile[consumed] &&
+                     mosaic.tile_width > 0 && mosaic.tile_height > 0 &&
+                     mosaic.tile_width % 2 == 0 && mosaic.tile_height % 2 == 0;
+        if (!valid) {
+            g_printerr("Invalid mosaic tile '%s', expected even WIDTHxHEIGHT\n", tile);
+        }
+        g_free(tile);
+        if (!valid) {
+            return false;
+        }
+    }
+
+    mosaic.columns = get_integer(key_file, group, "columns", mosaic.columns);
+    mosaic.bitrate = get_integer(key_file, group, "bitrate", mosaic.bitrate);
+    if (mosaic.columns < 0 || mosaic.bitrate <= 0) {
+        g_printerr("Invalid mosaic columns or bitrate\n");
+        return false;
+    }
+
+    gchar *codec = g_key_file_get_string(key_file, group, "codec", NULL);
+    if (codec) {
+        bool valid = parse_video_codec(g_strstrip(codec), mosaic.codec);
+        g_free(codec);
+        if (!valid) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool load_camera_config(const std::string& path, std::vector<CameraConfig>& cameras,
+                        GeneralConfig& general, MosaicConfig *mosaic) {
+    GKeyFile *key_file = g_key_file_new();
+    GError *err = NULL;
+
+    if (!g_key_file_load_from_file(key_file, path.c_str(), G_KEY_FILE_NONE, &err)) {
+        g_printerr("Failed to load %s: %s\n", path.c_str(), err->message);
+        g_error_free(err);
+        g_key_file_free(key_file);
+        return false;
+    }
+
+    std::string output_root;
+    gchar *root = g_key_file_get_string(key_file, "general", "output", NULL);
+    if (root) {
+        output_root = root;
+        g_free(root);
+    }
+
+    // Calibrated ladders, written by --calibrate
+    gchar *store_path = g_key_file_get_string(key_file, "general", "ladder-store", NULL);
+    if (store_path) {
+        general.ladder_store = store_path;
+        g_free(store_path);
+    }
+    gchar *timing_url = g_key_file_get_string(key_file, "general", "utc-timing", NULL);
+    if (timing_url) {
+        general.utc_timing = g_strstrip(timing_url);
+        g_free(timing_url);
+    }
+    if (g_key_file_has_key(key_file, "general", "cpu-headroom", NULL)) {
+        general.cpu_headroom = g_key_file_get_double(key_file, "general", "cpu-headroom", NULL);
+        if (general.cpu_headroom < 0 || general.cpu_headroom >= 1) {
+            g_printerr("cpu-headroom must be at least 0 and below 1\n");
+            g_key_file_free(key_file);
+            return false;
+        }
+    }
+
+    // Camera leases shared with the other nodes, see LeaseStore
+    gchar *lease_path = g_key_file_get_string(key_file, "general", "lease-store", NULL);
+    if (lease_path) {
+        general.lease_store = lease_path;
+        g_free(lease_path);
+    }
+    if (g_key_file_has_key(key_file, "general", "lease-ttl", NULL)) {
+        general.lease_ttl = g_key_file_get_integer(key_file, "general", "lease-ttl", NULL);
+        if (general.lease_ttl < 2) {
+            g_printerr("lease-ttl must be at least 2 seconds\n");
+            g_key_file_free(key_file);
+            return false;
+        }
+    }
+
+    GKeyFile *store = g_key_file_new();
+    bool have_store = !general.ladder_store.empty() &&
+        g_key_file_load_from_file(store, general.ladder_store.c_str(), G_KEY_FILE_NONE, NULL);
+
+    bool ok = true;
+    gchar **groups = g_key_file_get_groups(key_file, NULL);
+    for (gchar **group = groups; *group && ok; group++) {
+        if (!g_str_has_prefix(*group, "camera ")) {
+            continue;
+        }
+
+        CameraConfig camera;
+        ok = load_camera(key_file, *group, output_root, camera);
+        if (ok) {
+            if (have_store) {
+                load_calibrated_ladder(store, camera);
+            }
+            cameras.push_back(camera);
+        }
+    }
+    g_strfreev(groups);
+    g_key_file_free(store);
+
+    if (ok && cameras.empty()) {
+        g_printerr("No [camera <id>] groups in %s\n", path.c_str());
+        ok = false;
+    }
+    if (ok && mosaic && g_key_file_has_group(key_file, "mosaic")) {
+        ok = load_mosaic(key_file, output_root, cameras, *mosaic);
+    }
+    g_key_file_free(key_file);
+    return ok;
+}
@@ -0,0 +1,202 @@
+#ifndef RTSP_DASH_CONFIG_H
+#define RTSP_DASH_CONFIG_H
+
+#include <string>
+#include <vector>
+
+// Output codec of a rendition
+enum VideoCodec {
+    CODEC_H264, // openh264enc
+    CODEC_H265, // x265enc
+    CODEC_AV1   // svtav1enc, rav1enc or av1enc
+};
+
+// Rectangle of the camera frame in source pixels, the part a rendition
+// shows or a privacy mask
+struct FrameRegion {
+    int x;
+    int y;
+    int width; // 0 means the whole frame
+    int height;
+};
+
+// One entry of the output ladder
+struct RenditionConfig {
+    std::string name;
+    int width;
+    int height;
+    int bitrate; // kbps
+    VideoCodec codec;
+    FrameRegion crop;
+};
+
+// Which RTP transports rtspsrc may negotiate. Everything but
+// multicast-only and tcp falls back to TCP when UDP is refused or
+// blocked.
+enum TransportPolicy {
+    TRANSPORT_AUTO,           // rtspsrc default, the camera chooses
+    TRANSPORT_MULTICAST,      // multicast, else TCP
+    TRANSPORT_MULTICAST_ONLY, // shared feed or nothing
+    TRANSPORT_UDP,            // unicast UDP, else TCP
+    TRANSPORT_TCP             // interleaved in the RTSP connection
+};
+
+// Transport actually in use by the current RTSP session
+enum RtpTransport {
+    RTP_TRANSPORT_NONE,
+    RTP_TRANSPORT_UDP_MCAST,
+    RTP_TRANSPORT_UDP,
+    RTP_TRANSPORT_TCP
+};
+
+enum ThumbnailFormat {
+    THUMBNAIL_JPEG,
+    THUMBNAIL_WEBP
+};
+
+// Low-rate snapshots taken off the decoded stream
+struct ThumbnailConfig {
+    int interval = 0; // seconds, 0 disables the thumbnail branch
+    int width = 320;  // height follows the aspect ratio
+    ThumbnailFormat format = THUMBNAIL_JPEG;
+    std::string path; // empty keeps the image in memory only
+};
+
+enum DenoiseMode {
+    DENOISE_OFF,
+    DENOISE_AUTO, // follows the estimated noise level
+    DENOISE_ON
+};
+
+// Temporal prefilter in front of the tee, see TemporalDenoiser
+struct DenoiseConfig {
+    DenoiseMode mode = DENOISE_OFF;
+    double threshold = 4.0; // noise sigma (8-bit luma levels) that enables auto
+};
+
+// Node-wide settings from the [general] group
+struct GeneralConfig {
+    std::string ladder_store; // calibrated ladders, written by --calibrate
+
+    // Time endpoint (urn:mpeg:dash:utc:http-iso:2014) the manifests'
+    // UTCTiming points players to; the manifests carry no timing
+    // elements without it
+    std::string utc_timing;
+
+    // Fraction of the CPUs new cameras and renditions must leave free;
+    // negative disables admission control
+    double cpu_headroom = -1;
+
+    // Shared lease file and lease lifetime in seconds for --shard
+    std::string lease_store;
+    int lease_ttl = 5;
+};
+
+// Everything needed to run one camera
+struct CameraConfig {
+    std::string id;
+    std::string rtsp_uri;
+    std::string backup_rtsp_uri; // optional hot standby, e.g. an NVR re-stream
+    std::string output_path;
+    std::vector<RenditionConfig> renditions; // empty means default ladder
+
+    // Same ladder with bitrates fitted to this camera by --calibrate,
+    // used instead of renditions when present, see load_camera_config()
+    std::vector<RenditionConfig> calibrated_renditions;
+
+    // Jitterbuffer latency: initial value and bounds for adaptation
+    int latency_ms = 200;
+    int min_latency_ms = 50;
+    int max_latency_ms = 2000;
+    bool adaptive_latency = true;
+
+    TransportPolicy transport = TRANSPORT_AUTO;
+    std::string multicast_iface; // empty means the default route
+
+    // AAC audio encoded once and muxed by every rendition; camera AAC in
+    // this format is passed through, anything else is transcoded
+    bool audio = true;
+    int audio_rate = 16000;
+    int audio_channels = 1;
+    int audio_bitrate = 32; // kbps
+
+    ThumbnailConfig thumbnail;
+
+    // Rendition that also gets an I-frame-only trick play Representation
+    std::string trickplay;
+
+    DenoiseConfig denoise;
+
+    // Burned into every rendition before the tee, see FrameOverlay
+    std::vector<FrameRegion> privacy_masks;
+    bool timestamp = false;
+    std::string overlay_text; // after the timestamp, defaults to the id
+
+    // Renditions are only encoded while their manifest is being fetched
+    // and stopped after demand_idle seconds without a request
+    bool on_demand = false;
+    int demand_idle = 60;
+};
+
+// Control room grid of the cameras' smallest renditions, encoded as a
+// stream of its own, see MosaicComposer
+struct MosaicConfig {
+    std::vector<std::string> cameras; // camera ids in tile order, empty disables it
+    std::string output_path;
+    int columns = 0; // 0 for the smallest square grid
+    int tile_width = 480;
+    int tile_height = 270;
+    int bitrate = 4000; // kbps
+    VideoCodec codec = CODEC_H264;
+};
+
+// Parses a "name:WIDTHxHEIGHT@KBPS[:CODEC][:crop=WxH+X+Y]" ladder entry
+bool parse_rendition(const std::string& text, RenditionConfig& rendition);
+
+// Inverse of parse_rendition(), the codec is only written when not H.264
+std::string format_rendition(const RenditionConfig& rendition);
+
+// Parses a WIDTHxHEIGHT+X+Y region
+bool parse_frame_region(const std::string& text, FrameRegion& region);
+
+// Parses h264, h265 (or hevc) and av1
+bool parse_video_codec(const std::string& text, VideoCodec& codec);
+
+const char *video_codec_name(VideoCodec codec);
+
+// Parses the "transport" key: auto, multicast, multicast-only, udp or tcp
+bool parse_transport_policy(const std::string& text, TransportPolicy& policy);
+
+// rtspsrc "protocols" flags for a policy, NULL for the element default
+const char *transport_policy_protocols(TransportPolicy policy);
+
+const char *rtp_transport_name(RtpTransport transport);
+
+// Parses the "thumbnail-format" key: jpeg or webp
+bool parse_thumbnail_format(const std::string& text, ThumbnailFormat& format);
+
+// File extension without the dot, also used for the default path
+const char *thumbnail_format_extension(ThumbnailFormat format);
+
+// Parses the "denoise" key: off, auto or on
+bool parse_denoise_mode(const std::string& text, DenoiseMode& mode);
+
+const char *denoise_mode_name(DenoiseMode mode);
+
+// Loads every [camera <id>] group of a key file. The optional [general]
+// group provides an output root used when a camera has no "output" key
+// and a ladder store whose calibrated ladders are applied to cameras
+// whose configured ladder has not changed since calibration. The rest of
+// [general] goes to general. A [mosaic] group is loaded into mosaic when
+// given; its cameras default to all.
+bool load_camera_config(const std::string& path, std::vector<CameraConfig>& cameras,
+                        GeneralConfig& general, MosaicConfig *mosaic = nullptr);
+
+// Records a calibrated ladder for camera in the ladder store, along with
+// the configured ladder it was derived from and the measured complexity
+// (bits per pixel) of every rendition
+bool save_calibrated_ladder(const std::string& ladder_store, const CameraConfig& camera,
+                            const std::vector<RenditionConfig>& ladder,
+                            const std::vector<double>& bits_per_pixel);
+
+#endif // RTSP_DASH_CONFIG_H
@@ -0,0 +1,135 @@
+#include "denoise.h"
+
+#include <cmath>
+#include <cstdlib>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Frames between noise estimates, about a second of video
+static const guint ESTIMATE_INTERVAL = 25;
+
+void temporal_denoise_row(guint8 *row, guint8 *previous, int width, guint8 threshold) {
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i limit = _mm_set1_epi8((char)threshold);
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16) {
+        __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i*>(previous + x));
+        __m128i diff = _mm_or_si128(_mm_subs_epu8(cur, prev), _mm_subs_epu8(prev, cur));
+        // All ones where the difference lies within the noise band
+        __m128i still = _mm_cmpeq_epi8(_mm_subs_epu8(diff, limit), zero);
+        __m128i out = _mm_or_si128(_mm_and_si128(still, _mm_avg_epu8(cur, prev)),
+                                   _mm_andnot_si128(still, cur));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row + x), out);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(previous + x), out);
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t limit = vdupq_n_u8(threshold);
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t cur = vld1q_u8(row + x);
+        uint8x16_t prev = vld1q_u8(previous + x);
+        uint8x16_t still = vcleq_u8(vabdq_u8(cur, prev), limit);
+        uint8x16_t out = vbslq_u8(still, vrhaddq_u8(cur, prev), cur);
+        vst1q_u8(row + x, out);
+        vst1q_u8(previous + x, out);
+    }
+#endif
+    // Same rounding as the vector averages
+    for (; x < width; x++) {
+        int diff = abs(row[x] - previous[x]);
+        guint8 out = diff <= threshold ? (guint8)((row[x] + previous[x] + 1) >> 1) : row[x];
+        row[x] = previous[x] = out;
+    }
+}
+
+double estimate_plane_noise(const guint8 *plane, int stride, int width, int height) {
+    guint64 sum = 0;
+    guint64 count = 0;
+    for (int y = 1; y + 1 < height; y += 4) {
+        const guint8 *above = plane + (y - 1) * stride;
+        const guint8 *row = above + stride;
+        const guint8 *below = row + stride;
+        for (int x = 1; x + 1 < width; x++) {
+            int laplace = above[x - 1] - 2 * above[x] + above[x + 1]
+                        - 2 * row[x - 1] + 4 * row[x] - 2 * row[x + 1]
+                        + below[x - 1] - 2 * below[x] + below[x + 1];
+            sum += abs(laplace);
+        }
+        count += width - 2;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    return sqrt(G_PI / 2) * sum / (6.0 * count);
+}
+
+void TemporalDenoiser::configure(const DenoiseConfig& denoise) {
+    config = denoise;
+    active = config.mode == DENOISE_ON;
+}
+
+void TemporalDenoiser::reset() {
+    primed = false;
+}
+
+bool TemporalDenoiser::estimate_due() {
+    return config.mode != DENOISE_OFF && frame_count++ % ESTIMATE_INTERVAL == 0;
+}
+
+void TemporalDenoiser::observe(const guint8 *data, const GstVideoInfo *info) {
+    double sigma = estimate_plane_noise(data + GST_VIDEO_INFO_PLANE_OFFSET(info, 0),
+                                        GST_VIDEO_INFO_PLANE_STRIDE(info, 0),
+                                        GST_VIDEO_INFO_WIDTH(info),
+                                        GST_VIDEO_INFO_HEIGHT(info));
+    // Smoothed so a single busy frame does not toggle the filter
+    double level = frame_count <= 1 ? sigma : 0.7 * noise + 0.3 * sigma;
+    noise = level;
+
+    // Two frames of pure noise differ by sigma * sqrt(2) on average
+    strength = (guint8)CLAMP(lround(2.5 * level), 2, 32);
+
+    if (config.mode != DENOISE_AUTO) {
+        return;
+    }
+    if (!active && level > config.threshold) {
+        g_print("Noise level %.1f, temporal denoise on\n", level);
+        primed = false;
+        active = true;
+    } else if (active && level < 0.75 * config.threshold) {
+        g_print("Noise level %.1f, temporal denoise off\n", level);
+        active = false;
+    }
+}
+
+bool TemporalDenoiser::filter(guint8 *data, const GstVideoInfo *info) {
+    int width = GST_VIDEO_INFO_WIDTH(info);
+    int height = GST_VIDEO_INFO_HEIGHT(info);
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    gsize size = GST_VIDEO_INFO_PLANE_OFFSET(info, 2) +
+                 (gsize)GST_VIDEO_INFO_PLANE_STRIDE(info, 2) * chroma_height;
+
+    // The reference has the frame's layout so rows line up by offset
+    if (!primed || previous.size() != size) {
+        previous.assign(data, data + size);
+        primed = true;
+        return false;
+    }
+
+    for (int plane = 0; plane < 3; plane++) {
+        int stride = GST_VIDEO_INFO_PLANE_STRIDE(info, plane);
+        gsize offset = GST_VIDEO_INFO_PLANE_OFFSET(info, plane);
+        int plane_width = plane ? chroma_width : width;
+        int plane_height = plane ? chroma_height : height;
+        for (int y = 0; y < plane_height; y++) {
+            gsize row = offset + (gsize)y * stride;
+            temporal_denoise_row(data + row, &previous[row], plane_width, strength);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef RTSP_DASH_DENOISE_H
+#define RTSP_DASH_DENOISE_H
+
+#include "config.h"
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <atomic>
+#include <vector>
+
+// Sensor noise at night changes from frame to frame, so the encoder
+// spends its bitrate on it. Averaging each pixel with its previous
+// output wherever the two differ by no more than the noise band keeps
+// static areas stable while moving edges pass untouched.
+
+// Filters one row in place against previous, which receives the output.
+// Pixels differing by at most threshold are averaged, others kept.
+void temporal_denoise_row(guint8 *row, guint8 *previous, int width, guint8 threshold);
+
+// Standard deviation of the noise of an 8-bit plane in levels, from
+// Immerkær's Laplacian difference mask on every fourth row
+double estimate_plane_noise(const guint8 *plane, int stride, int width, int height);
+
+// Motion-adaptive recursive filter for I420 frames. The noise level is
+// estimated about once a second; in auto mode the filter turns on above
+// the configured threshold and off again below three quarters of it.
+// Called from the streaming thread only, the getters from anywhere.
+class TemporalDenoiser {
+public:
+    void configure(const DenoiseConfig& config);
+
+    // New caps or source, the next frame starts a new reference
+    void reset();
+
+    // Whether observe() wants to see the next frame
+    bool estimate_due();
+    void observe(const guint8 *data, const GstVideoInfo *info);
+
+    bool is_active() const { return active; }
+    double noise_level() const { return noise; }
+
+    // Filters a writable frame, false for the frame that primes the
+    // reference
+    bool filter(guint8 *data, const GstVideoInfo *info);
+
+private:
+    DenoiseConfig config;
+    std::atomic<bool> active{false};
+    std::atomic<double> noise{0};
+    guint frame_count = 0;
+    guint8 strength = 0;
+    bool primed = false;
+    std::vector<guint8> previous;
+};
+
+#endif // RTSP_DASH_DENOISE_H
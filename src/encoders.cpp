@@ -0,0 +1,96 @@
+#include "encoders.h"
+
+#include <cstring>
+
+static const struct {
+    VideoCodec codec;
+    const gchar *factory;
+    const gchar *bitrate_property;
+    int bitrate_scale; // property units per kbps
+} encoders[] = {
+    { CODEC_H264, "openh264enc", "bitrate", 1000 },
+    { CODEC_H265, "x265enc", "bitrate", 1 },
+    { CODEC_AV1, "svtav1enc", "target-bitrate", 1 },
+    { CODEC_AV1, "rav1enc", "bitrate", 1000 },
+    { CODEC_AV1, "av1enc", "target-bitrate", 1 },
+};
+
+const gchar *find_video_encoder(VideoCodec codec) {
+    for (const auto& entry : encoders) {
+        if (entry.codec != codec) {
+            continue;
+        }
+        GstElementFactory *factory = gst_element_factory_find(entry.factory);
+        if (factory) {
+            gst_object_unref(factory);
+            return entry.factory;
+        }
+    }
+    return NULL;
+}
+
+const gchar *video_parser_factory(VideoCodec codec) {
+    switch (codec) {
+        case CODEC_H265:
+            return "h265parse";
+        case CODEC_AV1:
+            return "av1parse";
+        default:
+            return "h264parse";
+    }
+}
+
+GstElement *make_video_encoder(VideoCodec codec, const gchar *name, int kbps) {
+    const gchar *factory = find_video_encoder(codec);
+    if (!factory) {
+        return NULL;
+    }
+
+    GstElement *encoder = gst_element_factory_make(factory, name);
+    if (encoder) {
+        configure_video_encoder(encoder, kbps);
+    }
+    return encoder;
+}
+
+static void set_if_present(GstElement *encoder, const gchar *property, const gchar *value) {
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(encoder), property)) {
+        gst_util_set_object_arg(G_OBJECT(encoder), property, value);
+    }
+}
+
+void configure_video_encoder(GstElement *encoder, int kbps) {
+    GstElementFactory *factory = gst_element_get_factory(encoder);
+    const gchar *name = factory ? gst_plugin_feature_get_name(factory) : "";
+
+    // openh264enc is real-time as configured by default; the others
+    // default to offline presets that can't keep up with a camera
+    if (strcmp(name, "x265enc") == 0) {
+        set_if_present(encoder, "speed-preset", "superfast");
+        set_if_present(encoder, "tune", "zerolatency");
+    } else if (strcmp(name, "svtav1enc") == 0) {
+        set_if_present(encoder, "preset", "10");
+    } else if (strcmp(name, "rav1enc") == 0) {
+        set_if_present(encoder, "speed-preset", "10");
+        set_if_present(encoder, "low-latency", "true");
+    } else if (strcmp(name, "av1enc") == 0) {
+        set_if_present(encoder, "cpu-used", "8");
+        set_if_present(encoder, "usage-profile", "realtime");
+        set_if_present(encoder, "end-usage", "cbr");
+    }
+
+    set_encoder_bitrate(encoder, kbps);
+}
+
+void set_encoder_bitrate(GstElement *encoder, int kbps) {
+    GstElementFactory *factory = gst_element_get_factory(encoder);
+    const gchar *name = factory ? gst_plugin_feature_get_name(factory) : "";
+
+    for (const auto& entry : encoders) {
+        if (strcmp(name, entry.factory) == 0) {
+            g_object_set(encoder, entry.bitrate_property,
+                         (guint)(kbps * entry.bitrate_scale), NULL);
+            return;
+        }
+    }
+}
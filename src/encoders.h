@@ -0,0 +1,29 @@
+#ifndef RTSP_DASH_ENCODERS_H
+#define RTSP_DASH_ENCODERS_H
+
+#include "config.h"
+
+#include <gst/gst.h>
+
+// Encoders differ in factory, bitrate unit and latency knobs; everything
+// that builds an encode chain goes through these helpers so the streamer
+// and the benchmarks configure them the same way.
+
+// First installed encoder factory for codec, NULL when there is none
+const gchar *find_video_encoder(VideoCodec codec);
+
+// Parser that turns encoder output into what dashsink's muxer expects
+const gchar *video_parser_factory(VideoCodec codec);
+
+// Creates the encoder for codec configured for live use at kbps,
+// NULL when no encoder for it is installed
+GstElement *make_video_encoder(VideoCodec codec, const gchar *name, int kbps);
+
+// Low-latency settings and the target bitrate for an encoder created by
+// name, e.g. from a launch line
+void configure_video_encoder(GstElement *encoder, int kbps);
+
+// Changes the target bitrate, in the unit the encoder expects
+void set_encoder_bitrate(GstElement *encoder, int kbps);
+
+#endif // RTSP_DASH_ENCODERS_H
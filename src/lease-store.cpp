@@ -0,0 +1,287 @@
+#include "lease-store.h"
+
+#include <sys/file.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <map>
+
+static const gchar NODE_PREFIX[] = "node ";
+static const gchar CAMERA_PREFIX[] = "camera ";
+
+// A handover target that wrote no segment by then is given up on
+static const gint64 HANDOVER_TIMEOUT_MS = 30000;
+
+LeaseStore::LeaseStore(const std::string& path, const std::string& node, int ttl_seconds)
+    : path(path), lock_path(path + ".lock"), node(node), ttl_ms(ttl_seconds * 1000LL),
+      joined_ms(g_get_real_time() / 1000) {
+}
+
+template <typename Update> bool LeaseStore::transact(Update update) {
+    int fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        g_printerr("Failed to open lease lock %s: %s\n", lock_path.c_str(), g_strerror(errno));
+        return false;
+    }
+    if (flock(fd, LOCK_EX) < 0) {
+        g_printerr("Failed to lock %s: %s\n", lock_path.c_str(), g_strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    GKeyFile *file = g_key_file_new();
+    GError *error = NULL;
+    bool ok = g_key_file_load_from_file(file, path.c_str(), G_KEY_FILE_NONE, &error) ||
+              g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+    if (!ok) {
+        g_printerr("Failed to read lease store %s: %s\n", path.c_str(), error->message);
+    }
+    g_clear_error(&error);
+
+    if (ok) {
+        update(file, g_get_real_time() / 1000);
+        // Written to a temporary file and renamed, readers never see half of it
+        ok = g_key_file_save_to_file(file, path.c_str(), &error);
+        if (!ok) {
+            g_printerr("Failed to write lease store %s: %s\n", path.c_str(), error->message);
+            g_clear_error(&error);
+        }
+    }
+    g_key_file_free(file);
+    close(fd);
+    return ok;
+}
+
+static std::string camera_group(const std::string& id) {
+    return CAMERA_PREFIX + id;
+}
+
+static std::string get_key(GKeyFile *file, const std::string& group, const gchar *key) {
+    gchar *value = g_key_file_get_string(file, group.c_str(), key, NULL);
+    std::string result = value ? value : "";
+    g_free(value);
+    return result;
+}
+
+static std::string owner_of(GKeyFile *file, const std::string& group) {
+    return get_key(file, group, "owner");
+}
+
+static std::string handover_target(GKeyFile *file, const std::string& group) {
+    return get_key(file, group, "handover-to");
+}
+
+static void clear_handover(GKeyFile *file, const std::string& group) {
+    g_key_file_remove_key(file, group.c_str(), "handover-to", NULL);
+    g_key_file_remove_key(file, group.c_str(), "handover-since", NULL);
+    g_key_file_remove_key(file, group.c_str(), "handover-ready", NULL);
+}
+
+static void clear_lease(GKeyFile *file, const std::string& group, gint64 now) {
+    g_key_file_set_string(file, group.c_str(), "owner", "");
+    g_key_file_set_int64(file, group.c_str(), "expires", 0);
+    clear_handover(file, group);
+    g_key_file_set_int64(file, group.c_str(), "free-since", now);
+}
+
+bool LeaseStore::sync(const std::vector<std::string>& cameras, const std::set<std::string>& running,
+                      const std::set<std::string>& ready, bool full, Changes& changes) {
+    return transact([&](GKeyFile *file, gint64 now) {
+        std::string self = NODE_PREFIX + node;
+        g_key_file_set_int64(file, self.c_str(), "heartbeat", now);
+        g_key_file_set_boolean(file, self.c_str(), "full", full);
+
+        // Nodes that stopped heartbeating are gone, their leases run out
+        struct Node {
+            bool full;
+            int owned;
+            int incoming; // handed over to it, not taken over yet
+            int quota;
+        };
+        std::map<std::string, Node> nodes;
+        gchar **groups = g_key_file_get_groups(file, NULL);
+        for (gchar **group = groups; *group; group++) {
+            if (!g_str_has_prefix(*group, NODE_PREFIX)) {
+                continue;
+            }
+            if (g_key_file_get_int64(file, *group, "heartbeat", NULL) < now - ttl_ms) {
+                g_key_file_remove_group(file, *group, NULL);
+                continue;
+            }
+            Node state = { g_key_file_get_boolean(file, *group, "full", NULL) == TRUE, 0, 0, 0 };
+            nodes[*group + strlen(NODE_PREFIX)] = state;
+        }
+        g_strfreev(groups);
+
+        std::vector<std::string> unowned;
+        int handing_over = 0;
+        for (const std::string& id : cameras) {
+            std::string group = camera_group(id);
+            std::string owner = owner_of(file, group);
+            std::string target = handover_target(file, group);
+            bool valid = !owner.empty() &&
+                         g_key_file_get_int64(file, group.c_str(), "expires", NULL) > now;
+            bool runs = running.count(id) > 0;
+
+            if (owner == node || (!valid && runs)) {
+                if (runs) {
+                    // Passed on by its owner, or the owner's lease ran
+                    // out while this node stood by or lost track of it
+                    if (owner != node || target == node) {
+                        changes.promoted.push_back(id);
+                    }
+                    if (target == node) {
+                        clear_handover(file, group);
+                        target.clear();
+                    }
+                    g_key_file_set_string(file, group.c_str(), "owner", node.c_str());
+                    g_key_file_set_int64(file, group.c_str(), "expires", now + ttl_ms);
+                    g_key_file_remove_key(file, group.c_str(), "free-since", NULL);
+                    owner = node;
+                    valid = true;
+                } else {
+                    clear_lease(file, group, now);
+                    owner.clear();
+                    target.clear();
+                    valid = false;
+                }
+            } else if (valid && target == node) {
+                if (!runs) {
+                    changes.incoming.push_back(id);
+                } else if (ready.count(id)) {
+                    g_key_file_set_boolean(file, group.c_str(), "handover-ready", TRUE);
+                }
+            } else if (valid && runs) {
+                changes.lost.push_back(id);
+            }
+
+            if (!valid) {
+                if (!g_key_file_has_key(file, group.c_str(), "free-since", NULL)) {
+                    g_key_file_set_int64(file, group.c_str(), "free-since", now);
+                }
+                unowned.push_back(id);
+                continue;
+            }
+
+            // Our handovers: passed on once the target has written a
+            // segment, called off when it is gone, full or never got there
+            if (owner == node && !target.empty()) {
+                auto to = nodes.find(target);
+                gint64 since = g_key_file_get_int64(file, group.c_str(), "handover-since", NULL);
+                if (to == nodes.end() || to->second.full || now - since > HANDOVER_TIMEOUT_MS) {
+                    clear_handover(file, group);
+                    target.clear();
+                } else if (g_key_file_get_boolean(file, group.c_str(), "handover-ready", NULL)) {
+                    g_key_file_set_string(file, group.c_str(), "owner", target.c_str());
+                    g_key_file_set_int64(file, group.c_str(), "expires", now + ttl_ms);
+                    changes.handover.push_back(id);
+                    owner = target;
+                } else {
+                    handing_over++;
+                }
+            }
+
+            auto holder = nodes.find(owner);
+            if (holder != nodes.end()) {
+                holder->second.owned++;
+            }
+            auto to = nodes.find(target);
+            if (to != nodes.end() && target != owner) {
+                to->second.incoming++;
+            }
+        }
+
+        // Even shares, the first nodes by name take the remainder
+        int index = 0;
+        for (auto& entry : nodes) {
+            entry.second.quota = cameras.size() / nodes.size() +
+                                 (index++ < (int)(cameras.size() % nodes.size()) ? 1 : 0);
+        }
+        Node& mine = nodes[node];
+
+        // A node that just joined waits for the others' heartbeats first,
+        // so a site starting up does not land on its first node. A camera
+        // nobody took within a TTL, e.g. while the nodes below their quota
+        // are out of CPU, goes to anyone with room left.
+        if (!full && now - joined_ms >= ttl_ms) {
+            auto camera = unowned.begin();
+            while (camera != unowned.end()) {
+                std::string group = camera_group(*camera);
+                gint64 free_since = g_key_file_get_int64(file, group.c_str(), "free-since", NULL);
+                if (mine.owned + mine.incoming >= mine.quota && now - free_since < ttl_ms) {
+                    ++camera;
+                    continue;
+                }
+                g_key_file_set_string(file, group.c_str(), "owner", node.c_str());
+                g_key_file_set_int64(file, group.c_str(), "expires", now + ttl_ms);
+                clear_handover(file, group);
+                g_key_file_remove_key(file, group.c_str(), "free-since", NULL);
+                changes.claimed.push_back(*camera);
+                mine.owned++;
+                camera = unowned.erase(camera);
+            }
+        }
+
+        // Over the quota while another node has room: name the last
+        // cameras' targets, as many as the nodes below their quota can take
+        if (!unowned.empty()) {
+            return;
+        }
+        int count = mine.owned - mine.quota - handing_over;
+        for (auto id = cameras.rbegin(); count > 0 && id != cameras.rend(); ++id) {
+            std::string group = camera_group(*id);
+            if (owner_of(file, group) != node || !handover_target(file, group).empty()) {
+                continue;
+            }
+            auto target = nodes.end();
+            int room = 0;
+            for (auto entry = nodes.begin(); entry != nodes.end(); ++entry) {
+                int space = entry->second.quota - entry->second.owned - entry->second.incoming;
+                if (entry->first != node && !entry->second.full && space > room) {
+                    target = entry;
+                    room = space;
+                }
+            }
+            if (target == nodes.end()) {
+                break;
+            }
+            g_key_file_set_string(file, group.c_str(), "handover-to", target->first.c_str());
+            g_key_file_set_int64(file, group.c_str(), "handover-since", now);
+            g_key_file_set_boolean(file, group.c_str(), "handover-ready", FALSE);
+            target->second.incoming++;
+            count--;
+        }
+    });
+}
+
+bool LeaseStore::release(const std::vector<std::string>& ids) {
+    return transact([&](GKeyFile *file, gint64 now) {
+        for (const std::string& id : ids) {
+            std::string group = camera_group(id);
+            if (owner_of(file, group) == node) {
+                clear_lease(file, group, now);
+            } else if (handover_target(file, group) == node) {
+                clear_handover(file, group);
+            }
+        }
+    });
+}
+
+void LeaseStore::leave() {
+    transact([&](GKeyFile *file, gint64 now) {
+        gchar **groups = g_key_file_get_groups(file, NULL);
+        for (gchar **group = groups; *group; group++) {
+            if (!g_str_has_prefix(*group, CAMERA_PREFIX)) {
+                continue;
+            }
+            if (owner_of(file, *group) == node) {
+                clear_lease(file, *group, now);
+            } else if (handover_target(file, *group) == node) {
+                clear_handover(file, *group);
+            }
+        }
+        g_strfreev(groups);
+        g_key_file_remove_group(file, (NODE_PREFIX + node).c_str(), NULL);
+    });
+}
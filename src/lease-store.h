@@ -0,0 +1,60 @@
+#ifndef RTSP_DASH_LEASE_STORE_H
+#define RTSP_DASH_LEASE_STORE_H
+
+#include <glib.h>
+#include <set>
+#include <string>
+#include <vector>
+
+// Camera ownership shared by the streamer nodes of a site: a key file on
+// storage every node mounts, read and rewritten under flock() on a lock
+// file next to it. Nodes heartbeat and renew their leases once a second.
+// Leases of a node that stops doing so expire after the TTL and are
+// claimed by the others. Every live node gets an even quota of the
+// cameras; one over its quota hands cameras over while another node is
+// below its quota and has CPU headroom left. A handover makes before it
+// breaks: the owner names the target in the lease, the target starts the
+// camera without publishing it and reports its first segment, and only
+// then does the owner pass the lease on and stop. Times are wall clock
+// milliseconds, so the nodes' clocks must be synchronized (NTP).
+class LeaseStore {
+public:
+    LeaseStore(const std::string& path, const std::string& node, int ttl_seconds);
+
+    struct Changes {
+        std::vector<std::string> claimed;  // start these
+        std::vector<std::string> incoming; // start these without publishing, handed over to us
+        std::vector<std::string> promoted; // incoming ones this node owns now, publish them
+        std::vector<std::string> handover; // the target took over, stop right away
+        std::vector<std::string> lost;     // another node owns them now, stop right away
+    };
+
+    // Heartbeat, lease renewal and rebalancing. cameras is the site's
+    // camera list in configuration order, running what this node streams,
+    // ready the incoming cameras that wrote their first segment; leases
+    // of this node it does not run are dropped. full when a camera did
+    // not fit this node's CPU headroom, it then claims nothing.
+    bool sync(const std::vector<std::string>& cameras, const std::set<std::string>& running,
+              const std::set<std::string>& ready, bool full, Changes& changes);
+
+    // Gives leases up, and handovers to this node, e.g. when a camera
+    // failed to start
+    bool release(const std::vector<std::string>& ids);
+
+    // Gives up every lease and the heartbeat, on shutdown
+    void leave();
+
+    const std::string& get_node() const { return node; }
+
+private:
+    std::string path;
+    std::string lock_path;
+    std::string node;
+    gint64 ttl_ms;
+    gint64 joined_ms;
+
+    // Runs update on the locked key file and writes it back
+    template <typename Update> bool transact(Update update);
+};
+
+#endif // RTSP_DASH_LEASE_STORE_H
@@ -0,0 +1,325 @@
+#include "mosaic.h"
+#include "encoders.h"
+
+#include <cmath>
+#include <cstring>
+
+static const int MOSAIC_FRAMERATE = 25;
+
+// A camera silent for this long shows the slate tile
+static const gint64 STALE_US = G_USEC_PER_SEC / 2;
+
+// Fills a rectangle of an I420 frame with black, x, y and the size even
+static void fill_black(guint8 *data, const GstVideoInfo *info,
+                       int x, int y, int width, int height) {
+    for (int plane = 0; plane < 3; plane++) {
+        int shift = plane ? 1 : 0;
+        int stride = GST_VIDEO_INFO_PLANE_STRIDE(info, plane);
+        guint8 *row = data + GST_VIDEO_INFO_PLANE_OFFSET(info, plane) +
+                      (gsize)(y >> shift) * stride + (x >> shift);
+        for (int i = 0; i < height >> shift; i++, row += stride) {
+            memset(row, plane ? 128 : 16, width >> shift);
+        }
+    }
+}
+
+// Copies width x height at src_x, src_y of one I420 frame to x, y of
+// another; memcpy moves whole rows with the widest vector loads the CPU
+// has, there is nothing to convert
+static void blit(const guint8 *src, const GstVideoInfo *src_info, int src_x, int src_y,
+                 guint8 *dst, const GstVideoInfo *dst_info, int x, int y,
+                 int width, int height) {
+    for (int plane = 0; plane < 3; plane++) {
+        int shift = plane ? 1 : 0;
+        int src_stride = GST_VIDEO_INFO_PLANE_STRIDE(src_info, plane);
+        int dst_stride = GST_VIDEO_INFO_PLANE_STRIDE(dst_info, plane);
+        const guint8 *in = src + GST_VIDEO_INFO_PLANE_OFFSET(src_info, plane) +
+                           (gsize)(src_y >> shift) * src_stride + (src_x >> shift);
+        guint8 *out = dst + GST_VIDEO_INFO_PLANE_OFFSET(dst_info, plane) +
+                      (gsize)(y >> shift) * dst_stride + (x >> shift);
+        for (int i = 0; i < height >> shift; i++, in += src_stride, out += dst_stride) {
+            memcpy(out, in, width >> shift);
+        }
+    }
+}
+
+MosaicComposer::MosaicComposer(const MosaicConfig& config)
+    : config(config), columns(0), rows(0), pipeline(nullptr), source(nullptr),
+      pool(nullptr), thread(nullptr), stopping(false) {
+    for (const std::string& id : config.cameras) {
+        Tile *tile = new Tile();
+        tile->camera_id = id;
+        tile->frame = nullptr;
+        tile->received_us = 0;
+        tile->size_warned = false;
+        tiles.push_back(tile);
+    }
+}
+
+MosaicComposer::~MosaicComposer() {
+    stop();
+    for (Tile *tile : tiles) {
+        if (tile->frame) {
+            gst_buffer_unref(tile->frame);
+        }
+        delete tile;
+    }
+}
+
+bool MosaicComposer::attach(RTSPDashStreamer *streamer) {
+    for (Tile *tile : tiles) {
+        if (tile->camera_id == streamer->get_camera_id()) {
+            streamer->set_scaled_frame_callback(on_scaled_frame, tile);
+            return true;
+        }
+    }
+    return false;
+}
+
+void MosaicComposer::on_scaled_frame(GstBuffer *buffer, const GstVideoInfo *info,
+                                     gpointer user_data) {
+    Tile *tile = static_cast<Tile*>(user_data);
+
+    // Only a reference is kept, the copy happens when composing
+    GstBuffer *previous;
+    {
+        std::lock_guard<std::mutex> guard(tile->lock);
+        previous = tile->frame;
+        tile->frame = gst_buffer_ref(buffer);
+        tile->info = *info;
+        tile->received_us = g_get_monotonic_time();
+    }
+    if (previous) {
+        gst_buffer_unref(previous);
+    }
+}
+
+bool MosaicComposer::start() {
+    if (tiles.empty()) {
+        return false;
+    }
+    int count = tiles.size();
+    columns = config.columns > 0 ? config.columns : (int)ceil(sqrt((double)count));
+    rows = (count + columns - 1) / columns;
+    gst_video_info_set_format(&canvas_info, GST_VIDEO_FORMAT_I420,
+                              columns * config.tile_width, rows * config.tile_height);
+
+    g_mkdir_with_parents(config.output_path.c_str(), 0755);
+
+    pipeline = gst_pipeline_new("mosaic-pipeline");
+    source = gst_element_factory_make("appsrc", "mosaic-source");
+    GstElement *encoder = make_video_encoder(config.codec, "mosaic-encoder", config.bitrate);
+    GstElement *parse = gst_element_factory_make(video_parser_factory(config.codec),
+                                                 "mosaic-parse");
+    GstElement *dash_sink = gst_element_factory_make("dashsink", "mosaic-sink");
+    if (!pipeline || !source || !encoder || !parse || !dash_sink) {
+        g_printerr("Failed to create mosaic elements\n");
+        GstElement *created[] = { pipeline, source, encoder, parse, dash_sink };
+        for (GstElement *element : created) {
+            if (element) {
+                gst_object_unref(element);
+            }
+        }
+        pipeline = nullptr;
+        source = nullptr;
+        return false;
+    }
+    gst_bin_add_many(GST_BIN(pipeline), source, encoder, parse, dash_sink, NULL);
+
+    GstCaps *caps = gst_video_info_to_caps(&canvas_info);
+    gst_caps_set_simple(caps, "framerate", GST_TYPE_FRACTION, MOSAIC_FRAMERATE, 1, NULL);
+
+    // Timestamped on push, a slow encoder blocks the composer rather
+    // than queueing canvases
+    g_object_set(source,
+        "caps", caps,
+        "format", GST_FORMAT_TIME,
+        "is-live", TRUE,
+        "do-timestamp", TRUE,
+        "block", TRUE,
+        "max-bytes", (guint64)GST_VIDEO_INFO_SIZE(&canvas_info) * 2,
+        NULL);
+
+    std::string manifest_path = config.output_path + "/mosaic_manifest.mpd";
+    g_object_set(dash_sink,
+        "mpd-filename", manifest_path.c_str(),
+        "target-duration", 4,
+        NULL);
+
+    // Canvases are recycled rather than allocated per frame
+    pool = gst_buffer_pool_new();
+    GstStructure *pool_config = gst_buffer_pool_get_config(pool);
+    gst_buffer_pool_config_set_params(pool_config, caps, GST_VIDEO_INFO_SIZE(&canvas_info), 4, 0);
+    gst_buffer_pool_set_config(pool, pool_config);
+    gst_caps_unref(caps);
+    if (!gst_buffer_pool_set_active(pool, TRUE)) {
+        g_printerr("Failed to allocate mosaic canvases\n");
+        discard();
+        return false;
+    }
+
+    if (!gst_element_link_many(source, encoder, parse, dash_sink, NULL)) {
+        g_printerr("Failed to link mosaic pipeline\n");
+        discard();
+        return false;
+    }
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        g_printerr("Failed to start mosaic pipeline\n");
+        discard();
+        return false;
+    }
+
+    g_print("Mosaic of %d cameras, %dx%d, to %s\n", count,
+            GST_VIDEO_INFO_WIDTH(&canvas_info), GST_VIDEO_INFO_HEIGHT(&canvas_info),
+            manifest_path.c_str());
+    thread = g_thread_new("mosaic", compose_thread, this);
+    return true;
+}
+
+void MosaicComposer::stop() {
+    stopping = true;
+    if (thread) {
+        g_thread_join(thread);
+        thread = nullptr;
+    }
+
+    if (pipeline) {
+        // Let dashsink close the last segment and the manifest
+        if (source) {
+            GstFlowReturn ret;
+            g_signal_emit_by_name(source, "end-of-stream", &ret);
+        }
+        GstBus *bus = gst_element_get_bus(pipeline);
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, 5 * GST_SECOND,
+            (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+        if (msg) {
+            gst_message_unref(msg);
+        }
+        gst_object_unref(bus);
+    }
+    discard();
+}
+
+void MosaicComposer::discard() {
+    if (pipeline) {
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_object_unref(pipeline);
+        pipeline = nullptr;
+        source = nullptr;
+    }
+    if (pool) {
+        gst_buffer_pool_set_active(pool, FALSE);
+        gst_object_unref(pool);
+        pool = nullptr;
+    }
+}
+
+gpointer MosaicComposer::compose_thread(gpointer user_data) {
+    MosaicComposer *mosaic = static_cast<MosaicComposer*>(user_data);
+    const gint64 interval_us = G_USEC_PER_SEC / MOSAIC_FRAMERATE;
+    GstBus *bus = gst_element_get_bus(mosaic->pipeline);
+
+    gint64 next_us = g_get_monotonic_time();
+    while (!mosaic->stopping) {
+        GstBuffer *buffer = NULL;
+        if (gst_buffer_pool_acquire_buffer(mosaic->pool, &buffer, NULL) != GST_FLOW_OK) {
+            break;
+        }
+        GstMapInfo map;
+        if (gst_buffer_map(buffer, &map, GST_MAP_WRITE)) {
+            mosaic->compose(map.data);
+            gst_buffer_unmap(buffer, &map);
+        }
+        GST_BUFFER_DURATION(buffer) = GST_SECOND / MOSAIC_FRAMERATE;
+
+        // push-buffer takes its own reference
+        GstFlowReturn ret;
+        g_signal_emit_by_name(mosaic->source, "push-buffer", buffer, &ret);
+        gst_buffer_unref(buffer);
+
+        GstMessage *msg = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+        if (msg) {
+            GError *err = NULL;
+            gst_message_parse_error(msg, &err, NULL);
+            g_printerr("Mosaic error: %s\n", err->message);
+            g_error_free(err);
+            gst_message_unref(msg);
+            break;
+        }
+        if (ret != GST_FLOW_OK) {
+            g_printerr("Mosaic stopped: %s\n", gst_flow_get_name(ret));
+            break;
+        }
+
+        // Keeps the frame rate, after a stall it goes on from now
+        // instead of catching up in a burst
+        next_us += interval_us;
+        gint64 now_us = g_get_monotonic_time();
+        if (next_us > now_us) {
+            g_usleep(next_us - now_us);
+        } else if (now_us - next_us > interval_us) {
+            next_us = now_us;
+        }
+    }
+
+    gst_object_unref(bus);
+    return NULL;
+}
+
+void MosaicComposer::compose(guint8 *canvas) {
+    gint64 now_us = g_get_monotonic_time();
+    for (int cell = 0; cell < columns * rows; cell++) {
+        int x = cell % columns * config.tile_width;
+        int y = cell / columns * config.tile_height;
+        if (cell < (int)tiles.size()) {
+            compose_tile(tiles[cell], x, y, canvas, now_us);
+        } else {
+            fill_black(canvas, &canvas_info, x, y, config.tile_width, config.tile_height);
+        }
+    }
+}
+
+void MosaicComposer::compose_tile(Tile *tile, int x, int y, guint8 *canvas, gint64 now_us) {
+    // A reference keeps the frame alive while the camera moves on
+    GstBuffer *frame = NULL;
+    GstVideoInfo info;
+    {
+        std::lock_guard<std::mutex> guard(tile->lock);
+        if (tile->frame && now_us - tile->received_us < STALE_US) {
+            frame = gst_buffer_ref(tile->frame);
+            info = tile->info;
+        }
+    }
+    GstMapInfo map;
+    if (!frame || !gst_buffer_map(frame, &map, GST_MAP_READ)) {
+        fill_black(canvas, &canvas_info, x, y, config.tile_width, config.tile_height);
+        if (frame) {
+            gst_buffer_unref(frame);
+        }
+        return;
+    }
+
+    int frame_width = GST_VIDEO_INFO_WIDTH(&info);
+    int frame_height = GST_VIDEO_INFO_HEIGHT(&info);
+    if ((frame_width != config.tile_width || frame_height != config.tile_height) &&
+        !tile->size_warned) {
+        g_printerr("Mosaic: camera %s sends %dx%d for a %dx%d tile, size its smallest "
+                   "rendition to the tile to avoid cutting or borders\n",
+                   tile->camera_id.c_str(), frame_width, frame_height,
+                   config.tile_width, config.tile_height);
+        tile->size_warned = true;
+    }
+
+    // Even offsets and sizes keep the chroma planes aligned
+    int width = MIN(frame_width, config.tile_width) & ~1;
+    int height = MIN(frame_height, config.tile_height) & ~1;
+    if (width < config.tile_width || height < config.tile_height) {
+        fill_black(canvas, &canvas_info, x, y, config.tile_width, config.tile_height);
+    }
+    blit(map.data, &info, ((frame_width - width) / 2) & ~1, ((frame_height - height) / 2) & ~1,
+         canvas, &canvas_info, x + (((config.tile_width - width) / 2) & ~1),
+         y + (((config.tile_height - height) / 2) & ~1), width, height);
+
+    gst_buffer_unmap(frame, &map);
+    gst_buffer_unref(frame);
+}
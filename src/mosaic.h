@@ -0,0 +1,66 @@
+#ifndef RTSP_DASH_MOSAIC_H
+#define RTSP_DASH_MOSAIC_H
+
+#include "config.h"
+#include "streamer.h"
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Control room grid built from frames the cameras scale anyway. Every
+// tile holds the latest frame of its camera's smallest rendition, which
+// is copied row by row into the canvas without decoding or scaling
+// again, and the canvas is encoded once into a DASH stream of its own.
+// Frames larger than the tile are cut to its centre, smaller ones are
+// centred on black. A camera on its slate sends the slate; one that sends
+// nothing at all, e.g. while its pipeline restarts, gets a black slate
+// tile after a moment.
+class MosaicComposer {
+public:
+    explicit MosaicComposer(const MosaicConfig& config);
+    ~MosaicComposer();
+
+    // Feeds the tile of the streamer's camera, must be called before
+    // streamer->initialize(). False when the camera is not in the mosaic.
+    bool attach(RTSPDashStreamer *streamer);
+
+    // Builds the encode pipeline and composes on a thread of its own
+    bool start();
+    void stop();
+
+private:
+    struct Tile {
+        std::string camera_id;
+        std::mutex lock;
+        GstBuffer *frame; // latest scaled frame, described by info
+        GstVideoInfo info;
+        gint64 received_us;
+        bool size_warned;
+    };
+
+    MosaicConfig config;
+    std::vector<Tile*> tiles;
+    int columns;
+    int rows;
+    GstVideoInfo canvas_info;
+
+    GstElement *pipeline;
+    GstElement *source;
+    GstBufferPool *pool;
+    GThread *thread;
+    std::atomic<bool> stopping;
+
+    static void on_scaled_frame(GstBuffer *buffer, const GstVideoInfo *info, gpointer user_data);
+    static gpointer compose_thread(gpointer user_data);
+    void compose(guint8 *canvas);
+    void compose_tile(Tile *tile, int x, int y, guint8 *canvas, gint64 now_us);
+    // Takes the pipeline down and frees the canvases, also after a
+    // failed start()
+    void discard();
+};
+
+#endif // RTSP_DASH_MOSAIC_H
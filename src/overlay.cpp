@@ -0,0 +1,182 @@
+#include "overlay.h"
+
+#include <cstring>
+
+#ifdef HAVE_PANGOCAIRO
+#include <pango/pangocairo.h>
+#endif
+
+// "YYYY-MM-DD HH:MM:SS " in front of the label
+static const gsize TIME_LENGTH = 20;
+
+// Studio range, what the encoders expect
+static const guint8 LUMA_BLACK = 16;
+static const guint8 LUMA_WHITE = 235;
+static const guint8 CHROMA_NEUTRAL = 128;
+
+void FrameOverlay::configure(const std::vector<FrameRegion>& regions, bool show_timestamp,
+                             const std::string& label) {
+    masks = regions;
+    timestamp = show_timestamp;
+    text = label;
+}
+
+void FrameOverlay::set_frame_info(const GstVideoInfo *info) {
+    int width = GST_VIDEO_INFO_WIDTH(info);
+    int height = GST_VIDEO_INFO_HEIGHT(info);
+
+    // Clipped to the frame, chroma planes at half resolution
+    spans.clear();
+    auto add_rect = [&](int x, int y, int w, int h, int first_plane, guint8 luma) {
+        int x0 = CLAMP(x, 0, width);
+        int y0 = CLAMP(y, 0, height);
+        int x1 = CLAMP(x + w, 0, width);
+        int y1 = CLAMP(y + h, 0, height);
+        if (x1 <= x0 || y1 <= y0) {
+            return;
+        }
+        for (int plane = first_plane; plane < 3; plane++) {
+            int shift = plane ? 1 : 0;
+            Span span;
+            span.stride = GST_VIDEO_INFO_PLANE_STRIDE(info, plane);
+            span.offset = GST_VIDEO_INFO_PLANE_OFFSET(info, plane) +
+                          (gsize)(y0 >> shift) * span.stride + (x0 >> shift);
+            span.length = ((x1 + shift) >> shift) - (x0 >> shift);
+            span.rows = ((y1 + shift) >> shift) - (y0 >> shift);
+            span.value = plane ? CHROMA_NEUTRAL : luma;
+            spans.push_back(span);
+        }
+    };
+    for (const FrameRegion& mask : masks) {
+        add_rect(mask.x, mask.y, mask.width, mask.height, 0, LUMA_BLACK);
+    }
+
+    box_width = 0;
+    if (!timestamp || !rasterize_glyphs(MAX(height / 30, 10))) {
+        return;
+    }
+
+    // Top left, a line high and clipped on small frames
+    padding = cell_height / 4;
+    int margin = cell_height / 2;
+    gsize cells = TIME_LENGTH + text.size();
+    box_width = MIN((int)cells * cell_width + 2 * padding, width - 2 * margin);
+    box_height = MIN(cell_height + 2 * padding, height - 2 * margin);
+    if (box_width <= 0 || box_height <= 0) {
+        box_width = 0;
+        return;
+    }
+    box.assign((gsize)box_width * box_height, LUMA_BLACK);
+    box_text.assign(cells, ' ');
+    box_second = -1;
+    luma_stride = GST_VIDEO_INFO_PLANE_STRIDE(info, 0);
+    box_offset = GST_VIDEO_INFO_PLANE_OFFSET(info, 0) + (gsize)margin * luma_stride + margin;
+
+    // Only the luma of the box is copied per frame, its chroma is constant
+    add_rect(margin, margin, box_width, box_height, 1, LUMA_BLACK);
+}
+
+bool FrameOverlay::rasterize_glyphs(int size) {
+#ifdef HAVE_PANGOCAIRO
+    PangoFontDescription *font = pango_font_description_from_string("Monospace Bold");
+    pango_font_description_set_absolute_size(font, size * PANGO_SCALE);
+
+    // The cell of a digit holds every character of a monospace font
+    cairo_surface_t *scratch = cairo_image_surface_create(CAIRO_FORMAT_A8, 1, 1);
+    cairo_t *cr = cairo_create(scratch);
+    PangoLayout *layout = pango_cairo_create_layout(cr);
+    pango_layout_set_font_description(layout, font);
+    pango_layout_set_text(layout, "0", -1);
+    pango_layout_get_pixel_size(layout, &cell_width, &cell_height);
+    g_object_unref(layout);
+    cairo_destroy(cr);
+    cairo_surface_destroy(scratch);
+
+    for (int c = ' '; c < 127 && cell_width > 0 && cell_height > 0; c++) {
+        cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_A8,
+                                                              cell_width, cell_height);
+        cr = cairo_create(surface);
+        layout = pango_cairo_create_layout(cr);
+        pango_layout_set_font_description(layout, font);
+        char character = (char)c;
+        pango_layout_set_text(layout, &character, 1);
+        pango_cairo_show_layout(cr, layout);
+        cairo_surface_flush(surface);
+
+        const guint8 *pixels = cairo_image_surface_get_data(surface);
+        int stride = cairo_image_surface_get_stride(surface);
+        glyphs[c].resize((gsize)cell_width * cell_height);
+        for (int row = 0; row < cell_height; row++) {
+            memcpy(&glyphs[c][(gsize)row * cell_width], pixels + (gsize)row * stride, cell_width);
+        }
+
+        g_object_unref(layout);
+        cairo_destroy(cr);
+        cairo_surface_destroy(surface);
+    }
+    pango_font_description_free(font);
+    return cell_width > 0 && cell_height > 0;
+#else
+    g_printerr("Built without pangocairo, no timestamp overlay\n");
+    return false;
+#endif
+}
+
+void FrameOverlay::draw_cell(gsize index, char c) {
+    int x = padding + (int)index * cell_width;
+    int columns = MIN(cell_width, box_width - x);
+    int rows = MIN(cell_height, box_height - padding);
+    const std::vector<guint8>& glyph = glyphs[(unsigned char)c & 127];
+
+    for (int row = 0; row < rows && columns > 0; row++) {
+        guint8 *out = &box[(gsize)(padding + row) * box_width + x];
+        if (glyph.empty()) {
+            memset(out, LUMA_BLACK, columns);
+            continue;
+        }
+        const guint8 *alpha = &glyph[(gsize)row * cell_width];
+        for (int column = 0; column < columns; column++) {
+            out[column] = LUMA_BLACK + ((LUMA_WHITE - LUMA_BLACK) * alpha[column] + 127) / 255;
+        }
+    }
+}
+
+void FrameOverlay::update_box(gint64 now_us) {
+    gint64 second = now_us / G_USEC_PER_SEC;
+    if (second == box_second) {
+        return;
+    }
+    box_second = second;
+
+    GDateTime *now = g_date_time_new_from_unix_local(second);
+    gchar *stamp = g_date_time_format(now, "%Y-%m-%d %H:%M:%S ");
+    std::string line = std::string(stamp) + text;
+    g_free(stamp);
+    g_date_time_unref(now);
+    line.resize(box_text.size(), ' ');
+
+    // Usually just the last digit or two
+    for (gsize i = 0; i < line.size(); i++) {
+        if (line[i] != box_text[i]) {
+            draw_cell(i, line[i]);
+        }
+    }
+    box_text = line;
+}
+
+void FrameOverlay::apply(guint8 *data, gint64 now_us) {
+    for (const Span& span : spans) {
+        guint8 *row = data + span.offset;
+        for (int i = 0; i < span.rows; i++, row += span.stride) {
+            memset(row, span.value, span.length);
+        }
+    }
+
+    if (box_width > 0) {
+        update_box(now_us);
+        for (int row = 0; row < box_height; row++) {
+            memcpy(data + box_offset + (gsize)row * luma_stride,
+                   &box[(gsize)row * box_width], box_width);
+        }
+    }
+}
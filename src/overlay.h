@@ -0,0 +1,70 @@
+#ifndef RTSP_DASH_OVERLAY_H
+#define RTSP_DASH_OVERLAY_H
+
+#include "config.h"
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <string>
+#include <vector>
+
+// Privacy masks and a "date time text" line burned into I420 frames
+// once, before the tee, instead of a textoverlay per rendition. Masks
+// become plane spans when the frame layout is known. Glyphs are
+// rasterized once per frame size (pangocairo, when built with it) into
+// monospace cells, and the opaque box behind the line is kept as a luma
+// image in which only the characters that changed are redrawn. A frame
+// then costs a memset per mask row and a memcpy per box row.
+class FrameOverlay {
+public:
+    // label follows the time on the line
+    void configure(const std::vector<FrameRegion>& regions, bool show_timestamp,
+                   const std::string& label);
+    bool enabled() const { return !masks.empty() || timestamp; }
+
+    // New caps, precomputes everything that depends on the frame layout
+    void set_frame_info(const GstVideoInfo *info);
+
+    // Burns the masks and the time of now_us (wall clock) into a
+    // writable frame
+    void apply(guint8 *data, gint64 now_us);
+
+private:
+    // Rows of one plane filled with a constant
+    struct Span {
+        gsize offset; // start of the first row
+        int stride;
+        int length;
+        int rows;
+        guint8 value;
+    };
+
+    std::vector<FrameRegion> masks;
+    bool timestamp = false;
+    std::string text;
+
+    std::vector<Span> spans;
+
+    // Glyph alpha for printable ASCII, cell_width x cell_height each
+    std::vector<guint8> glyphs[128];
+    int cell_width = 0;
+    int cell_height = 0;
+
+    // Luma of the box with the line in it, redrawn per changed character
+    std::vector<guint8> box;
+    int box_width = 0;
+    int box_height = 0;
+    int padding = 0;
+    std::string box_text;
+    gint64 box_second = -1;
+
+    // Where the box goes in the frame
+    gsize box_offset = 0;
+    int luma_stride = 0;
+
+    bool rasterize_glyphs(int size);
+    void draw_cell(gsize index, char c);
+    void update_box(gint64 now_us);
+};
+
+#endif // RTSP_DASH_OVERLAY_H
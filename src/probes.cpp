@@ -0,0 +1,14 @@
+#include "probes.h"
+
+#ifdef ENABLE_USDT
+
+// Semaphores live in .probes where tracers expect them
+#define RTSP_DASH_DEFINE_SEMAPHORE(name) \
+    __attribute__((section(".probes"), used)) \
+    unsigned short rtsp_dash_##name##_semaphore = 0;
+
+extern "C" {
+RTSP_DASH_PROBES(RTSP_DASH_DEFINE_SEMAPHORE)
+}
+
+#endif // ENABLE_USDT
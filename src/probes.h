@@ -0,0 +1,59 @@
+#ifndef RTSP_DASH_PROBES_H
+#define RTSP_DASH_PROBES_H
+
+// USDT tracepoints of the rtsp_dash provider. Every probe has a semaphore
+// that tracers (bpftrace, perf, systemtap) raise while attached, so the
+// arguments are only evaluated when someone is listening and a detached
+// probe costs a single predictable branch. Without --enable-usdt the
+// macros compile away entirely.
+
+#ifdef ENABLE_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define RTSP_DASH_PROBES(X) \
+    X(switch_to_dummy) \
+    X(switch_to_rtsp) \
+    X(switch_to_backup) \
+    X(reconnect) \
+    X(connect_pad) \
+    X(encoder_enter) \
+    X(encoder_exit) \
+    X(segment) \
+    X(keyframe_request)
+
+#define RTSP_DASH_DECLARE_SEMAPHORE(name) \
+    extern unsigned short rtsp_dash_##name##_semaphore;
+
+extern "C" {
+RTSP_DASH_PROBES(RTSP_DASH_DECLARE_SEMAPHORE)
+}
+
+#define RTSP_DASH_TRACE_ENABLED(name) \
+    __builtin_expect(rtsp_dash_##name##_semaphore != 0, 0)
+
+#define RTSP_DASH_TRACE1(name, a1) \
+    do { if (RTSP_DASH_TRACE_ENABLED(name)) \
+        STAP_PROBE1(rtsp_dash, name, a1); } while (0)
+#define RTSP_DASH_TRACE2(name, a1, a2) \
+    do { if (RTSP_DASH_TRACE_ENABLED(name)) \
+        STAP_PROBE2(rtsp_dash, name, a1, a2); } while (0)
+#define RTSP_DASH_TRACE3(name, a1, a2, a3) \
+    do { if (RTSP_DASH_TRACE_ENABLED(name)) \
+        STAP_PROBE3(rtsp_dash, name, a1, a2, a3); } while (0)
+#define RTSP_DASH_TRACE4(name, a1, a2, a3, a4) \
+    do { if (RTSP_DASH_TRACE_ENABLED(name)) \
+        STAP_PROBE4(rtsp_dash, name, a1, a2, a3, a4); } while (0)
+
+#else
+
+#define RTSP_DASH_TRACE_ENABLED(name) 0
+#define RTSP_DASH_TRACE1(name, a1) do {} while (0)
+#define RTSP_DASH_TRACE2(name, a1, a2) do {} while (0)
+#define RTSP_DASH_TRACE3(name, a1, a2, a3) do {} while (0)
+#define RTSP_DASH_TRACE4(name, a1, a2, a3, a4) do {} while (0)
+
+#endif // ENABLE_USDT
+
+#endif // RTSP_DASH_PROBES_H
@@ -0,0 +1,322 @@
+#include "rtsp-dash.h"
+#include "admission.h"
+#include "streamer.h"
+
+#include <cstring>
+
+struct RtspDashStream {
+    RTSPDashStreamer *streamer;
+    GThread *thread;
+    bool initialized;
+    RtspDashSegmentFunc segment_func;
+    void *segment_data;
+    RtspDashFrameFunc frame_func;
+    void *frame_data;
+};
+
+static void segment_trampoline(const gchar *rendition, const gchar *location,
+                               GstClockTime running_time, gpointer user_data) {
+    RtspDashStream *stream = static_cast<RtspDashStream*>(user_data);
+    stream->segment_func(stream, rendition, location,
+                         GST_CLOCK_TIME_IS_VALID(running_time) ? running_time : 0,
+                         stream->segment_data);
+}
+
+static void frame_trampoline(const gchar *rendition, GstBuffer *buffer, gpointer user_data) {
+    RtspDashStream *stream = static_cast<RtspDashStream*>(user_data);
+    GstMapInfo map;
+
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        return;
+    }
+
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    stream->frame_func(stream, rendition, map.data, map.size,
+                       GST_CLOCK_TIME_IS_VALID(pts) ? pts : 0,
+                       !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT),
+                       stream->frame_data);
+    gst_buffer_unmap(buffer, &map);
+}
+
+static gpointer stream_thread(gpointer user_data) {
+    RtspDashStream *stream = static_cast<RtspDashStream*>(user_data);
+    stream->streamer->run();
+    return NULL;
+}
+
+extern "C" {
+
+int rtsp_dash_init(int *argc, char ***argv) {
+    GError *err = NULL;
+
+    if (!gst_init_check(argc, argv, &err)) {
+        g_printerr("Failed to initialize GStreamer: %s\n",
+                   err ? err->message : "unknown error");
+        g_clear_error(&err);
+        return -1;
+    }
+    return 0;
+}
+
+int rtsp_dash_set_cpu_headroom(double fraction) {
+    if (fraction < 0 || fraction >= 1) {
+        return -1;
+    }
+    AdmissionControl::get().set_headroom(fraction);
+    return 0;
+}
+
+RtspDashStream *rtsp_dash_stream_new(const char *rtsp_uri, const char *output_dir) {
+    g_return_val_if_fail(rtsp_uri != NULL && output_dir != NULL, NULL);
+
+    RtspDashStream *stream = g_new0(RtspDashStream, 1);
+    stream->streamer = new RTSPDashStreamer(rtsp_uri, output_dir);
+    return stream;
+}
+
+void rtsp_dash_stream_free(RtspDashStream *stream) {
+    if (!stream) {
+        return;
+    }
+
+    rtsp_dash_stream_stop(stream);
+    delete stream->streamer;
+    g_free(stream);
+}
+
+int rtsp_dash_stream_set_rendition(RtspDashStream *stream, const char *name,
+                                   int width, int height, int bitrate_kbps) {
+    g_return_val_if_fail(stream != NULL && name != NULL, -1);
+    g_return_val_if_fail(width > 0 && height > 0 && bitrate_kbps > 0, -1);
+
+    RenditionConfig config = { name, width, height, bitrate_kbps, CODEC_H264 };
+    return stream->streamer->reconfigure(config) ? 0 : -1;
+}
+
+int rtsp_dash_stream_set_rendition_codec(RtspDashStream *stream, const char *name,
+                                         const char *codec, int width, int height,
+                                         int bitrate_kbps) {
+    g_return_val_if_fail(stream != NULL && name != NULL && codec != NULL, -1);
+    g_return_val_if_fail(width > 0 && height > 0 && bitrate_kbps > 0, -1);
+
+    RenditionConfig config = { name, width, height, bitrate_kbps, CODEC_H264 };
+    if (!parse_video_codec(codec, config.codec)) {
+        return -1;
+    }
+    return stream->streamer->reconfigure(config) ? 0 : -1;
+}
+
+int rtsp_dash_stream_set_rendition_crop(RtspDashStream *stream, const char *name,
+                                        int width, int height, int bitrate_kbps,
+                                        int crop_x, int crop_y,
+                                        int crop_width, int crop_height) {
+    g_return_val_if_fail(stream != NULL && name != NULL, -1);
+    g_return_val_if_fail(width > 0 && height > 0 && bitrate_kbps > 0, -1);
+    g_return_val_if_fail(crop_x >= 0 && crop_y >= 0 && crop_width > 0 && crop_height > 0, -1);
+
+    RenditionConfig config = { name, width, height, bitrate_kbps, CODEC_H264,
+                               { crop_x, crop_y, crop_width, crop_height } };
+    return stream->streamer->reconfigure(config) ? 0 : -1;
+}
+
+int rtsp_dash_stream_remove_rendition(RtspDashStream *stream, const char *name) {
+    g_return_val_if_fail(stream != NULL && name != NULL, -1);
+
+    return stream->streamer->remove_rendition(name) ? 0 : -1;
+}
+
+int rtsp_dash_stream_set_backup_uri(RtspDashStream *stream, const char *uri) {
+    g_return_val_if_fail(stream != NULL && uri != NULL, -1);
+
+    if (stream->initialized) {
+        return -1;
+    }
+    stream->streamer->set_backup_uri(uri);
+    return 0;
+}
+
+int rtsp_dash_stream_set_trickplay(RtspDashStream *stream, const char *rendition) {
+    g_return_val_if_fail(stream != NULL && rendition != NULL, -1);
+
+    if (stream->initialized) {
+        return -1;
+    }
+    stream->streamer->set_trickplay(rendition);
+    return 0;
+}
+
+int rtsp_dash_stream_set_denoise(RtspDashStream *stream, const char *mode, double threshold) {
+    g_return_val_if_fail(stream != NULL && mode != NULL, -1);
+
+    DenoiseConfig denoise;
+    if (stream->initialized || threshold < 0 || !parse_denoise_mode(mode, denoise.mode)) {
+        return -1;
+    }
+    if (threshold > 0) {
+        denoise.threshold = threshold;
+    }
+    stream->streamer->set_denoise(denoise);
+    return 0;
+}
+
+int rtsp_dash_stream_add_privacy_mask(RtspDashStream *stream, int x, int y,
+                                      int width, int height) {
+    g_return_val_if_fail(stream != NULL, -1);
+
+    if (stream->initialized || x < 0 || y < 0 || width <= 0 || height <= 0) {
+        return -1;
+    }
+    stream->streamer->add_privacy_mask({x, y, width, height});
+    return 0;
+}
+
+int rtsp_dash_stream_set_timestamp_overlay(RtspDashStream *stream, int enabled,
+                                           const char *text) {
+    g_return_val_if_fail(stream != NULL, -1);
+
+    if (stream->initialized) {
+        return -1;
+    }
+    stream->streamer->set_timestamp_overlay(enabled != 0, text ? text : "");
+    return 0;
+}
+
+int rtsp_dash_stream_set_utc_timing(RtspDashStream *stream, const char *url) {
+    g_return_val_if_fail(stream != NULL && url != NULL, -1);
+
+    if (stream->initialized) {
+        return -1;
+    }
+    stream->streamer->set_utc_timing(url);
+    return 0;
+}
+
+int rtsp_dash_stream_set_on_demand(RtspDashStream *stream, int enabled, int idle_s) {
+    g_return_val_if_fail(stream != NULL, -1);
+
+    if (stream->initialized || idle_s <= 0) {
+        return -1;
+    }
+    stream->streamer->set_on_demand(enabled != 0, idle_s);
+    return 0;
+}
+
+int rtsp_dash_stream_request_rendition(RtspDashStream *stream, const char *name) {
+    g_return_val_if_fail(stream != NULL && name != NULL, -1);
+
+    return stream->streamer->request_rendition(name) ? 0 : -1;
+}
+
+int rtsp_dash_stream_set_thumbnail(RtspDashStream *stream, int interval_s, int width_px,
+                                   const char *format, const char *path) {
+    g_return_val_if_fail(stream != NULL && format != NULL, -1);
+
+    ThumbnailConfig thumbnail;
+    if (stream->initialized || interval_s < 0 || width_px <= 0 ||
+        !parse_thumbnail_format(format, thumbnail.format)) {
+        return -1;
+    }
+    thumbnail.interval = interval_s;
+    thumbnail.width = width_px;
+    thumbnail.path = path ? path : "";
+    stream->streamer->set_thumbnail(thumbnail);
+    return 0;
+}
+
+int rtsp_dash_stream_get_snapshot(RtspDashStream *stream, uint8_t **data, size_t *size) {
+    g_return_val_if_fail(stream != NULL && data != NULL && size != NULL, -1);
+
+    std::vector<guint8> image;
+    if (!stream->streamer->get_snapshot(image)) {
+        return -1;
+    }
+    *data = static_cast<uint8_t*>(g_malloc(image.size()));
+    memcpy(*data, image.data(), image.size());
+    *size = image.size();
+    return 0;
+}
+
+void rtsp_dash_stream_set_segment_callback(RtspDashStream *stream,
+                                           RtspDashSegmentFunc func,
+                                           void *user_data) {
+    g_return_if_fail(stream != NULL);
+
+    stream->segment_func = func;
+    stream->segment_data = user_data;
+    stream->streamer->set_segment_callback(func ? segment_trampoline : NULL, stream);
+}
+
+void rtsp_dash_stream_set_frame_callback(RtspDashStream *stream,
+                                         RtspDashFrameFunc func,
+                                         void *user_data) {
+    g_return_if_fail(stream != NULL);
+
+    stream->frame_func = func;
+    stream->frame_data = user_data;
+    stream->streamer->set_frame_callback(func ? frame_trampoline : NULL, stream);
+}
+
+int rtsp_dash_stream_start(RtspDashStream *stream) {
+    g_return_val_if_fail(stream != NULL, -1);
+
+    if (stream->thread) {
+        return 0;
+    }
+
+    if (!stream->initialized) {
+        if (!stream->streamer->admit()) {
+            g_printerr("Not enough CPU headroom to start the stream\n");
+            return -1;
+        }
+        if (!stream->streamer->initialize()) {
+            return -1;
+        }
+        stream->initialized = true;
+    }
+
+    if (!stream->streamer->start()) {
+        return -1;
+    }
+
+    stream->thread = g_thread_new("rtsp-dash", stream_thread, stream);
+    return 0;
+}
+
+void rtsp_dash_stream_stop(RtspDashStream *stream) {
+    g_return_if_fail(stream != NULL);
+
+    if (!stream->thread) {
+        return;
+    }
+
+    stream->streamer->stop();
+    g_thread_join(stream->thread);
+    stream->thread = NULL;
+}
+
+RtspDashState rtsp_dash_stream_get_state(RtspDashStream *stream) {
+    g_return_val_if_fail(stream != NULL, RTSP_DASH_STATE_STOPPED);
+
+    if (!stream->thread) {
+        return RTSP_DASH_STATE_STOPPED;
+    }
+    if (stream->streamer->is_connected()) {
+        return RTSP_DASH_STATE_LIVE;
+    }
+    return stream->streamer->is_on_backup() ? RTSP_DASH_STATE_BACKUP : RTSP_DASH_STATE_SLATE;
+}
+
+char *rtsp_dash_stream_get_stats(RtspDashStream *stream) {
+    g_return_val_if_fail(stream != NULL, NULL);
+
+    GstStructure *stats = stream->streamer->get_stats();
+    char *text = gst_structure_to_string(stats);
+    gst_structure_free(stats);
+    return text;
+}
+
+void rtsp_dash_free(void *ptr) {
+    g_free(ptr);
+}
+
+} // extern "C"
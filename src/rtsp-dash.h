@@ -0,0 +1,152 @@
+/*
+ * rtsp-dash: embeddable RTSP to DASH streaming engine
+ *
+ * All functions returning int return 0 on success and -1 on failure.
+ * A stream runs its pipeline on a private thread between
+ * rtsp_dash_stream_start() and rtsp_dash_stream_stop(), so the host
+ * application does not need to run a GLib main loop.
+ */
+#ifndef RTSP_DASH_H
+#define RTSP_DASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct RtspDashStream RtspDashStream;
+
+typedef enum {
+    RTSP_DASH_STATE_STOPPED = 0,
+    RTSP_DASH_STATE_SLATE,      /* running, camera not connected */
+    RTSP_DASH_STATE_LIVE,       /* running, camera connected */
+    RTSP_DASH_STATE_BACKUP      /* running, showing the backup URI */
+} RtspDashState;
+
+/* Invoked on the stream thread once a segment file has been closed */
+typedef void (*RtspDashSegmentFunc)(RtspDashStream *stream,
+                                    const char *rendition,
+                                    const char *location,
+                                    uint64_t running_time_ns,
+                                    void *user_data);
+
+/* Invoked on a streaming thread for every encoded access unit; the
+ * data is only valid for the duration of the call */
+typedef void (*RtspDashFrameFunc)(RtspDashStream *stream,
+                                  const char *rendition,
+                                  const uint8_t *data,
+                                  size_t size,
+                                  uint64_t pts_ns,
+                                  int keyframe,
+                                  void *user_data);
+
+/* Initializes GStreamer, argc/argv may be NULL */
+int rtsp_dash_init(int *argc, char ***argv);
+
+/* Fraction of the CPUs (0 to below 1) that starting streams and new
+ * renditions must leave free, judged by a cost model measured from the
+ * running streams. Streams that would not fit fail to start, renditions
+ * are refused. Off until called; applies to every stream of the process. */
+int rtsp_dash_set_cpu_headroom(double fraction);
+
+RtspDashStream *rtsp_dash_stream_new(const char *rtsp_uri, const char *output_dir);
+void rtsp_dash_stream_free(RtspDashStream *stream);
+
+/* Adds a rendition before start, or changes/adds one while running.
+ * Without any rendition the default 1080p/720p ladder is used. */
+int rtsp_dash_stream_set_rendition(RtspDashStream *stream, const char *name,
+                                   int width, int height, int bitrate_kbps);
+int rtsp_dash_stream_remove_rendition(RtspDashStream *stream, const char *name);
+
+/* Same for a codec other than H.264: "h264", "h265" or "av1". Each
+ * rendition has its own manifest; changing the codec rebuilds it. */
+int rtsp_dash_stream_set_rendition_codec(RtspDashStream *stream, const char *name,
+                                         const char *codec, int width, int height,
+                                         int bitrate_kbps);
+
+/* Rendition of only the crop_width x crop_height region at crop_x,
+ * crop_y of the camera frame, e.g. a door at a higher effective
+ * resolution; only that region is scaled and encoded */
+int rtsp_dash_stream_set_rendition_crop(RtspDashStream *stream, const char *name,
+                                        int width, int height, int bitrate_kbps,
+                                        int crop_x, int crop_y,
+                                        int crop_width, int crop_height);
+
+/* Hot standby URI (e.g. an NVR re-stream) kept connected and switched to
+ * at its next keyframe when the primary fails; must be set before start */
+int rtsp_dash_stream_set_backup_uri(RtspDashStream *stream, const char *uri);
+
+/* Adds an I-frame-only trick play Representation, taken from the
+ * encoded rendition without encoding again, to that rendition's
+ * manifest; must be set before start */
+int rtsp_dash_stream_set_trickplay(RtspDashStream *stream, const char *rendition);
+
+/* Temporal denoise in front of all renditions: "off", "on" or "auto",
+ * which enables it while the estimated noise sigma exceeds threshold
+ * (8-bit levels, 0 for the default); must be set before start */
+int rtsp_dash_stream_set_denoise(RtspDashStream *stream, const char *mode, double threshold);
+
+/* Blacks out the width x height region at x, y of the camera frame in
+ * every rendition and the thumbnails; must be called before start */
+int rtsp_dash_stream_add_privacy_mask(RtspDashStream *stream, int x, int y,
+                                      int width, int height);
+
+/* Burns the local date and time followed by text (NULL for none) into
+ * the top left corner of the frames, before the renditions are scaled;
+ * must be set before start */
+int rtsp_dash_stream_set_timestamp_overlay(RtspDashStream *stream, int enabled,
+                                           const char *text);
+
+/* Time endpoint players synchronize to, announced as the manifests'
+ * UTCTiming (urn:mpeg:dash:utc:http-iso:2014); without it the manifests
+ * carry no timing elements. Must be set before start. */
+int rtsp_dash_stream_set_utc_timing(RtspDashStream *stream, const char *url);
+
+/* Encodes renditions only while they are watched: each starts when its
+ * manifest is fetched from the output directory or requested with
+ * rtsp_dash_stream_request_rendition(), and stops after idle_s seconds
+ * without a request. Must be set before start. */
+int rtsp_dash_stream_set_on_demand(RtspDashStream *stream, int enabled, int idle_s);
+
+/* Marks a rendition as watched, for origins that serve the files from
+ * elsewhere; call it for every manifest or segment request */
+int rtsp_dash_stream_request_rendition(RtspDashStream *stream, const char *name);
+
+/* Takes a thumbnail every interval_s seconds, width_px wide, as "jpeg"
+ * or "webp"; path may be NULL to keep it in memory only. Frames are
+ * dropped from the thumbnail branch, never from the DASH output. Must be
+ * set before start. */
+int rtsp_dash_stream_set_thumbnail(RtspDashStream *stream, int interval_s, int width_px,
+                                   const char *format, const char *path);
+
+/* Copies the latest thumbnail into *data, release with rtsp_dash_free();
+ * fails until the first one has been taken */
+int rtsp_dash_stream_get_snapshot(RtspDashStream *stream, uint8_t **data, size_t *size);
+
+/* Callbacks must be registered before rtsp_dash_stream_start() */
+void rtsp_dash_stream_set_segment_callback(RtspDashStream *stream,
+                                           RtspDashSegmentFunc func,
+                                           void *user_data);
+void rtsp_dash_stream_set_frame_callback(RtspDashStream *stream,
+                                         RtspDashFrameFunc func,
+                                         void *user_data);
+
+/* Fails without starting when the stream does not fit the CPU headroom */
+int rtsp_dash_stream_start(RtspDashStream *stream);
+void rtsp_dash_stream_stop(RtspDashStream *stream);
+
+RtspDashState rtsp_dash_stream_get_state(RtspDashStream *stream);
+
+/* Returns the stream counters serialized as a GstStructure string,
+ * release with rtsp_dash_free() */
+char *rtsp_dash_stream_get_stats(RtspDashStream *stream);
+
+void rtsp_dash_free(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RTSP_DASH_H */
@@ -0,0 +1,280 @@
+#include "scoring.h"
+#include "encoders.h"
+
+#include <gst/video/video.h>
+#include <cmath>
+#include <cstring>
+
+std::string clip_description(const gchar *uri, int width, int height, int frames,
+                             const FrameRegion *crop) {
+    gchar *source = uri
+        ? g_strdup_printf("uridecodebin uri=\"%s\"", uri)
+        : g_strdup("videotestsrc pattern=ball motion=sweep background-color=0xff306030");
+
+    // videocrop works out the right and bottom margins (-1) from the
+    // region size the caps ask for
+    if (crop && crop->width > 0) {
+        gchar *cropped = g_strdup_printf(
+            "%s ! videoconvert ! videocrop left=%d top=%d right=-1 bottom=-1 "
+            "! video/x-raw,width=%d,height=%d",
+            source, crop->x, crop->y, crop->width, crop->height);
+        g_free(source);
+        source = cropped;
+    }
+
+    gchar *description = g_strdup_printf(
+        "%s ! videoconvert ! videoscale ! videorate "
+        "! video/x-raw,format=I420,width=%d,height=%d,framerate=%d/1 "
+        "! identity eos-after=%d",
+        source, width, height, SCORING_FRAMERATE, frames);
+    std::string result = description;
+    g_free(source);
+    g_free(description);
+    return result;
+}
+
+std::string rate_distortion_pipeline(const gchar *uri, const RenditionConfig& rendition,
+                                     int frames, bool vmaf, const gchar *vmaf_model) {
+    std::string encode = std::string(find_video_encoder(rendition.codec)) + " name=encoder ! " +
+                         video_parser_factory(rendition.codec);
+    std::string description =
+        clip_description(uri, rendition.width, rendition.height, frames, &rendition.crop) +
+        " ! tee name=t"
+        " t. ! queue ! " + encode + " ! tee name=e"
+        " e. ! queue ! fakesink name=encoded"
+        " e. ! queue ! decodebin ! videoconvert ! video/x-raw,format=I420 ! tee name=d"
+        " d. ! queue ! fakesink name=decoded"
+        " t. ! queue ! tee name=r"
+        " r. ! queue ! fakesink name=reference";
+
+    if (vmaf) {
+        description += " r. ! queue ! vmaf.ref_sink d. ! queue ! vmaf.dist_sink"
+                       " vmaf name=vmaf";
+        if (vmaf_model) {
+            description += std::string(" model-filename=\"") + vmaf_model + "\"";
+        }
+        description += " ! fakesink";
+    }
+    return description;
+}
+
+static void on_encoded(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data) {
+    *static_cast<guint64*>(user_data) += gst_buffer_get_size(buffer);
+}
+
+bool run_encode_pipeline(const std::string& description, int kbps,
+                         FrameComparator *comparator, guint64 *encoded_bytes) {
+    GError *err = NULL;
+    GstElement *pipeline = gst_parse_launch(description.c_str(), &err);
+    if (!pipeline) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return false;
+    }
+    return run_encode_pipeline(pipeline, kbps, comparator, encoded_bytes);
+}
+
+bool run_encode_pipeline(GstElement *pipeline, int kbps,
+                         FrameComparator *comparator, guint64 *encoded_bytes) {
+    GstElement *encoder = gst_bin_get_by_name(GST_BIN(pipeline), "encoder");
+    if (encoder) {
+        configure_video_encoder(encoder, kbps);
+        gst_object_unref(encoder);
+    }
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "encoded");
+    if (sink) {
+        g_object_set(sink, "signal-handoffs", TRUE, "sync", FALSE, NULL);
+        g_signal_connect(sink, "handoff", G_CALLBACK(on_encoded), encoded_bytes);
+        gst_object_unref(sink);
+    }
+    if (comparator) {
+        comparator->attach(pipeline);
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GError *err = NULL;
+    bool ok = false;
+    bool done = false;
+    while (!done) {
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+            (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR | GST_MESSAGE_ELEMENT));
+        switch (GST_MESSAGE_TYPE(msg)) {
+            case GST_MESSAGE_EOS:
+                ok = done = true;
+                break;
+            case GST_MESSAGE_ERROR: {
+                gchar *debug = NULL;
+                gst_message_parse_error(msg, &err, &debug);
+                g_printerr("  %s\n", err->message);
+                g_error_free(err);
+                g_free(debug);
+                done = true;
+                break;
+            }
+            default:
+                if (comparator) {
+                    comparator->handle_message(msg);
+                }
+                break;
+        }
+        gst_message_unref(msg);
+    }
+    gst_object_unref(bus);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    return ok;
+}
+
+void FrameComparator::attach(GstElement *pipeline) {
+    GstElement *reference = gst_bin_get_by_name(GST_BIN(pipeline), "reference");
+    GstElement *decoded = gst_bin_get_by_name(GST_BIN(pipeline), "decoded");
+
+    GstElement *sinks[] = { reference, decoded };
+    for (GstElement *sink : sinks) {
+        g_object_set(sink, "signal-handoffs", TRUE, "sync", FALSE, NULL);
+    }
+    g_signal_connect(reference, "handoff", G_CALLBACK(on_reference), this);
+    g_signal_connect(decoded, "handoff", G_CALLBACK(on_decoded), this);
+
+    gst_object_unref(reference);
+    gst_object_unref(decoded);
+
+    // Per-frame scores of the optional vmaf element arrive on the bus
+    GstElement *vmaf = gst_bin_get_by_name(GST_BIN(pipeline), "vmaf");
+    if (vmaf) {
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(vmaf), "frame-message")) {
+            g_object_set(vmaf, "frame-message", TRUE, NULL);
+        }
+        gst_object_unref(vmaf);
+    }
+}
+
+void FrameComparator::handle_message(GstMessage *msg) {
+    const GstStructure *structure = gst_message_get_structure(msg);
+    gdouble score;
+    if (structure && gst_structure_has_name(structure, "VMAF") &&
+        gst_structure_get_double(structure, "score", &score)) {
+        std::lock_guard<std::mutex> guard(lock);
+        vmaf_sum += score;
+        vmaf_frames++;
+    }
+}
+
+double FrameComparator::mean_psnr() const {
+    return compared > 0 ? psnr_sum / compared : 0;
+}
+
+double FrameComparator::mean_ssim() const {
+    return compared > 0 ? ssim_sum / compared : 0;
+}
+
+double FrameComparator::mean_vmaf() const {
+    return vmaf_frames > 0 ? vmaf_sum / vmaf_frames : -1;
+}
+
+void FrameComparator::on_reference(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data) {
+    static_cast<FrameComparator*>(user_data)->add_frame(0, buffer, pad);
+}
+
+void FrameComparator::on_decoded(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data) {
+    static_cast<FrameComparator*>(user_data)->add_frame(1, buffer, pad);
+}
+
+static double luma_psnr(const std::vector<guint8>& a, const std::vector<guint8>& b) {
+    double sum = 0;
+    for (gsize i = 0; i < a.size(); i++) {
+        double diff = (double)a[i] - b[i];
+        sum += diff * diff;
+    }
+    double mse = sum / a.size();
+    // Identical frames, capped like most tools do
+    return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : 100;
+}
+
+// SSIM over 8x8 windows every 4 pixels, the unweighted variant libvpx
+// and x264 report, close to the Gaussian original at a fraction of the cost
+static double luma_ssim(const std::vector<guint8>& a, const std::vector<guint8>& b,
+                        gint width, gint height) {
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+    const gint window = 8;
+    double sum = 0;
+    guint windows = 0;
+
+    for (gint y = 0; y + window <= height; y += 4) {
+        for (gint x = 0; x + window <= width; x += 4) {
+            guint64 sum_a = 0, sum_b = 0, sum_aa = 0, sum_bb = 0, sum_ab = 0;
+            for (gint row = y; row < y + window; row++) {
+                const guint8 *pa = &a[row * width + x];
+                const guint8 *pb = &b[row * width + x];
+                for (gint col = 0; col < window; col++) {
+                    sum_a += pa[col];
+                    sum_b += pb[col];
+                    sum_aa += pa[col] * pa[col];
+                    sum_bb += pb[col] * pb[col];
+                    sum_ab += pa[col] * pb[col];
+                }
+            }
+
+            const double n = window * window;
+            double mean_a = sum_a / n, mean_b = sum_b / n;
+            double var_a = sum_aa / n - mean_a * mean_a;
+            double var_b = sum_bb / n - mean_b * mean_b;
+            double covar = sum_ab / n - mean_a * mean_b;
+            sum += ((2 * mean_a * mean_b + c1) * (2 * covar + c2)) /
+                   ((mean_a * mean_a + mean_b * mean_b + c1) * (var_a + var_b + c2));
+            windows++;
+        }
+    }
+    return windows > 0 ? sum / windows : 1;
+}
+
+void FrameComparator::add_frame(int side, GstBuffer *buffer, GstPad *pad) {
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    GstVideoInfo info;
+    bool valid = caps && gst_video_info_from_caps(&info, caps);
+    if (caps) {
+        gst_caps_unref(caps);
+    }
+    GstMapInfo map;
+    if (!valid || !gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        return;
+    }
+
+    // Only the luma plane is kept, without the stride padding
+    gint width = GST_VIDEO_INFO_WIDTH(&info);
+    gint height = GST_VIDEO_INFO_HEIGHT(&info);
+    gint stride = GST_VIDEO_INFO_PLANE_STRIDE(&info, 0);
+    gsize offset = GST_VIDEO_INFO_PLANE_OFFSET(&info, 0);
+    std::vector<guint8> luma(width * height);
+    for (gint row = 0; row < height; row++) {
+        memcpy(&luma[row * width], map.data + offset + row * stride, width);
+    }
+    gst_buffer_unmap(buffer, &map);
+
+    // Whichever side arrives second scores the pair
+    std::unique_lock<std::mutex> guard(lock);
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    auto& other = pending[1 - side];
+    auto match = other.find(pts);
+    if (match == other.end()) {
+        pending[side][pts] = std::move(luma);
+        return;
+    }
+    std::vector<guint8> counterpart = std::move(match->second);
+    other.erase(match);
+    guard.unlock();
+
+    if (counterpart.size() != luma.size()) {
+        return;
+    }
+    double psnr = luma_psnr(counterpart, luma);
+    double ssim = luma_ssim(counterpart, luma, width, height);
+
+    guard.lock();
+    psnr_sum += psnr;
+    ssim_sum += ssim;
+    compared++;
+}
@@ -0,0 +1,72 @@
+#ifndef RTSP_DASH_SCORING_H
+#define RTSP_DASH_SCORING_H
+
+#include "config.h"
+
+#include <gst/gst.h>
+#include <glib.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Objective quality of encodes against their source, shared by the
+// ladder calibration and the benchmarks
+
+// Every clip is rendered at this rate, whatever the source's
+static const int SCORING_FRAMERATE = 25;
+
+// Launch line of raw I420 frames at width x height, ending after frames.
+// uri is any clip uridecodebin plays, NULL for a moving test pattern.
+// With crop only that region of the clip is scaled, as in the streamer.
+std::string clip_description(const gchar *uri, int width, int height, int frames,
+                             const FrameRegion *crop = nullptr);
+
+// clip_description() encoded as rendition, cropped like it, split into the reference,
+// a fakesink named "encoded" and the decoded frames. With vmaf both
+// sides are also fed to the vmaf element, using vmaf_model if given.
+std::string rate_distortion_pipeline(const gchar *uri, const RenditionConfig& rendition,
+                                     int frames, bool vmaf, const gchar *vmaf_model);
+
+class FrameComparator;
+
+// Runs a launch line to EOS. An element named "encoder" is configured
+// for kbps and the bytes reaching a fakesink named "encoded" are added
+// to encoded_bytes; comparator, if given, scores the run.
+bool run_encode_pipeline(const std::string& description, int kbps,
+                         FrameComparator *comparator, guint64 *encoded_bytes);
+
+// Same for a pipeline the caller has built and hooked up, which it hands
+// over
+bool run_encode_pipeline(GstElement *pipeline, int kbps,
+                         FrameComparator *comparator, guint64 *encoded_bytes);
+
+// Scores decoded frames against the source frames they were encoded
+// from. Hooks the fakesinks named "reference" and "decoded" of a
+// pipeline and pairs their I420 frames by pts; an element named "vmaf"
+// adds its per-frame scores.
+class FrameComparator {
+public:
+    void attach(GstElement *pipeline);
+    void handle_message(GstMessage *msg);
+
+    guint frames() const { return compared; }
+    double mean_psnr() const; // luma, dB
+    double mean_ssim() const; // luma, 0..1
+    double mean_vmaf() const; // 0..100, -1 without a vmaf element
+
+private:
+    std::mutex lock;
+    std::map<GstClockTime, std::vector<guint8>> pending[2];
+    double psnr_sum = 0;
+    double ssim_sum = 0;
+    guint compared = 0;
+    double vmaf_sum = 0;
+    guint vmaf_frames = 0;
+
+    void add_frame(int side, GstBuffer *buffer, GstPad *pad);
+    static void on_reference(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data);
+    static void on_decoded(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data);
+};
+
+#endif // RTSP_DASH_SCORING_H
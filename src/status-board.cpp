@@ -0,0 +1,325 @@
+#include "status-board.h"
+
+#include <cerrno>
+#include <cstring>
+#include <set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const guint32 STATUS_BOARD_MAGIC = 0x52445342; // "RDSB"
+static const guint32 STATUS_BOARD_VERSION = 10;
+
+// Seconds after which a camera record counts as stale
+static const gint64 STALE_RECORD_SECONDS = 10;
+
+struct StatusBoard::Header {
+    guint32 magic;
+    guint32 version;
+    guint32 worker_count;
+    guint32 camera_count;
+};
+
+template <typename T>
+struct StatusBoard::Slot {
+    std::atomic<guint32> sequence;
+    T record;
+};
+
+template <typename T>
+static void write_slot(std::atomic<guint32>& sequence, T& target, const T& record) {
+    guint32 seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&target, &record, sizeof(T));
+    sequence.store(seq + 2, std::memory_order_release);
+}
+
+template <typename T>
+static bool read_slot(const std::atomic<guint32>& sequence, const T& source, T& record) {
+    // A writer holds a slot for a few hundred nanoseconds at most
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        guint32 before = sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(&record, &source, sizeof(T));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence.load(std::memory_order_relaxed) == before) {
+            return true;
+        }
+    }
+    return false;
+}
+
+StatusBoard::StatusBoard()
+    : header(nullptr), size(0), owner(false) {}
+
+StatusBoard::~StatusBoard() {
+    if (header) {
+        munmap(header, size);
+    }
+    if (owner) {
+        shm_unlink(shm_name.c_str());
+    }
+}
+
+bool StatusBoard::create(const std::string& name, const std::vector<CameraConfig>& cameras,
+                         int workers) {
+    gsize length = sizeof(Header) +
+                   workers * sizeof(Slot<WorkerRecord>) +
+                   cameras.size() * sizeof(Slot<CameraRecord>);
+
+    // Replace a board left behind by a previous run
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        g_printerr("Failed to create status board %s: %s\n", name.c_str(), g_strerror(errno));
+        return false;
+    }
+
+    if (ftruncate(fd, length) < 0 || !map(fd, length, true)) {
+        g_printerr("Failed to size status board %s: %s\n", name.c_str(), g_strerror(errno));
+        close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    close(fd);
+
+    shm_name = name;
+    owner = true;
+
+    // The segment is zero-filled, only identities need to be written
+    header->magic = STATUS_BOARD_MAGIC;
+    header->version = STATUS_BOARD_VERSION;
+    header->worker_count = workers;
+    header->camera_count = cameras.size();
+
+    for (gsize i = 0; i < cameras.size(); i++) {
+        CameraRecord record = CameraRecord();
+        g_strlcpy(record.camera_id, cameras[i].id.c_str(), sizeof(record.camera_id));
+        record.worker = -1;
+        publish_camera(i, record);
+    }
+
+    return true;
+}
+
+bool StatusBoard::open(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        g_printerr("Failed to open status board %s: %s\n", name.c_str(), g_strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (gsize)st.st_size < sizeof(Header) ||
+        !map(fd, st.st_size, false)) {
+        g_printerr("Failed to map status board %s\n", name.c_str());
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    if (header->magic != STATUS_BOARD_MAGIC || header->version != STATUS_BOARD_VERSION) {
+        g_printerr("Status board %s has an unknown layout\n", name.c_str());
+        return false;
+    }
+
+    shm_name = name;
+    return true;
+}
+
+bool StatusBoard::map(int fd, gsize length, bool writable) {
+    void *address = mmap(NULL, length, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                         MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+        return false;
+    }
+
+    header = static_cast<Header*>(address);
+    size = length;
+    return true;
+}
+
+int StatusBoard::get_camera_count() const {
+    return header ? header->camera_count : 0;
+}
+
+int StatusBoard::get_worker_count() const {
+    return header ? header->worker_count : 0;
+}
+
+StatusBoard::Slot<WorkerRecord> *StatusBoard::worker_slots() const {
+    return reinterpret_cast<Slot<WorkerRecord>*>(header + 1);
+}
+
+StatusBoard::Slot<CameraRecord> *StatusBoard::camera_slots() const {
+    return reinterpret_cast<Slot<CameraRecord>*>(worker_slots() + header->worker_count);
+}
+
+void StatusBoard::publish_camera(int index, const CameraRecord& record) {
+    if (index >= 0 && index < get_camera_count()) {
+        Slot<CameraRecord>& slot = camera_slots()[index];
+        write_slot(slot.sequence, slot.record, record);
+    }
+}
+
+bool StatusBoard::read_camera(int index, CameraRecord& record) const {
+    if (index < 0 || index >= get_camera_count()) {
+        return false;
+    }
+    const Slot<CameraRecord>& slot = camera_slots()[index];
+    return read_slot(slot.sequence, slot.record, record);
+}
+
+void StatusBoard::publish_worker(int index, const WorkerRecord& record) {
+    if (index >= 0 && index < get_worker_count()) {
+        Slot<WorkerRecord>& slot = worker_slots()[index];
+        write_slot(slot.sequence, slot.record, record);
+    }
+}
+
+bool StatusBoard::read_worker(int index, WorkerRecord& record) const {
+    if (index < 0 || index >= get_worker_count()) {
+        return false;
+    }
+    const Slot<WorkerRecord>& slot = worker_slots()[index];
+    return read_slot(slot.sequence, slot.record, record);
+}
+
+std::string StatusBoard::format_metrics() const {
+    GString *out = g_string_new(NULL);
+    gint64 now = g_get_real_time();
+
+    g_string_append(out, "# TYPE rtsp_dash_worker_up gauge\n");
+    g_string_append(out, "# TYPE rtsp_dash_worker_restarts_total counter\n");
+    for (int i = 0; i < get_worker_count(); i++) {
+        WorkerRecord worker;
+        if (!read_worker(i, worker)) {
+            continue;
+        }
+        g_string_append_printf(out, "rtsp_dash_worker_up{worker=\"%d\",numa_node=\"%d\"} %u\n",
+                               i, worker.numa_node, worker.alive);
+        g_string_append_printf(out, "rtsp_dash_worker_restarts_total{worker=\"%d\"} %u\n",
+                               i, worker.restarts);
+    }
+
+    g_string_append(out, "# TYPE rtsp_dash_camera_state gauge\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_frames_total counter\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_segments_total counter\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_warnings_total counter\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_qos_dropped_total counter\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_latency_recalculations_total counter\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_rtp_jitter_seconds gauge\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_rtp_loss_ratio gauge\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_latency_seconds gauge\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_rtcp_jitter_seconds gauge\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_rtcp_packets_lost_total counter\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_keyframe_requests_total counter\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_transport gauge\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_multicast_joins_total counter\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_multicast_packets_lost_total counter\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_tcp_fallbacks_total counter\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_failovers_total counter\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_last_failover_seconds gauge\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_branch_restarts_total counter\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_branch_restart_failures_total counter\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_decode_skip_level gauge\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_decode_skipped_total counter\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_decode_fps gauge\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_cpu_projected_cores gauge\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_cpu_measured_cores gauge\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_admissions_refused_total counter\n");
+    g_string_append(out, "# TYPE rtsp_dash_camera_stale gauge\n");
+    std::set<int> load_workers;
+    GString *worker_load = g_string_new(NULL);
+    for (int i = 0; i < get_camera_count(); i++) {
+        CameraRecord camera;
+        if (!read_camera(i, camera)) {
+            continue;
+        }
+
+        gchar *labels = g_strdup_printf("camera=\"%s\",worker=\"%d\"",
+                                        camera.camera_id, camera.worker);
+        bool stale = camera.updated_us == 0 ||
+                     now - camera.updated_us > STALE_RECORD_SECONDS * G_USEC_PER_SEC;
+
+        g_string_append_printf(out, "rtsp_dash_camera_state{%s} %u\n", labels, camera.state);
+        g_string_append_printf(out, "rtsp_dash_camera_frames_total{%s} %" G_GUINT64_FORMAT "\n",
+                               labels, camera.frames);
+        g_string_append_printf(out, "rtsp_dash_camera_segments_total{%s} %" G_GUINT64_FORMAT "\n",
+                               labels, camera.segments);
+        g_string_append_printf(out, "rtsp_dash_camera_warnings_total{%s} %" G_GUINT64_FORMAT "\n",
+                               labels, camera.warnings);
+        g_string_append_printf(out, "rtsp_dash_camera_qos_dropped_total{%s} %" G_GUINT64_FORMAT "\n",
+                               labels, camera.qos_dropped);
+        g_string_append_printf(out, "rtsp_dash_camera_latency_recalculations_total{%s} %" G_GUINT64_FORMAT "\n",
+                               labels, camera.latency_recalculations);
+        g_string_append_printf(out, "rtsp_dash_camera_rtp_jitter_seconds{%s} %.6f\n",
+                               labels, camera.rtp_jitter_us / 1e6);
+        g_string_append_printf(out, "rtsp_dash_camera_rtp_loss_ratio{%s} %.6f\n",
+                               labels, camera.rtp_loss_rate);
+        g_string_append_printf(out, "rtsp_dash_camera_latency_seconds{%s} %.3f\n",
+                               labels, camera.latency_ms / 1e3);
+        g_string_append_printf(out, "rtsp_dash_camera_rtcp_jitter_seconds{%s} %.6f\n",
+                               labels, camera.rtcp_jitter_us / 1e6);
+        g_string_append_printf(out, "rtsp_dash_camera_rtcp_packets_lost_total{%s} %" G_GUINT64_FORMAT "\n",
+                               labels, camera.rtcp_packets_lost);
+        g_string_append_printf(out, "rtsp_dash_camera_keyframe_requests_total{%s} %" G_GUINT64_FORMAT "\n",
+                               labels, camera.keyframe_requests);
+        g_string_append_printf(out, "rtsp_dash_camera_transport{%s,transport=\"%s\"} 1\n",
+                               labels, rtp_transport_name((RtpTransport)camera.transport));
+        g_string_append_printf(out, "rtsp_dash_camera_multicast_joins_total{%s} %" G_GUINT64_FORMAT "\n",
+                               labels, camera.multicast_joins);
+        g_string_append_printf(out, "rtsp_dash_camera_multicast_packets_lost_total{%s} %" G_GUINT64_FORMAT "\n",
+                               labels, camera.multicast_packets_lost);
+        g_string_append_printf(out, "rtsp_dash_camera_tcp_fallbacks_total{%s} %" G_GUINT64_FORMAT "\n",
+                               labels, camera.tcp_fallbacks);
+        g_string_append_printf(out, "rtsp_dash_camera_failovers_total{%s} %" G_GUINT64_FORMAT "\n",
+                               labels, camera.failovers);
+        g_string_append_printf(out, "rtsp_dash_camera_last_failover_seconds{%s} %.3f\n",
+                               labels, camera.last_failover_ms / 1e3);
+        g_string_append_printf(out, "rtsp_dash_camera_branch_restarts_total{%s} %" G_GUINT64_FORMAT "\n",
+                               labels, camera.branch_restarts);
+        g_string_append_printf(out, "rtsp_dash_camera_branch_restart_failures_total{%s} %" G_GUINT64_FORMAT "\n",
+                               labels, camera.branch_restart_failures);
+        g_string_append_printf(out, "rtsp_dash_camera_decode_skip_level{%s} %d\n",
+                               labels, camera.decode_skip_level);
+        g_string_append_printf(out, "rtsp_dash_camera_decode_skipped_total{%s} %" G_GUINT64_FORMAT "\n",
+                               labels, camera.decode_skipped);
+        g_string_append_printf(out, "rtsp_dash_camera_decode_fps{%s} %.2f\n",
+                               labels, camera.decode_fps);
+        g_string_append_printf(out, "rtsp_dash_camera_cpu_projected_cores{%s} %.3f\n",
+                               labels, camera.cpu_projected);
+        g_string_append_printf(out, "rtsp_dash_camera_cpu_measured_cores{%s} %.3f\n",
+                               labels, camera.cpu_measured);
+        g_string_append_printf(out, "rtsp_dash_camera_admissions_refused_total{%s} %" G_GUINT64_FORMAT "\n",
+                               labels, camera.admissions_refused);
+        g_string_append_printf(out, "rtsp_dash_camera_stale{%s} %d\n", labels, stale ? 1 : 0);
+        g_free(labels);
+
+        // Every camera of a worker carries its process totals
+        if (!stale && load_workers.insert(camera.worker).second) {
+            g_string_append_printf(worker_load,
+                "rtsp_dash_worker_cpu_projected_cores{worker=\"%d\"} %.3f\n"
+                "rtsp_dash_worker_cpu_measured_cores{worker=\"%d\"} %.3f\n"
+                "rtsp_dash_worker_cpu_capacity_cores{worker=\"%d\"} %.3f\n",
+                camera.worker, camera.worker_cpu_projected,
+                camera.worker, camera.worker_cpu_measured,
+                camera.worker, camera.worker_cpu_capacity);
+        }
+    }
+
+    g_string_append(out, "# TYPE rtsp_dash_worker_cpu_projected_cores gauge\n");
+    g_string_append(out, "# TYPE rtsp_dash_worker_cpu_measured_cores gauge\n");
+    g_string_append(out, "# TYPE rtsp_dash_worker_cpu_capacity_cores gauge\n");
+    g_string_append(out, worker_load->str);
+    g_string_free(worker_load, TRUE);
+
+    gchar *text = g_string_free(out, FALSE);
+    std::string metrics(text);
+    g_free(text);
+    return metrics;
+}
@@ -0,0 +1,111 @@
+#ifndef RTSP_DASH_STATUS_BOARD_H
+#define RTSP_DASH_STATUS_BOARD_H
+
+#include "config.h"
+
+#include <glib.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Camera state as published on the board
+enum CameraState {
+    CAMERA_STATE_STOPPED = 0,
+    CAMERA_STATE_SLATE,
+    CAMERA_STATE_LIVE,
+    CAMERA_STATE_BACKUP, // primary down, showing the hot standby
+    CAMERA_STATE_QUEUED  // waiting for CPU headroom, see AdmissionControl
+};
+
+// Written only by the worker that owns the camera
+struct CameraRecord {
+    char camera_id[64];
+    gint32 worker;
+    gint32 pid;
+    guint32 state;
+    guint64 frames;
+    guint64 segments;
+    guint64 warnings;
+    guint64 qos_dropped;
+    guint64 latency_recalculations;
+    gdouble rtp_loss_rate;
+    guint32 rtp_jitter_us;
+    guint32 latency_ms;
+    guint32 rtcp_jitter_us;
+    guint64 rtcp_packets_lost;
+    guint64 keyframe_requests;
+    guint32 transport; // RtpTransport
+    guint64 multicast_joins;
+    guint64 multicast_packets_lost;
+    guint64 tcp_fallbacks;
+    guint64 failovers;
+    guint32 last_failover_ms;
+    guint64 branch_restarts; // renditions rebuilt after an error
+    guint64 branch_restart_failures; // rebuilds that failed and are retried
+
+    // RTSP decoder frame skipping: 0 none, 1 non-reference, 2 all but keyframes
+    gint32 decode_skip_level;
+    guint64 decode_skipped;
+    gdouble decode_fps;
+
+    // Cores of this camera and of its worker process, projected by the
+    // cost model and measured
+    gdouble cpu_projected;
+    gdouble cpu_measured;
+    guint64 admissions_refused;
+    gdouble worker_cpu_projected;
+    gdouble worker_cpu_measured;
+    gdouble worker_cpu_capacity;
+
+    gint64 updated_us; // wall clock of the last publish
+};
+
+// Written only by the supervisor
+struct WorkerRecord {
+    gint32 pid;
+    gint32 numa_node;
+    guint32 alive;
+    guint32 restarts;
+    gint64 started_us;
+};
+
+// Fixed-layout status table in POSIX shared memory. Every record is
+// guarded by its own sequence counter (odd while being written), so
+// readers never block writers and never need to talk to them.
+class StatusBoard {
+public:
+    StatusBoard();
+    ~StatusBoard();
+
+    // Creates and sizes the segment, assigning cameras to slots in order
+    bool create(const std::string& name, const std::vector<CameraConfig>& cameras,
+                int workers);
+    // Maps an existing segment read-only
+    bool open(const std::string& name);
+
+    int get_camera_count() const;
+    int get_worker_count() const;
+
+    void publish_camera(int index, const CameraRecord& record);
+    bool read_camera(int index, CameraRecord& record) const;
+    void publish_worker(int index, const WorkerRecord& record);
+    bool read_worker(int index, WorkerRecord& record) const;
+
+    // Prometheus text exposition of the whole board
+    std::string format_metrics() const;
+
+private:
+    struct Header;
+    template <typename T> struct Slot;
+
+    Header *header;
+    gsize size;
+    std::string shm_name;
+    bool owner;
+
+    Slot<WorkerRecord> *worker_slots() const;
+    Slot<CameraRecord> *camera_slots() const;
+    bool map(int fd, gsize length, bool writable);
+};
+
+#endif // RTSP_DASH_STATUS_BOARD_H
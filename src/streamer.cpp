@@ -0,0 +1,3878 @@
+#include "streamer.h"
+#include "admission.h"
+#include "encoders.h"
+#include "probes.h"
+
+#include <gst/video/video.h>
+#include <glib-unix.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Adaptive load control: the health check runs every HEALTH_INTERVAL
+// seconds; a branch that drops frames or has a half full queue for
+// PRESSURE_WINDOWS checks in a row is stepped down one load level, one
+// that stays calm for CALM_WINDOWS checks is stepped back up
+static const guint HEALTH_INTERVAL = 2;
+static const guint PRESSURE_WINDOWS = 2;
+static const guint CALM_WINDOWS = 15;
+
+// Encoder input per load level: every frame, 1 in 2, 1 in 3. Keeping
+// every Nth frame gives an even lower rate, and the kept frame lasts as
+// long as the ones it replaces, so the timeline has no holes.
+static const guint LOAD_LEVEL_FRAME_DIVISOR[] = { 1, 2, 3 };
+static const int MAX_LOAD_LEVEL = G_N_ELEMENTS(LOAD_LEVEL_FRAME_DIVISOR) - 1;
+
+// When that is not enough, i.e. a branch is still under pressure at
+// MAX_LOAD_LEVEL or the decoder drops late frames, the RTSP decoder skips
+// frames the same way: non-reference frames first, then all but
+// keyframes. Temporal resolution goes instead of latency piling up.
+enum DecodeSkip {
+    DECODE_SKIP_NONE,
+    DECODE_SKIP_NONREF,
+    DECODE_SKIP_NONKEY
+};
+
+// Jitterbuffer latency control: every LATENCY_INTERVAL seconds the
+// latency is moved towards JITTER_MULTIPLIER times the measured jitter
+// plus headroom. Late or lost packets raise it by a quarter right away,
+// a lower target is approached by at most a tenth per check.
+static const guint LATENCY_INTERVAL = 5;
+static const guint JITTER_MULTIPLIER = 4;
+static const guint LATENCY_HEADROOM_MS = 20;
+static const guint LATENCY_MIN_STEP_MS = 10;
+static const double LOSS_THRESHOLD = 0.005;
+
+// RTCP statistics are read every RTCP_INTERVAL seconds. Keyframe requests
+// are sent at most once per KEYFRAME_REQUEST_INTERVAL, one request covers
+// all the damage until the camera's next IDR anyway.
+static const guint RTCP_INTERVAL = 5;
+static const gint64 KEYFRAME_REQUEST_INTERVAL = G_USEC_PER_SEC;
+static const guint MAX_RTP_SESSIONS = 8;
+
+// On-demand renditions: every DEMAND_INTERVAL seconds the ones nobody
+// requested for demand_idle seconds are stopped. Players keep refetching
+// the manifest every MANIFEST_UPDATE_MS, which is what keeps one running.
+static const guint DEMAND_INTERVAL = 5;
+static const guint64 MANIFEST_UPDATE_MS = 4000;
+static const gchar MANIFEST_SUFFIX[] = "_manifest.mpd";
+
+// CPU cost model: every COST_INTERVAL seconds the pixels processed are
+// handed to AdmissionControl, which samples the threads' CPU time. Until
+// a key is measured, the seeds assume about half a core for 1080p25
+// H.264 and a few times that for the slower codecs.
+static const guint COST_INTERVAL = 5;
+static const double DECODE_SEED_NS_PER_PIXEL = 3.0;
+static const double ENCODE_SEED_NS_PER_PIXEL[] = { 10.0, 40.0, 30.0 }; // by VideoCodec
+static const int RENDITION_FPS = 25;
+
+// A rendition that fails is rebuilt on its own after RESTART_DELAY_MIN
+// seconds, doubling up to RESTART_DELAY_MAX while it fails again before
+// writing a segment, e.g. on a full disk. Its elements carry BRANCH_KEY.
+static const guint RESTART_DELAY_MIN = 1;
+static const guint RESTART_DELAY_MAX = 60;
+static const gchar BRANCH_KEY[] = "rtsp-dash-branch";
+
+// videorate normally repeats frames to keep the branch at RENDITION_FPS.
+// That would re-create the frames the decoder skipped, so the encoders
+// would still encode the full rate. In drop-only mode the lower rate
+// reaches them instead. The caps keep RENDITION_FPS, and mp4mux stretches
+// each sample to the next timestamp.
+static void set_rate_drop_only(GstElement *videorate, bool drop_only) {
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(videorate), "drop-only")) {
+        g_object_set(videorate, "drop-only", (gboolean)drop_only, NULL);
+    }
+}
+
+static const gchar *decode_skip_name(int level) {
+    switch (level) {
+        case DECODE_SKIP_NONREF:
+            return "non-reference";
+        case DECODE_SKIP_NONKEY:
+            return "non-key";
+        default:
+            return "none";
+    }
+}
+
+// What feeds the shared audio track
+enum AudioSource {
+    AUDIO_SOURCE_NONE,
+    AUDIO_SOURCE_SILENCE,
+    AUDIO_SOURCE_PASSTHROUGH,
+    AUDIO_SOURCE_TRANSCODE
+};
+
+static const gchar *audio_source_name(int source) {
+    switch (source) {
+        case AUDIO_SOURCE_SILENCE:
+            return "silence";
+        case AUDIO_SOURCE_PASSTHROUGH:
+            return "passthrough";
+        case AUDIO_SOURCE_TRANSCODE:
+            return "transcode";
+        default:
+            return "none";
+    }
+}
+
+RTSPDashStreamer::RTSPDashStreamer(const std::string& uri, const std::string& output)
+    : pipeline(nullptr), rtsp_src(nullptr), dummy_src(nullptr),
+      input_selector(nullptr), tee(nullptr), rtsp_depay(nullptr), rtsp_decoder(nullptr),
+      backup_src(nullptr), backup_depay(nullptr), backup_decoder(nullptr),
+      dummy_selector_pad(nullptr), rtsp_selector_pad(nullptr), backup_selector_pad(nullptr),
+      bus(nullptr),
+      context(nullptr),
+      bus_watch_id(0), reconnect_timeout_id(0), health_timeout_id(0),
+      latency_timeout_id(0), rtcp_timeout_id(0), backup_reconnect_timeout_id(0),
+      camera_id("default"), rtsp_uri(uri), output_path(output),
+      is_rtsp_connected(false), rtsp_connections(0), rtsp_restarting(false),
+      is_loop_running(false), stop_requested(false),
+      segment_callback(nullptr), segment_user_data(nullptr),
+      frame_callback(nullptr), frame_user_data(nullptr),
+      scaled_frame_callback(nullptr), scaled_frame_user_data(nullptr),
+      rtsp_warnings(0), pipeline_warnings(0), qos_events(0),
+      decoder_qos_dropped(0), latency_recalculations(0),
+      rtp_jitter_us(0), rtp_loss_rate(0), rtp_manager(nullptr),
+      rtp_pushed_seen(0), rtp_lost_seen(0), rtp_late_seen(0),
+      rtcp_jitter_us(0), rtcp_packets_received(0), rtcp_packets_lost(0),
+      rtcp_keyframe_requests_sent(0),
+      rtcp_received_seen(0), rtcp_lost_seen(0), rtcp_requests_seen(0),
+      last_keyframe_request_us(0), keyframe_requests(0), keyframe_requests_suppressed(0),
+      transport_policy(TRANSPORT_AUTO), rtp_transport(RTP_TRANSPORT_NONE),
+      multicast_joins(0), multicast_packets_lost(0), tcp_fallbacks(0),
+      backup_connected(false), backup_active(false), backup_waiting_keyframe(false),
+      backup_selected(false), backup_switch_pending(false), backup_restarting(false),
+      failover_started_us(0), failovers(0), last_failover_ms(0),
+      audio_raw_selector(nullptr), audio_encoded_selector(nullptr), audio_tee(nullptr),
+      rtsp_audio_depay(nullptr), silence_selector_pad(nullptr), audio_encoder_pad(nullptr),
+      rtsp_audio_pad(nullptr), rtsp_audio_passthrough(false),
+      audio_source(AUDIO_SOURCE_NONE),
+      thumbnail_tee_pad(nullptr), snapshot_taken_us(0), snapshots(0),
+      thumbnail_write_failed(false),
+      frame_info_valid(false), denoised_frames(0), denoise_us(0),
+      timestamp_overlay(false), overlaid_frames(0), overlay_us(0),
+      publishing(true), reference_sampled_us(0), capture_delay_ms(-1),
+      demand_watch_fd(-1), demand_watch_id(0), demand_timeout_id(0),
+      input_reservation(0), decoded_frames(0), decoded_frames_seen(0), decoded_pixels(0),
+      cost_evaluated_us(0), admissions_refused(0), cost_timeout_id(0),
+      decode_skip_level(DECODE_SKIP_NONE), decode_resync(false), decode_skipped(0),
+      decode_pressure_windows(0), decode_calm_windows(0), decoder_qos_dropped_seen(0),
+      decode_rate_frames_seen(0), decode_rate_us(0), decode_fps(0) {
+    // Every streamer owns its main context so several of them can run
+    // side by side in one process, each on its own thread
+    context = g_main_context_new();
+
+    const CameraConfig defaults;
+    current_latency_ms = defaults.latency_ms;
+    min_latency_ms = defaults.min_latency_ms;
+    max_latency_ms = defaults.max_latency_ms;
+    adaptive_latency = defaults.adaptive_latency;
+    audio_enabled = defaults.audio;
+    audio_rate = defaults.audio_rate;
+    audio_channels = defaults.audio_channels;
+    audio_bitrate = defaults.audio_bitrate;
+    on_demand = defaults.on_demand;
+    demand_idle = defaults.demand_idle;
+}
+
+RTSPDashStreamer::RTSPDashStreamer(const CameraConfig& camera)
+    : RTSPDashStreamer(camera.rtsp_uri, camera.output_path) {
+    camera_id = camera.id;
+    current_latency_ms = camera.latency_ms;
+    min_latency_ms = camera.min_latency_ms;
+    max_latency_ms = camera.max_latency_ms;
+    adaptive_latency = camera.adaptive_latency;
+    transport_policy = camera.transport;
+    multicast_iface = camera.multicast_iface;
+    backup_uri = camera.backup_rtsp_uri;
+    audio_enabled = camera.audio;
+    audio_rate = camera.audio_rate;
+    audio_channels = camera.audio_channels;
+    audio_bitrate = camera.audio_bitrate;
+    thumbnail = camera.thumbnail;
+    trickplay_rendition = camera.trickplay;
+    denoise = camera.denoise;
+    privacy_masks = camera.privacy_masks;
+    timestamp_overlay = camera.timestamp;
+    overlay_text = camera.overlay_text;
+    on_demand = camera.on_demand;
+    demand_idle = camera.demand_idle;
+    if (!camera.calibrated_renditions.empty()) {
+        set_renditions(camera.calibrated_renditions);
+    } else if (!camera.renditions.empty()) {
+        set_renditions(camera.renditions);
+    }
+}
+
+RTSPDashStreamer::~RTSPDashStreamer() {
+    cleanup();
+}
+
+std::vector<RenditionConfig> RTSPDashStreamer::default_ladder() {
+    std::vector<RenditionConfig> ladder;
+    ladder.push_back({"fullhd", 1920, 1080, 5000, CODEC_H264});
+    ladder.push_back({"hd", 1280, 720, 3000, CODEC_H264});
+    return ladder;
+}
+
+void RTSPDashStreamer::set_renditions(const std::vector<RenditionConfig>& ladder) {
+    std::lock_guard<std::mutex> guard(branches_lock);
+    for (RenditionBranch *branch : branches) {
+        delete branch;
+    }
+    branches.clear();
+
+    for (const RenditionConfig& config : ladder) {
+        RenditionBranch *branch = new RenditionBranch();
+        branch->owner = this;
+        branch->config = config;
+        branches.push_back(branch);
+    }
+}
+
+void RTSPDashStreamer::set_backup_uri(const std::string& uri) {
+    backup_uri = uri;
+}
+
+void RTSPDashStreamer::set_thumbnail(const ThumbnailConfig& config) {
+    thumbnail = config;
+}
+
+void RTSPDashStreamer::set_trickplay(const std::string& rendition) {
+    trickplay_rendition = rendition;
+}
+
+void RTSPDashStreamer::set_denoise(const DenoiseConfig& config) {
+    denoise = config;
+}
+
+void RTSPDashStreamer::add_privacy_mask(const FrameRegion& region) {
+    privacy_masks.push_back(region);
+}
+
+void RTSPDashStreamer::set_timestamp_overlay(bool enabled, const std::string& text) {
+    timestamp_overlay = enabled;
+    overlay_text = text;
+}
+
+void RTSPDashStreamer::set_utc_timing(const std::string& url) {
+    utc_timing = url;
+}
+
+void RTSPDashStreamer::set_segment_subdirectory(const std::string& name) {
+    segment_subdirectory = name;
+}
+
+void RTSPDashStreamer::set_on_demand(bool enabled, int idle_seconds) {
+    on_demand = enabled;
+    demand_idle = MAX(idle_seconds, 1);
+}
+
+void RTSPDashStreamer::set_segment_callback(SegmentCallback callback, gpointer user_data) {
+    segment_callback = callback;
+    segment_user_data = user_data;
+}
+
+void RTSPDashStreamer::set_frame_callback(FrameCallback callback, gpointer user_data) {
+    frame_callback = callback;
+    frame_user_data = user_data;
+}
+
+void RTSPDashStreamer::set_scaled_frame_callback(ScaledFrameCallback callback, gpointer user_data) {
+    scaled_frame_callback = callback;
+    scaled_frame_user_data = user_data;
+}
+
+void RTSPDashStreamer::choose_scaled_frame_rendition() {
+    // The smallest rendition showing the whole frame, a crop only when
+    // there is nothing else
+    const RenditionConfig *smallest = nullptr;
+    for (RenditionBranch *branch : branches) {
+        const RenditionConfig& config = branch->config;
+        if (!smallest) {
+            smallest = &config;
+            continue;
+        }
+        bool cropped = config.crop.width > 0;
+        bool smallest_cropped = smallest->crop.width > 0;
+        if ((smallest_cropped && !cropped) ||
+            (cropped == smallest_cropped &&
+             config.width * config.height < smallest->width * smallest->height)) {
+            smallest = &config;
+        }
+    }
+    scaled_frame_rendition = smallest ? smallest->name : "";
+}
+
+bool RTSPDashStreamer::initialize() {
+    if (!segment_subdirectory.empty() &&
+        g_mkdir_with_parents(segment_path().c_str(), 0755) < 0) {
+        g_printerr("Failed to create %s: %s\n", segment_path().c_str(), g_strerror(errno));
+        return false;
+    }
+
+    // Create main pipeline
+    pipeline = gst_pipeline_new("rtsp-dash-pipeline");
+    if (!pipeline) {
+        g_printerr("Failed to create pipeline\n");
+        return false;
+    }
+
+    // Create RTSP source
+    rtsp_src = gst_element_factory_make("rtspsrc", "rtsp-source");
+    if (!rtsp_src) {
+        g_printerr("Failed to create rtspsrc element\n");
+        return false;
+    }
+
+    configure_rtsp_source(rtsp_src, rtsp_uri);
+
+    // Optional hot standby, connected all the time but only decoded
+    // while the primary is down
+    if (!backup_uri.empty()) {
+        backup_src = gst_element_factory_make("rtspsrc", "rtsp-backup-source");
+        if (!backup_src) {
+            g_printerr("Failed to create backup rtspsrc element\n");
+            return false;
+        }
+        configure_rtsp_source(backup_src, backup_uri);
+    }
+
+    // Create dummy video source (test pattern)
+    dummy_src = gst_element_factory_make("videotestsrc", "dummy-source");
+    if (!dummy_src) {
+        g_printerr("Failed to create videotestsrc element\n");
+        return false;
+    }
+
+    // Configure dummy source
+    g_object_set(dummy_src,
+        "pattern", 2, // Black screen
+        "is-live", TRUE,
+        NULL);
+
+    // Create input selector to switch between RTSP and dummy
+    input_selector = gst_element_factory_make("input-selector", "input-selector");
+    if (!input_selector) {
+        g_printerr("Failed to create input-selector element\n");
+        return false;
+    }
+
+    // Create tee for splitting stream
+    tee = gst_element_factory_make("tee", "tee");
+    if (!tee) {
+        g_printerr("Failed to create tee element\n");
+        return false;
+    }
+
+    // On demand, the tee runs without branches while nobody watches
+    if (on_demand) {
+        g_object_set(tee, "allow-not-linked", TRUE, NULL);
+    }
+
+    // Add elements to pipeline
+    gst_bin_add_many(GST_BIN(pipeline),
+        rtsp_src, dummy_src, input_selector, tee, NULL);
+    if (backup_src) {
+        gst_bin_add(GST_BIN(pipeline), backup_src);
+    }
+
+    // The audio track has to exist before the branches so every dashsink
+    // gets its audio pad up front; without it we stream video only
+    if (audio_enabled && !create_audio_chain()) {
+        g_printerr("Audio elements missing, streaming video only\n");
+        audio_enabled = false;
+    }
+
+    // Create DASH branches
+    if (branches.empty()) {
+        set_renditions(default_ladder());
+    }
+    {
+        std::lock_guard<std::mutex> guard(branches_lock);
+        if (scaled_frame_callback) {
+            choose_scaled_frame_rendition();
+        }
+        input_reservation = AdmissionControl::get().reserve(input_cost_key(), input_pixel_rate(),
+                                                            DECODE_SEED_NS_PER_PIXEL);
+        for (RenditionBranch *branch : branches) {
+            // On demand, only the rendition feeding the mosaic starts
+            // right away, the others with their first request
+            if (on_demand && !always_on(branch)) {
+                write_idle_manifest(branch);
+                continue;
+            }
+            if (!create_dash_pipeline(branch)) {
+                return false;
+            }
+        }
+    }
+
+    // Thumbnails are optional, the DASH output does not depend on them
+    if (thumbnail.interval > 0 && !create_thumbnail_branch()) {
+        g_printerr("Thumbnail elements missing, snapshots disabled\n");
+        thumbnail.interval = 0;
+    }
+
+    // Connect dummy source to input selector
+    if (!connect_dummy_source()) {
+        return false;
+    }
+
+    // Set up bus monitoring
+    setup_bus_monitoring();
+
+    // Connect RTSP source dynamically (when pads are available)
+    g_signal_connect(rtsp_src, "pad-added", G_CALLBACK(on_rtsp_pad_added), this);
+    g_signal_connect(rtsp_src, "no-more-pads", G_CALLBACK(on_rtsp_no_more_pads), this);
+
+    // Collect the jitterbuffers for latency control
+    g_signal_connect(rtsp_src, "new-manager", G_CALLBACK(on_new_manager), this);
+
+    if (backup_src) {
+        g_signal_connect(backup_src, "pad-added", G_CALLBACK(on_backup_pad_added), this);
+    }
+
+    return true;
+}
+
+void RTSPDashStreamer::configure_rtsp_source(GstElement *src, const std::string& uri) {
+    // Configure RTSP source for reliability
+    g_object_set(src,
+        "location", uri.c_str(),
+        "retry", 999,
+        "timeout", G_GUINT64_CONSTANT(5000000), // 5 seconds
+        "tcp-timeout", G_GUINT64_CONSTANT(5000000),
+        "do-retransmission", TRUE,
+        "latency", (guint)current_latency_ms, // adapted in evaluate_latency()
+        NULL);
+
+    // Multicast lets several streamer hosts share one camera session;
+    // rtspsrc falls back to TCP by itself when the policy allows it
+    const gchar *protocols = transport_policy_protocols(transport_policy);
+    if (protocols) {
+        gst_util_set_object_arg(G_OBJECT(src), "protocols", protocols);
+    }
+    if (!multicast_iface.empty()) {
+        g_object_set(src, "multicast-iface", multicast_iface.c_str(), NULL);
+    }
+
+    // NTP capture time from the sender reports on every frame, for the
+    // manifests' ProducerReferenceTime (GStreamer 1.22 and later)
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(src), "add-reference-timestamp-meta")) {
+        g_object_set(src, "add-reference-timestamp-meta", TRUE, NULL);
+    }
+}
+
+bool RTSPDashStreamer::start() {
+    if (!pipeline) {
+        g_printerr("Pipeline not initialized\n");
+        return false;
+    }
+
+    stop_requested = false;
+
+    // Start with dummy source active
+    switch_to_dummy_source();
+
+    // Set pipeline to playing state
+    GstStateChangeReturn ret = gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    if (ret == GST_STATE_CHANGE_FAILURE) {
+        g_printerr("Failed to start pipeline\n");
+        return false;
+    }
+
+    remove_source(health_timeout_id);
+    health_timeout_id = add_timeout_seconds(HEALTH_INTERVAL, evaluate_health, this);
+    remove_source(latency_timeout_id);
+    latency_timeout_id = add_timeout_seconds(LATENCY_INTERVAL, evaluate_latency, this);
+    remove_source(rtcp_timeout_id);
+    rtcp_timeout_id = add_timeout_seconds(RTCP_INTERVAL, poll_rtcp_stats, this);
+    if (on_demand) {
+        watch_manifest_requests();
+        remove_source(demand_timeout_id);
+        demand_timeout_id = add_timeout_seconds(DEMAND_INTERVAL, evaluate_demand, this);
+    }
+    remove_source(cost_timeout_id);
+    cost_timeout_id = add_timeout_seconds(COST_INTERVAL, evaluate_cost, this);
+
+    g_print("Starting RTSP to DASH streaming...\n");
+    g_print("RTSP URI: %s\n", rtsp_uri.c_str());
+    g_print("Output path: %s\n", output_path.c_str());
+
+    return true;
+}
+
+void RTSPDashStreamer::run() {
+    // Dispatch bus messages and timers until stop() is called
+    g_main_context_push_thread_default(context);
+    is_loop_running = true;
+    while (!stop_requested) {
+        g_main_context_iteration(context, TRUE);
+    }
+    is_loop_running = false;
+    g_main_context_pop_thread_default(context);
+
+    if (pipeline) {
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+    }
+    is_rtsp_connected = false;
+}
+
+void RTSPDashStreamer::stop() {
+    // Only a flag and a wakeup, so this is safe from signal handlers and
+    // before run() has been entered
+    stop_requested = true;
+    if (context) {
+        g_main_context_wakeup(context);
+    }
+}
+
+bool RTSPDashStreamer::reconfigure(const RenditionConfig& rendition) {
+    std::lock_guard<std::mutex> guard(branches_lock);
+
+    RenditionBranch *branch = find_branch(rendition.name);
+    if (!branch) {
+        // New rendition, on demand it is admitted when requested
+        bool starts = pipeline && !on_demand;
+        if (starts && !admit_rendition(rendition, 0, true)) {
+            return false;
+        }
+
+        branch = new RenditionBranch();
+        branch->owner = this;
+        branch->config = rendition;
+        branches.push_back(branch);
+
+        if (!pipeline) {
+            return true;
+        }
+        if (!starts) {
+            write_idle_manifest(branch);
+            return true;
+        }
+        return create_dash_pipeline(branch);
+    }
+
+    if (branch->removing) {
+        g_printerr("Rendition %s is being removed\n", rendition.name.c_str());
+        return false;
+    }
+
+    const FrameRegion& crop = branch->config.crop;
+    bool resized = branch->config.width != rendition.width ||
+                   branch->config.height != rendition.height ||
+                   branch->config.codec != rendition.codec ||
+                   crop.x != rendition.crop.x || crop.y != rendition.crop.y ||
+                   crop.width != rendition.crop.width || crop.height != rendition.crop.height;
+    if (resized && branch->encoder &&
+        !admit_rendition(rendition, project_rendition(branch->config), true)) {
+        return false;
+    }
+    branch->config = rendition;
+
+    if (!branch->encoder) {
+        return true;
+    }
+
+    if (resized) {
+        // The muxer inside dashsink can't follow a caps change, so the
+        // branch is rebuilt with a fresh manifest
+        branch->rebuild = true;
+        teardown_dash_pipeline(branch);
+    } else {
+        set_encoder_bitrate(branch->encoder, rendition.bitrate);
+    }
+
+    return true;
+}
+
+bool RTSPDashStreamer::remove_rendition(const std::string& name) {
+    std::lock_guard<std::mutex> guard(branches_lock);
+
+    RenditionBranch *branch = find_branch(name);
+    if (!branch || branch->removing) {
+        return false;
+    }
+
+    if (!branch->encoder) {
+        remove_source(branch->restart_timeout_id);
+        branches.erase(std::find(branches.begin(), branches.end(), branch));
+        delete branch;
+        return true;
+    }
+
+    branch->rebuild = false;
+    teardown_dash_pipeline(branch);
+    return true;
+}
+
+bool RTSPDashStreamer::request_rendition(const std::string& name) {
+    std::lock_guard<std::mutex> guard(branches_lock);
+
+    RenditionBranch *branch = find_branch(name);
+    if (!branch) {
+        return false;
+    }
+
+    // One that is being stopped right now is started again by
+    // finish_branch_teardown()
+    branch->demanded_us = g_get_monotonic_time();
+    if (on_demand && pipeline && !branch->encoder && !branch->removing) {
+        activate_branch(branch);
+    }
+    return true;
+}
+
+StreamCounters RTSPDashStreamer::get_counters() {
+    StreamCounters counters = StreamCounters();
+    counters.connected = is_rtsp_connected;
+    counters.connections = rtsp_connections;
+    counters.warnings = rtsp_warnings + pipeline_warnings;
+    counters.qos_dropped = decoder_qos_dropped;
+    counters.latency_recalculations = latency_recalculations;
+    counters.rtp_jitter_us = rtp_jitter_us;
+    counters.rtp_loss_rate = rtp_loss_rate;
+    counters.latency_ms = current_latency_ms;
+    counters.rtcp_jitter_us = rtcp_jitter_us;
+    counters.rtcp_packets_lost = rtcp_packets_lost;
+    counters.keyframe_requests = keyframe_requests;
+    counters.transport = rtp_transport;
+    counters.multicast_joins = multicast_joins;
+    counters.multicast_packets_lost = multicast_packets_lost;
+    counters.tcp_fallbacks = tcp_fallbacks;
+    counters.on_backup = backup_selected;
+    counters.failovers = failovers;
+    counters.last_failover_ms = last_failover_ms;
+    counters.snapshots = snapshots;
+    counters.denoise_active = denoiser.is_active();
+    counters.noise_level = denoiser.noise_level();
+    counters.denoised_frames = denoised_frames;
+    counters.admissions_refused = admissions_refused;
+    counters.decode_skip_level = decode_skip_level;
+    counters.decode_skipped = decode_skipped;
+    counters.decode_fps = decode_fps;
+
+    AdmissionControl& admission = AdmissionControl::get();
+    counters.cpu_projected = admission.projected_cores(input_reservation);
+    counters.cpu_measured = MAX(admission.measured_cores(input_reservation), 0.0);
+
+    std::lock_guard<std::mutex> guard(branches_lock);
+    for (RenditionBranch *branch : branches) {
+        counters.frames += branch->frames;
+        counters.segments += branch->segments;
+        counters.qos_dropped += branch->qos_dropped;
+        counters.branch_restarts += branch->restarts;
+        counters.branch_restart_failures += branch->restart_failures;
+        if (branch->reservation) {
+            counters.cpu_projected += admission.projected_cores(branch->reservation);
+            counters.cpu_measured += MAX(admission.measured_cores(branch->reservation), 0.0);
+        }
+    }
+    return counters;
+}
+
+GstStructure *RTSPDashStreamer::get_stats() {
+    GstStructure *stats = gst_structure_new("rtsp-dash-stats",
+        "camera", G_TYPE_STRING, camera_id.c_str(),
+        "uri", G_TYPE_STRING, rtsp_uri.c_str(),
+        "running", G_TYPE_BOOLEAN, (gboolean)is_loop_running,
+        "connected", G_TYPE_BOOLEAN, (gboolean)is_rtsp_connected,
+        "connections", G_TYPE_UINT64, (guint64)rtsp_connections,
+        "rtsp-warnings", G_TYPE_UINT64, (guint64)rtsp_warnings,
+        "pipeline-warnings", G_TYPE_UINT64, (guint64)pipeline_warnings,
+        "qos-events", G_TYPE_UINT64, (guint64)qos_events,
+        "decoder-qos-dropped", G_TYPE_UINT64, (guint64)decoder_qos_dropped,
+        "latency-recalculations", G_TYPE_UINT64, (guint64)latency_recalculations,
+        "rtp-jitter-us", G_TYPE_UINT, (guint)rtp_jitter_us,
+        "rtp-loss-rate", G_TYPE_DOUBLE, (gdouble)rtp_loss_rate,
+        "latency-ms", G_TYPE_UINT, (guint)current_latency_ms,
+        "adaptive-latency", G_TYPE_BOOLEAN, (gboolean)adaptive_latency,
+        "rtcp-jitter-us", G_TYPE_UINT, (guint)rtcp_jitter_us,
+        "rtcp-packets-received", G_TYPE_UINT64, (guint64)rtcp_packets_received,
+        "rtcp-packets-lost", G_TYPE_UINT64, (guint64)rtcp_packets_lost,
+        "rtcp-keyframe-requests-sent", G_TYPE_UINT64, (guint64)rtcp_keyframe_requests_sent,
+        "keyframe-requests", G_TYPE_UINT64, (guint64)keyframe_requests,
+        "keyframe-requests-suppressed", G_TYPE_UINT64, (guint64)keyframe_requests_suppressed,
+        "transport", G_TYPE_STRING, rtp_transport_name(rtp_transport),
+        "multicast-joins", G_TYPE_UINT64, (guint64)multicast_joins,
+        "multicast-packets-lost", G_TYPE_UINT64, (guint64)multicast_packets_lost,
+        "tcp-fallbacks", G_TYPE_UINT64, (guint64)tcp_fallbacks,
+        "backup-connected", G_TYPE_BOOLEAN, (gboolean)backup_connected,
+        "on-backup", G_TYPE_BOOLEAN, (gboolean)backup_selected,
+        "failovers", G_TYPE_UINT64, (guint64)failovers,
+        "last-failover-ms", G_TYPE_UINT, (guint)last_failover_ms,
+        "audio-source", G_TYPE_STRING, audio_source_name(audio_source),
+        "snapshots", G_TYPE_UINT64, (guint64)snapshots,
+        "denoise", G_TYPE_STRING, denoise_mode_name(denoise.mode),
+        "denoise-active", G_TYPE_BOOLEAN, (gboolean)denoiser.is_active(),
+        "noise-level", G_TYPE_DOUBLE, denoiser.noise_level(),
+        "denoised-frames", G_TYPE_UINT64, (guint64)denoised_frames,
+        "denoise-cpu-ms", G_TYPE_UINT64, (guint64)denoise_us / 1000,
+        "privacy-masks", G_TYPE_UINT, (guint)privacy_masks.size(),
+        "timestamp-overlay", G_TYPE_BOOLEAN, (gboolean)timestamp_overlay,
+        "overlaid-frames", G_TYPE_UINT64, (guint64)overlaid_frames,
+        "overlay-frame-us", G_TYPE_DOUBLE,
+            overlaid_frames ? (gdouble)overlay_us / overlaid_frames : 0.0,
+        "on-demand", G_TYPE_BOOLEAN, (gboolean)on_demand,
+        "admissions-refused", G_TYPE_UINT64, (guint64)admissions_refused,
+        "decode-skip", G_TYPE_STRING, decode_skip_name(decode_skip_level),
+        "decode-skipped", G_TYPE_UINT64, (guint64)decode_skipped,
+        "decode-fps", G_TYPE_DOUBLE, (gdouble)decode_fps,
+        NULL);
+    if (!backup_uri.empty()) {
+        gst_structure_set(stats, "backup-uri", G_TYPE_STRING, backup_uri.c_str(), NULL);
+    }
+    if (capture_delay_ms >= 0) {
+        // Capture to tee: network, jitterbuffer and decode
+        gst_structure_set(stats, "capture-delay-ms", G_TYPE_INT64, (gint64)capture_delay_ms, NULL);
+    }
+
+    // Projected against measured cores, for this camera and the process
+    AdmissionControl& admission = AdmissionControl::get();
+    double cpu_projected = admission.projected_cores(input_reservation);
+    double cpu_measured = MAX(admission.measured_cores(input_reservation), 0.0);
+    gst_structure_set(stats,
+        "host-cpu-projected", G_TYPE_DOUBLE, admission.projected_total(),
+        "host-cpu-measured", G_TYPE_DOUBLE, admission.measured_total(),
+        "host-cpu-capacity", G_TYPE_DOUBLE, admission.capacity(),
+        NULL);
+
+    std::lock_guard<std::mutex> guard(branches_lock);
+    if (!last_warning.empty()) {
+        gst_structure_set(stats, "last-warning", G_TYPE_STRING, last_warning.c_str(), NULL);
+    }
+    if (!rtsp_audio_codec.empty()) {
+        gst_structure_set(stats, "audio-codec", G_TYPE_STRING, rtsp_audio_codec.c_str(), NULL);
+    }
+    {
+        std::lock_guard<std::mutex> jitter_guard(jitter_lock);
+        if (!multicast_group.empty()) {
+            gst_structure_set(stats, "multicast-group", G_TYPE_STRING,
+                              multicast_group.c_str(), NULL);
+        }
+    }
+    for (RenditionBranch *branch : branches) {
+        const std::string& name = branch->config.name;
+        gst_structure_set(stats,
+            (name + ".width").c_str(), G_TYPE_INT, branch->config.width,
+            (name + ".height").c_str(), G_TYPE_INT, branch->config.height,
+            (name + ".bitrate").c_str(), G_TYPE_INT, branch->config.bitrate,
+            (name + ".codec").c_str(), G_TYPE_STRING, video_codec_name(branch->config.codec),
+            (name + ".frames").c_str(), G_TYPE_UINT64, (guint64)branch->frames,
+            (name + ".segments").c_str(), G_TYPE_UINT64, (guint64)branch->segments,
+            (name + ".qos-dropped").c_str(), G_TYPE_UINT64, (guint64)branch->qos_dropped,
+            (name + ".load-level").c_str(), G_TYPE_INT, branch->load_level,
+            (name + ".restarts").c_str(), G_TYPE_UINT64, branch->restarts,
+            (name + ".restart-failures").c_str(), G_TYPE_UINT64, branch->restart_failures,
+            NULL);
+        if (!branch->last_error.empty()) {
+            gst_structure_set(stats, (name + ".last-error").c_str(), G_TYPE_STRING,
+                              branch->last_error.c_str(), NULL);
+        }
+        if (branch->reservation) {
+            double projected = admission.projected_cores(branch->reservation);
+            double measured = admission.measured_cores(branch->reservation);
+            gst_structure_set(stats,
+                (name + ".cpu-projected").c_str(), G_TYPE_DOUBLE, projected,
+                (name + ".cpu-measured").c_str(), G_TYPE_DOUBLE, measured,
+                NULL);
+            cpu_projected += projected;
+            cpu_measured += MAX(measured, 0.0);
+        }
+        const FrameRegion& crop = branch->config.crop;
+        if (crop.width > 0) {
+            gchar *region = g_strdup_printf("%dx%d+%d+%d", crop.width, crop.height, crop.x, crop.y);
+            gst_structure_set(stats, (name + ".crop").c_str(), G_TYPE_STRING, region, NULL);
+            g_free(region);
+        }
+        if (on_demand) {
+            gst_structure_set(stats,
+                (name + ".active").c_str(), G_TYPE_BOOLEAN,
+                    (gboolean)(branch->encoder && !branch->removing),
+                (name + ".activations").c_str(), G_TYPE_UINT64, branch->activations,
+                NULL);
+            if (branch->first_segment_ms > 0) {
+                gst_structure_set(stats, (name + ".first-segment-ms").c_str(), G_TYPE_UINT,
+                                  branch->first_segment_ms, NULL);
+            }
+        }
+        if (branch->trick_queue) {
+            gst_structure_set(stats,
+                (name + ".trick-segments").c_str(), G_TYPE_UINT64, (guint64)branch->trick_segments,
+                (name + ".gop-frames").c_str(), G_TYPE_UINT, (guint)branch->gop_frames,
+                NULL);
+        }
+    }
+    gst_structure_set(stats,
+        "cpu-projected", G_TYPE_DOUBLE, cpu_projected,
+        "cpu-measured", G_TYPE_DOUBLE, cpu_measured,
+        NULL);
+
+    return stats;
+}
+
+bool RTSPDashStreamer::create_dash_pipeline(RenditionBranch *branch) {
+    const std::string& quality = branch->config.name;
+    std::string sink_name = "dash-sink-" + quality;
+    std::string enc_name = "encoder-" + quality;
+    std::string scale_name = "scale-" + quality;
+    std::string rate_name = "rate-" + quality;
+    std::string parse_name = "parse-" + quality;
+    std::string queue_name = "queue-" + quality;
+
+    // Create elements for this quality
+    GstElement *queue = gst_element_factory_make("queue", queue_name.c_str());
+    GstElement *videoconvert = gst_element_factory_make("videoconvert", NULL);
+    GstElement *videoscale = gst_element_factory_make("videoscale", scale_name.c_str());
+    GstElement *videorate = gst_element_factory_make("videorate", rate_name.c_str());
+    GstElement *capsfilter = gst_element_factory_make("capsfilter", NULL);
+    GstElement *encoder = make_video_encoder(branch->config.codec, enc_name.c_str(),
+                                             branch->config.bitrate);
+    GstElement *parse = gst_element_factory_make(video_parser_factory(branch->config.codec),
+                                                 parse_name.c_str());
+    GstElement *dash_sink = gst_element_factory_make("dashsink", sink_name.c_str());
+
+    // A region of interest is cut before anything else touches the frame,
+    // so convert, scale and encode only see the cropped area. videocrop
+    // hands the region on as crop meta where downstream accepts it and
+    // copies just the region otherwise.
+    bool cropped = branch->config.crop.width > 0;
+    GstElement *crop = cropped
+        ? gst_element_factory_make("videocrop", ("crop-" + quality).c_str()) : NULL;
+
+    if (!encoder) {
+        g_printerr("No %s encoder installed for %s quality\n",
+                   video_codec_name(branch->config.codec), quality.c_str());
+    }
+    if (cropped && !crop) {
+        g_printerr("Failed to create videocrop for %s quality\n", quality.c_str());
+    }
+    if (!queue || !videoconvert || !videoscale || !videorate ||
+        !capsfilter || !encoder || !parse || !dash_sink || (cropped && !crop)) {
+        g_printerr("Failed to create elements for %s quality\n", quality.c_str());
+        // Branches are built again at runtime, the floating ones would pile up
+        GstElement *created[] = {
+            queue, videoconvert, videoscale, videorate, capsfilter, encoder, parse, dash_sink, crop
+        };
+        for (GstElement *element : created) {
+            if (element) {
+                gst_object_unref(element);
+            }
+        }
+        return false;
+    }
+
+    if (crop) {
+        // The margins depend on the input size, which changes between
+        // the camera and the slate
+        FrameRegion *region = g_new(FrameRegion, 1);
+        *region = branch->config.crop;
+        GstPad *crop_sink = gst_element_get_static_pad(crop, "sink");
+        gst_pad_add_probe(crop_sink, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+            on_crop_caps, region, g_free);
+        gst_object_unref(crop_sink);
+    }
+
+    // Configure caps for resolution and framerate. Scaled frames are
+    // handed out as I420, which every encoder takes.
+    bool scaled_frames = scaled_frame_callback && quality == scaled_frame_rendition;
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+        "width", G_TYPE_INT, branch->config.width,
+        "height", G_TYPE_INT, branch->config.height,
+        "framerate", GST_TYPE_FRACTION, RENDITION_FPS, 1,
+        NULL);
+    if (scaled_frames) {
+        gst_caps_set_simple(caps, "format", G_TYPE_STRING, "I420", NULL);
+    }
+    g_object_set(capsfilter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    // While the decoder skips frames they stay skipped
+    set_rate_drop_only(videorate, decode_skip_level > DECODE_SKIP_NONE);
+
+    // Let the encoder report late frames as QoS messages
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(encoder), "qos")) {
+        g_object_set(encoder, "qos", TRUE, NULL);
+    }
+
+    // Configure DASH sink. It writes a staging manifest that
+    // publish_manifest() completes with the timing elements and, with
+    // trick play, rewrites so players do not take the I-frame-only
+    // Representation for a regular one.
+    bool trickplay = quality == trickplay_rendition;
+    std::string manifest_path = segment_path() + "/" + quality + "_manifest.staging.mpd";
+    g_object_set(dash_sink,
+        "mpd-filename", manifest_path.c_str(),
+        "target-duration", 4, // 4 second segments
+        NULL);
+
+    // On demand, players have to keep refetching the manifest for the
+    // rendition to stay up
+    if (on_demand) {
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(dash_sink), "dynamic")) {
+            g_object_set(dash_sink, "dynamic", TRUE, NULL);
+        }
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(dash_sink), "minimum-update-period")) {
+            g_object_set(dash_sink, "minimum-update-period", MANIFEST_UPDATE_MS, NULL);
+        }
+    }
+
+    // Add elements to pipeline
+    gst_bin_add_many(GST_BIN(pipeline),
+        queue, videoconvert, videoscale, videorate,
+        capsfilter, encoder, parse, dash_sink, NULL);
+    if (crop) {
+        gst_bin_add(GST_BIN(pipeline), crop);
+    }
+
+    // Known to the branch from here on, so a failure below can take them
+    // out again, see discard_dash_pipeline()
+    branch->queue = queue;
+    branch->crop = crop;
+    branch->convert = videoconvert;
+    branch->scale = videoscale;
+    branch->rate = videorate;
+    branch->capsfilter = capsfilter;
+    branch->encoder = encoder;
+    branch->parse = parse;
+    branch->dash_sink = dash_sink;
+    branch->base_running_time = GST_CLOCK_TIME_NONE;
+
+    // Link elements
+    if ((crop ? !gst_element_link_many(queue, crop, videoconvert, NULL)
+              : !gst_element_link(queue, videoconvert)) ||
+        !gst_element_link_many(videoconvert, videoscale,
+                               videorate, capsfilter, encoder,
+                               parse, NULL) ||
+        !(trickplay ? link_trickplay(branch, parse, dash_sink)
+                    : gst_element_link(parse, dash_sink))) {
+        g_printerr("Failed to link %s pipeline elements\n", quality.c_str());
+        discard_dash_pipeline(branch);
+        return false;
+    }
+
+    // Books the branch's CPU time before its streaming thread starts
+    reserve_branch(branch);
+    GstPad *queue_src = gst_element_get_static_pad(queue, "src");
+    gst_pad_add_probe(queue_src, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+        on_branch_stream_start, branch, NULL);
+    gst_object_unref(queue_src);
+
+    // Count encoded frames and hand them to the frame callback
+    GstPad *parse_src = gst_element_get_static_pad(parse, "src");
+    gst_pad_add_probe(parse_src, GST_PAD_PROBE_TYPE_BUFFER,
+        on_encoded_frame, branch, NULL);
+    gst_object_unref(parse_src);
+
+    if (scaled_frames) {
+        branch->scaled_info_valid = false;
+        GstPad *capsfilter_src = gst_element_get_static_pad(capsfilter, "src");
+        gst_pad_add_probe(capsfilter_src,
+            (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+            on_scaled_frame, branch, NULL);
+        gst_object_unref(capsfilter_src);
+    }
+
+    // Frame skipping used by the adaptive load controller, also takes the
+    // branch's first running time
+    GstPad *encoder_pad = gst_element_get_static_pad(encoder, "sink");
+    gst_pad_add_probe(encoder_pad, GST_PAD_PROBE_TYPE_BUFFER,
+        on_encoder_input, branch, NULL);
+    gst_object_unref(encoder_pad);
+
+#ifdef ENABLE_USDT
+    // Encoder latency tracepoints, matched on pts by the tracer
+    GstPad *encoder_sink = gst_element_get_static_pad(encoder, "sink");
+    GstPad *encoder_src = gst_element_get_static_pad(encoder, "src");
+    gst_pad_add_probe(encoder_sink, GST_PAD_PROBE_TYPE_BUFFER,
+        on_encoder_enter, branch, NULL);
+    gst_pad_add_probe(encoder_src, GST_PAD_PROBE_TYPE_BUFFER,
+        on_encoder_exit, branch, NULL);
+    gst_object_unref(encoder_sink);
+    gst_object_unref(encoder_src);
+#endif
+
+    // Bring the branch up before it sees data when added while playing
+    gst_element_sync_state_with_parent(dash_sink);
+    if (branch->parse_tee) {
+        gst_element_sync_state_with_parent(branch->video_queue);
+        gst_element_sync_state_with_parent(branch->trick_queue);
+        gst_element_sync_state_with_parent(branch->parse_tee);
+    }
+    gst_element_sync_state_with_parent(parse);
+    gst_element_sync_state_with_parent(encoder);
+    gst_element_sync_state_with_parent(capsfilter);
+    gst_element_sync_state_with_parent(videorate);
+    gst_element_sync_state_with_parent(videoscale);
+    gst_element_sync_state_with_parent(videoconvert);
+    if (crop) {
+        gst_element_sync_state_with_parent(crop);
+    }
+    gst_element_sync_state_with_parent(queue);
+
+    // Audio encoded once in front of the audio tee, packaged into this
+    // rendition's segments and manifest by its own dashsink
+    if (audio_tee) {
+        std::string audio_queue_name = "audio-queue-" + quality;
+        GstElement *audio_queue = gst_element_factory_make("queue", audio_queue_name.c_str());
+        if (!audio_queue) {
+            g_printerr("Failed to create audio queue for %s quality\n", quality.c_str());
+            discard_dash_pipeline(branch);
+            return false;
+        }
+        gst_bin_add(GST_BIN(pipeline), audio_queue);
+        branch->audio_queue = audio_queue;
+
+        GstPad *queue_src = gst_element_get_static_pad(audio_queue, "src");
+        GstPad *sink_pad = gst_element_get_request_pad(dash_sink, "audio_%u");
+        GstPadLinkReturn ret = sink_pad ? gst_pad_link(queue_src, sink_pad) : GST_PAD_LINK_REFUSED;
+        gst_object_unref(queue_src);
+        if (sink_pad) {
+            gst_object_unref(sink_pad);
+        }
+        if (ret != GST_PAD_LINK_OK) {
+            g_printerr("Failed to link audio to %s DASH sink\n", quality.c_str());
+            discard_dash_pipeline(branch);
+            return false;
+        }
+        gst_element_sync_state_with_parent(audio_queue);
+
+        GstPad *audio_tee_pad = gst_element_get_request_pad(audio_tee, "src_%u");
+        branch->audio_tee_pad = audio_tee_pad;
+        GstPad *audio_queue_pad = gst_element_get_static_pad(audio_queue, "sink");
+        ret = gst_pad_link(audio_tee_pad, audio_queue_pad);
+        gst_object_unref(audio_queue_pad);
+        if (ret != GST_PAD_LINK_OK) {
+            g_printerr("Failed to link audio tee to %s queue\n", quality.c_str());
+            discard_dash_pipeline(branch);
+            return false;
+        }
+
+        gst_pad_add_probe(audio_tee_pad,
+            (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+            on_branch_input, branch, NULL);
+    }
+
+    // Lets on_sync_error() find the branch without taking branches_lock
+    GstElement *elements[] = {
+        queue, crop, videoconvert, videoscale, videorate, capsfilter, encoder, parse, dash_sink,
+        branch->audio_queue, branch->parse_tee, branch->video_queue, branch->trick_queue
+    };
+    for (GstElement *element : elements) {
+        if (element) {
+            g_object_set_data(G_OBJECT(element), BRANCH_KEY, branch);
+        }
+    }
+    branch->failed = false;
+
+    // Request tee pad and link to queue, a failed branch's input is
+    // dropped there so its error does not reach the tee
+    GstPad *tee_pad = gst_element_get_request_pad(tee, "src_%u");
+    gst_pad_add_probe(tee_pad,
+        (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+        on_branch_input, branch, NULL);
+    GstPad *queue_pad = gst_element_get_static_pad(queue, "sink");
+
+    // Keep the tee pad so the branch can be released later
+    branch->tee_pad = tee_pad;
+
+    if (gst_pad_link(tee_pad, queue_pad) != GST_PAD_LINK_OK) {
+        g_printerr("Failed to link tee to %s queue\n", quality.c_str());
+        gst_object_unref(queue_pad);
+        discard_dash_pipeline(branch);
+        return false;
+    }
+
+    gst_object_unref(queue_pad);
+    return true;
+}
+
+void RTSPDashStreamer::discard_dash_pipeline(RenditionBranch *branch) {
+    // A branch that failed half way, nothing has been linked to it from
+    // the tees or they are released here. Its fixed element names have to
+    // be free for the next attempt.
+    remove_branch_elements(branch);
+    clear_branch_elements(branch);
+}
+
+void RTSPDashStreamer::remove_branch_elements(RenditionBranch *branch) {
+    GstElement *elements[] = {
+        branch->queue, branch->crop, branch->convert, branch->scale, branch->rate,
+        branch->capsfilter, branch->encoder, branch->parse, branch->dash_sink,
+        branch->audio_queue, branch->parse_tee, branch->video_queue, branch->trick_queue
+    };
+    for (GstElement *element : elements) {
+        if (element) {
+            gst_element_set_state(element, GST_STATE_NULL);
+        }
+    }
+
+    // dashsink's video_%u and audio_%u are all request pads
+    if (branch->dash_sink) {
+        std::vector<GstPad*> pads;
+        GstIterator *iterator = gst_element_iterate_sink_pads(branch->dash_sink);
+        GValue item = G_VALUE_INIT;
+        while (gst_iterator_next(iterator, &item) == GST_ITERATOR_OK) {
+            pads.push_back(GST_PAD(g_value_dup_object(&item)));
+            g_value_reset(&item);
+        }
+        g_value_unset(&item);
+        gst_iterator_free(iterator);
+        for (GstPad *pad : pads) {
+            gst_element_release_request_pad(branch->dash_sink, pad);
+            gst_object_unref(pad);
+        }
+    }
+
+    for (GstElement *element : elements) {
+        if (element) {
+            gst_bin_remove(GST_BIN(pipeline), element);
+            qos_dropped_by_element.erase(GST_OBJECT(element));
+        }
+    }
+
+    if (branch->tee_pad) {
+        gst_element_release_request_pad(tee, branch->tee_pad);
+        gst_object_unref(branch->tee_pad);
+    }
+    if (branch->audio_tee_pad) {
+        gst_element_release_request_pad(audio_tee, branch->audio_tee_pad);
+        gst_object_unref(branch->audio_tee_pad);
+    }
+    if (branch->reservation) {
+        AdmissionControl::get().release(branch->reservation);
+    }
+}
+
+void RTSPDashStreamer::clear_branch_elements(RenditionBranch *branch) {
+    branch->queue = branch->crop = branch->convert = branch->scale = branch->rate = nullptr;
+    branch->capsfilter = branch->encoder = branch->parse = branch->dash_sink = nullptr;
+    branch->tee_pad = nullptr;
+    branch->reservation = 0;
+    branch->audio_queue = nullptr;
+    branch->audio_tee_pad = nullptr;
+    branch->parse_tee = branch->video_queue = branch->trick_queue = nullptr;
+    branch->trick_pad.clear();
+}
+
+void RTSPDashStreamer::teardown_dash_pipeline(RenditionBranch *branch) {
+    // Unlink from the tee once no buffer is in flight on its pad
+    branch->removing = true;
+    gst_pad_add_probe(branch->tee_pad, GST_PAD_PROBE_TYPE_IDLE,
+        on_branch_idle, branch, NULL);
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_branch_idle(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RenditionBranch *branch = static_cast<RenditionBranch*>(user_data);
+
+    GstPad *queue_pad = gst_element_get_static_pad(branch->queue, "sink");
+    gst_pad_unlink(pad, queue_pad);
+    gst_object_unref(queue_pad);
+
+    // The audio tee pad is released the same way, it runs on its own
+    // streaming thread
+    if (branch->audio_tee_pad) {
+        gst_pad_add_probe(branch->audio_tee_pad, GST_PAD_PROBE_TYPE_IDLE,
+            on_branch_audio_idle, branch, NULL);
+    } else {
+        schedule_branch_teardown(branch);
+    }
+
+    return GST_PAD_PROBE_REMOVE;
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_branch_audio_idle(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RenditionBranch *branch = static_cast<RenditionBranch*>(user_data);
+
+    GstPad *queue_pad = gst_element_get_static_pad(branch->audio_queue, "sink");
+    gst_pad_unlink(pad, queue_pad);
+    gst_object_unref(queue_pad);
+
+    schedule_branch_teardown(branch);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+void RTSPDashStreamer::schedule_branch_teardown(RenditionBranch *branch) {
+    // State changes must not happen on the streaming thread
+    GSource *source = g_idle_source_new();
+    g_source_set_callback(source, finish_branch_teardown, branch, NULL);
+    g_source_attach(source, branch->owner->context);
+    g_source_unref(source);
+}
+
+gboolean RTSPDashStreamer::finish_branch_teardown(gpointer user_data) {
+    RenditionBranch *branch = static_cast<RenditionBranch*>(user_data);
+    RTSPDashStreamer *streamer = branch->owner;
+
+    streamer->remove_branch_elements(branch);
+
+    std::lock_guard<std::mutex> guard(streamer->branches_lock);
+    streamer->clear_branch_elements(branch);
+    branch->removing = false;
+
+    if (branch->rebuild && branch->failed) {
+        branch->rebuild = false;
+        branch->restart_timeout_id = streamer->add_timeout_seconds(branch->restart_delay,
+                                                                   restart_branch, branch);
+    } else if (branch->rebuild) {
+        branch->rebuild = false;
+        g_print("Rebuilding %s rendition (%dx%d)\n", branch->config.name.c_str(),
+                branch->config.width, branch->config.height);
+        if (!streamer->create_dash_pipeline(branch)) {
+            streamer->retry_branch(branch);
+        }
+    } else if (branch->idle) {
+        branch->idle = false;
+        streamer->write_idle_manifest(branch);
+
+        // Requested again while it was being stopped
+        if (branch->demanded_us > branch->deactivated_us) {
+            streamer->activate_branch(branch);
+        }
+    } else {
+        g_print("Removed %s rendition\n", branch->config.name.c_str());
+        streamer->branches.erase(std::find(streamer->branches.begin(),
+                                           streamer->branches.end(), branch));
+        delete branch;
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_branch_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RenditionBranch *branch = static_cast<RenditionBranch*>(user_data);
+
+    // Dropped buffers count as pushed, the tee and the input carry on
+    return branch->failed ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+}
+
+void RTSPDashStreamer::on_sync_error(GstBus *bus, GstMessage *msg, gpointer user_data) {
+    // On the failing element's streaming thread, before the error flow
+    // return gets to the tee. The bus watch tears the branch down later.
+    GstObject *object = GST_MESSAGE_SRC(msg) ? GST_OBJECT(gst_object_ref(GST_MESSAGE_SRC(msg))) : NULL;
+    while (object) {
+        gpointer data = g_object_get_data(G_OBJECT(object), BRANCH_KEY);
+        if (data) {
+            static_cast<RenditionBranch*>(data)->failed = true;
+            gst_object_unref(object);
+            return;
+        }
+        GstObject *parent = gst_object_get_parent(object);
+        gst_object_unref(object);
+        object = parent;
+    }
+}
+
+bool RTSPDashStreamer::fail_branch(GstObject *source, const GError *error) {
+    std::lock_guard<std::mutex> guard(branches_lock);
+
+    RenditionBranch *branch = find_branch_for_object(source);
+    if (!branch) {
+        return false;
+    }
+    branch->last_error = error->message;
+
+    // Further errors of a branch already on its way down
+    if (branch->removing) {
+        return true;
+    }
+
+    // Back off while it fails before writing anything, e.g. on a full disk
+    branch->restart_delay = !branch->restart_delay || branch->segments > branch->segments_restarted
+        ? RESTART_DELAY_MIN : MIN(branch->restart_delay * 2, RESTART_DELAY_MAX);
+    branch->segments_restarted = branch->segments;
+    branch->restarts++;
+    branch->failed = true;
+    branch->rebuild = true;
+    g_printerr("%s rendition failed, restarting it in %u s\n",
+               branch->config.name.c_str(), branch->restart_delay);
+    teardown_dash_pipeline(branch);
+    return true;
+}
+
+gboolean RTSPDashStreamer::restart_branch(gpointer user_data) {
+    RenditionBranch *branch = static_cast<RenditionBranch*>(user_data);
+    RTSPDashStreamer *streamer = branch->owner;
+    std::lock_guard<std::mutex> guard(streamer->branches_lock);
+
+    branch->restart_timeout_id = 0;
+
+    // Already started again by an on-demand request
+    if (branch->encoder) {
+        return G_SOURCE_REMOVE;
+    }
+    g_print("Restarting %s rendition (restart %" G_GUINT64_FORMAT ")\n",
+            branch->config.name.c_str(), branch->restarts);
+    if (!streamer->create_dash_pipeline(branch)) {
+        streamer->retry_branch(branch);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+void RTSPDashStreamer::retry_branch(RenditionBranch *branch) {
+    // A branch that could not be built again, e.g. for lack of an element
+    // or a disk that is still full, keeps backing off like a failing one
+    branch->restart_delay = branch->restart_delay
+        ? MIN(branch->restart_delay * 2, RESTART_DELAY_MAX) : RESTART_DELAY_MIN;
+    branch->restarts++;
+    branch->restart_failures++;
+    g_printerr("Failed to build %s rendition, retrying in %u s\n",
+               branch->config.name.c_str(), branch->restart_delay);
+    branch->restart_timeout_id = add_timeout_seconds(branch->restart_delay, restart_branch, branch);
+}
+
+bool RTSPDashStreamer::link_trickplay(RenditionBranch *branch, GstElement *parse, GstElement *dash_sink) {
+    // parse -> tee -> queue -> dashsink video_0 (regular Representation)
+    //              -> queue -> dashsink video_1 (IDR frames only)
+    // The trick play stream reuses the encoded rendition, nothing is
+    // encoded twice.
+    const std::string& quality = branch->config.name;
+    std::string tee_name = "parse-tee-" + quality;
+    std::string video_queue_name = "video-queue-" + quality;
+    std::string trick_queue_name = "trick-queue-" + quality;
+    GstElement *parse_tee = gst_element_factory_make("tee", tee_name.c_str());
+    GstElement *video_queue = gst_element_factory_make("queue", video_queue_name.c_str());
+    GstElement *trick_queue = gst_element_factory_make("queue", trick_queue_name.c_str());
+    if (!parse_tee || !video_queue || !trick_queue) {
+        g_printerr("Failed to create trick play elements for %s\n", quality.c_str());
+        GstElement *created[] = { parse_tee, video_queue, trick_queue };
+        for (GstElement *element : created) {
+            if (element) {
+                gst_object_unref(element);
+            }
+        }
+        return false;
+    }
+
+    gst_bin_add_many(GST_BIN(pipeline), parse_tee, video_queue, trick_queue, NULL);
+    branch->parse_tee = parse_tee;
+    branch->video_queue = video_queue;
+    branch->trick_queue = trick_queue;
+
+    if (!gst_element_link(parse, parse_tee) ||
+        !gst_element_link(parse_tee, video_queue) ||
+        !gst_element_link(parse_tee, trick_queue)) {
+        return false;
+    }
+
+    GstElement *queues[] = { video_queue, trick_queue };
+    for (GstElement *queue : queues) {
+        GstPad *queue_src = gst_element_get_static_pad(queue, "src");
+        GstPad *sink_pad = gst_element_get_request_pad(dash_sink, "video_%u");
+        GstPadLinkReturn ret = gst_pad_link(queue_src, sink_pad);
+        if (queue == trick_queue) {
+            branch->trick_pad = GST_PAD_NAME(sink_pad);
+        }
+        gst_object_unref(queue_src);
+        gst_object_unref(sink_pad);
+        if (ret != GST_PAD_LINK_OK) {
+            return false;
+        }
+    }
+
+    // Delta frames are dropped before they are queued
+    GstPad *trick_sink = gst_element_get_static_pad(trick_queue, "sink");
+    gst_pad_add_probe(trick_sink, GST_PAD_PROBE_TYPE_BUFFER,
+        on_trickplay_frame, branch, NULL);
+    gst_object_unref(trick_sink);
+
+    g_print("Trick play Representation %s for %s\n", branch->trick_pad.c_str(), quality.c_str());
+    return true;
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_trickplay_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RenditionBranch *branch = static_cast<RenditionBranch*>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+        branch->frames_since_keyframe++;
+        return GST_PAD_PROBE_DROP;
+    }
+
+    // The GOP length is the speed-up of playing the IDR frames back to
+    // back, advertised as maxPlayoutRate
+    if (branch->frames_since_keyframe > 0) {
+        branch->gop_frames = branch->frames_since_keyframe + 1;
+    }
+    branch->frames_since_keyframe = 0;
+    return GST_PAD_PROBE_OK;
+}
+
+// Byte ranges of the Representation elements inside [from, to) of an MPD
+static std::vector<std::pair<gsize, gsize>> find_representations(const std::string& mpd,
+                                                                  gsize from, gsize to) {
+    std::vector<std::pair<gsize, gsize>> ranges;
+    const std::string open = "<Representation";
+    const std::string close = "</Representation>";
+
+    gsize pos = mpd.find(open, from);
+    while (pos != std::string::npos && pos < to) {
+        char next = mpd[pos + open.size()];
+        if (next != ' ' && next != '>' && next != '\n') {
+            // RepresentationIndex and the like
+            pos = mpd.find(open, pos + open.size());
+            continue;
+        }
+
+        gsize tag_end = mpd.find('>', pos);
+        if (tag_end == std::string::npos) {
+            break;
+        }
+        gsize end = tag_end + 1;
+        if (mpd[tag_end - 1] != '/') {
+            end = mpd.find(close, tag_end);
+            if (end == std::string::npos) {
+                break;
+            }
+            end += close.size();
+        }
+        ranges.push_back(std::make_pair(pos, end));
+        pos = mpd.find(open, end);
+    }
+    return ranges;
+}
+
+// Value of an attribute in the start tag at pos, empty when absent
+static std::string tag_attribute(const std::string& mpd, gsize pos, const std::string& name) {
+    gsize tag_end = mpd.find('>', pos);
+    std::string key = " " + name + "=\"";
+    gsize start = mpd.find(key, pos);
+    if (start == std::string::npos || start > tag_end) {
+        return std::string();
+    }
+    start += key.size();
+    return mpd.substr(start, mpd.find('"', start) - start);
+}
+
+// Moves the Representation trick_id out of its AdaptationSet into a copy
+// of that set marked with the DASH-IF trickmode EssentialProperty, so
+// regular players ignore it and scrubbing players find it
+static bool split_trickplay_representation(const std::string& mpd, const std::string& trick_id,
+                                           guint max_playout_rate, std::string& result) {
+    gsize set_start = std::string::npos;
+    std::pair<gsize, gsize> trick(0, 0);
+    for (const auto& range : find_representations(mpd, 0, mpd.size())) {
+        if (tag_attribute(mpd, range.first, "id") == trick_id) {
+            trick = range;
+            set_start = mpd.rfind("<AdaptationSet", range.first);
+            break;
+        }
+    }
+    if (set_start == std::string::npos) {
+        return false;
+    }
+
+    const std::string set_close = "</AdaptationSet>";
+    gsize set_end = mpd.find(set_close, trick.second);
+    std::string main_id = tag_attribute(mpd, set_start, "id");
+    if (set_end == std::string::npos || main_id.empty()) {
+        return false;
+    }
+    set_end += set_close.size();
+
+    // The new set needs an id of its own
+    guint next_id = 0;
+    for (gsize pos = mpd.find("<AdaptationSet"); pos != std::string::npos;
+         pos = mpd.find("<AdaptationSet", pos + 1)) {
+        next_id = std::max(next_id, (guint)atoi(tag_attribute(mpd, pos, "id").c_str()) + 1);
+    }
+
+    // Regular set: everything but the trick play Representation
+    std::string main_set = mpd.substr(set_start, trick.first - set_start) +
+                           mpd.substr(trick.second, set_end - trick.second);
+
+    // Trick play set: the same set with only the trick play Representation
+    std::string trick_set;
+    gsize copied = set_start;
+    for (const auto& range : find_representations(mpd, set_start, set_end)) {
+        trick_set += mpd.substr(copied, range.first - copied);
+        if (range == trick) {
+            std::string representation = mpd.substr(range.first, range.second - range.first);
+            std::string attributes = " codingDependency=\"false\"";
+            if (max_playout_rate > 1) {
+                attributes += " maxPlayoutRate=\"" + std::to_string(max_playout_rate) + "\"";
+            }
+            representation.insert(strlen("<Representation"), attributes);
+            trick_set += representation;
+        }
+        copied = range.second;
+    }
+    trick_set += mpd.substr(copied, set_end - copied);
+
+    gsize id_pos = trick_set.find(" id=\"" + main_id + "\"");
+    trick_set.replace(id_pos, main_id.size() + 6, " id=\"" + std::to_string(next_id) + "\"");
+    gsize open_end = trick_set.find('>') + 1;
+    trick_set.insert(open_end,
+        "<EssentialProperty schemeIdUri=\"http://dashif.org/guidelines/trickmode\" value=\"" +
+        main_id + "\"/>");
+
+    result = mpd.substr(0, set_start) + main_set + trick_set + mpd.substr(set_end);
+    return true;
+}
+
+// xs:dateTime in UTC with milliseconds
+static std::string format_wall_clock(gint64 unix_us) {
+    GDateTime *time = g_date_time_new_from_unix_utc(unix_us / G_USEC_PER_SEC);
+    gchar *seconds = g_date_time_format(time, "%Y-%m-%dT%H:%M:%S");
+    gchar *text = g_strdup_printf("%s.%03dZ", seconds, (int)(unix_us % G_USEC_PER_SEC / 1000));
+    std::string result = text;
+    g_free(text);
+    g_free(seconds);
+    g_date_time_unref(time);
+    return result;
+}
+
+// Adds a UTCTiming element to the MPD and, once a frame has been seen, a
+// ProducerReferenceTime to every AdaptationSet, in front of its Roles,
+// segment information and Representations as the schema orders them.
+// Only with a time endpoint: a wall clock the players can't synchronize
+// to is no use, and a time written into the manifest is stale by the
+// time they read it.
+static std::string insert_timing_elements(const std::string& mpd, const std::string& utc_timing,
+                                          const ProducerReference& reference) {
+    if (utc_timing.empty()) {
+        return mpd;
+    }
+    std::string timing = "<UTCTiming schemeIdUri=\"urn:mpeg:dash:utc:http-iso:2014\" value=\"" +
+                         utc_timing + "\"/>";
+
+    std::string result;
+    gsize copied = 0;
+    const std::string open = "<AdaptationSet";
+    for (gsize pos = mpd.find(open); reference.valid && pos != std::string::npos;
+         pos = mpd.find(open, pos + open.size())) {
+        gsize insert = mpd.find('>', pos);
+        gsize set_end = mpd.find("</AdaptationSet>", pos);
+        if (insert == std::string::npos || set_end == std::string::npos) {
+            break;
+        }
+        insert++;
+
+        // Properties come first, e.g. the trick play marker
+        for (;;) {
+            gsize next = mpd.find_first_not_of(" \t\r\n", insert);
+            if (next == std::string::npos ||
+                (mpd.compare(next, 18, "<EssentialProperty") != 0 &&
+                 mpd.compare(next, 21, "<SupplementalProperty") != 0)) {
+                break;
+            }
+            gsize end = mpd.find("/>", next);
+            if (end == std::string::npos || end + 1 != mpd.find('>', next)) {
+                break;
+            }
+            insert = end + 2;
+        }
+
+        // In the timescale of the set's segment information
+        guint64 timescale = 1;
+        gsize scale_pos = mpd.find(" timescale=\"", pos);
+        if (scale_pos != std::string::npos && scale_pos < set_end) {
+            timescale = MAX(g_ascii_strtoull(mpd.c_str() + scale_pos + 12, NULL, 10), 1);
+        }
+        gchar *element = g_strdup_printf(
+            "<ProducerReferenceTime id=\"0\" type=\"%s\" wallClockTime=\"%s\" "
+            "presentationTime=\"%" G_GUINT64_FORMAT "\">%s</ProducerReferenceTime>",
+            reference.captured ? "captured" : "encoder",
+            format_wall_clock(reference.wall_clock_us).c_str(),
+            gst_util_uint64_scale(reference.running_time, timescale, GST_SECOND),
+            timing.c_str());
+        result += mpd.substr(copied, insert - copied) + element;
+        g_free(element);
+        copied = insert;
+    }
+    result += mpd.substr(copied);
+
+    gsize mpd_end = result.rfind("</MPD>");
+    if (mpd_end != std::string::npos) {
+        result.insert(mpd_end, timing);
+    }
+    return result;
+}
+
+// Points the manifest's relative segment URLs into a subdirectory; the
+// schema puts BaseURL after ProgramInformation
+static std::string insert_base_url(const std::string& mpd, const std::string& base) {
+    std::string result = mpd;
+    const std::string info_end = "</ProgramInformation>";
+    gsize insert = result.find(info_end);
+    if (insert != std::string::npos) {
+        insert += info_end.size();
+    } else {
+        insert = result.find("<MPD");
+        insert = insert == std::string::npos ? insert : result.find('>', insert);
+        if (insert == std::string::npos) {
+            return result;
+        }
+        insert++;
+    }
+    result.insert(insert, "<BaseURL>" + base + "</BaseURL>");
+    return result;
+}
+
+void RTSPDashStreamer::publish_manifest(RenditionBranch *branch) {
+    if (!publishing) {
+        return;
+    }
+    std::string staging_path = segment_path() + "/" + branch->config.name + "_manifest.staging.mpd";
+    std::string manifest_path = output_path + "/" + branch->config.name + MANIFEST_SUFFIX;
+
+    gchar *contents = NULL;
+    gsize length = 0;
+    if (!g_file_get_contents(staging_path.c_str(), &contents, &length, NULL)) {
+        return;
+    }
+
+    std::string mpd(contents, length);
+    g_free(contents);
+
+    std::string published = mpd;
+    if (branch->trick_queue &&
+        !split_trickplay_representation(mpd, branch->trick_pad, branch->gop_frames, published)) {
+        // Without the marker regular players could pick the trick play
+        // Representation, leave the previous manifest in place
+        if (!branch->trick_manifest_failed) {
+            g_printerr("Trick play Representation %s not found in %s\n",
+                       branch->trick_pad.c_str(), staging_path.c_str());
+        }
+        branch->trick_manifest_failed = true;
+        return;
+    }
+    branch->trick_manifest_failed = false;
+
+    ProducerReference reference;
+    {
+        std::lock_guard<std::mutex> guard(reference_lock);
+        reference = producer_reference;
+    }
+    // Presentation times count from the start of this branch's timeline
+    GstClockTime base = branch->base_running_time;
+    if (!GST_CLOCK_TIME_IS_VALID(base) || reference.running_time < base) {
+        reference.valid = false;
+    } else {
+        reference.running_time -= base;
+    }
+    published = insert_timing_elements(published, utc_timing, reference);
+    if (!segment_subdirectory.empty()) {
+        published = insert_base_url(published, segment_subdirectory + "/");
+    }
+
+    GError *err = NULL;
+    if (!g_file_set_contents(manifest_path.c_str(), published.c_str(), published.size(), &err)) {
+        g_printerr("Failed to write %s: %s\n", manifest_path.c_str(), err->message);
+        g_error_free(err);
+    }
+}
+
+bool RTSPDashStreamer::always_on(RenditionBranch *branch) const {
+    // The mosaic shows every camera all the time
+    return scaled_frame_callback && branch->config.name == scaled_frame_rendition;
+}
+
+void RTSPDashStreamer::activate_branch(RenditionBranch *branch) {
+    // Refused requests stay queued, the players' next manifest fetch
+    // tries again
+    if (!admit_rendition(branch->config, 0, !branch->refused)) {
+        branch->refused = true;
+        return;
+    }
+    branch->refused = false;
+
+    // The RTSP session and the decoder are up already, what is left is
+    // the encoder's start and the first segment. Timed from the request
+    // to that segment, see handle_element_message().
+    g_print("Starting %s rendition on request\n", branch->config.name.c_str());
+    branch->activations++;
+    branch->activated_us = branch->demanded_us;
+    if (!create_dash_pipeline(branch)) {
+        branch->activated_us = 0;
+    }
+}
+
+void RTSPDashStreamer::write_idle_manifest(RenditionBranch *branch) {
+    // A live manifest without Representations that players refetch every
+    // second until the first segment of the rendition is out. Fetching
+    // it is what starts the rendition.
+    if (!publishing) {
+        return;
+    }
+    std::string manifest_path = output_path + "/" + branch->config.name + MANIFEST_SUFFIX;
+    std::string now = format_wall_clock(g_get_real_time());
+    std::string mpd =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" "
+        "profiles=\"urn:mpeg:dash:profile:isoff-live:2011\" type=\"dynamic\" "
+        "availabilityStartTime=\"" + now + "\" publishTime=\"" + now + "\" "
+        "minimumUpdatePeriod=\"PT1S\" minBufferTime=\"PT4S\">\n"
+        "  <Period id=\"0\" start=\"PT0S\"/>\n"
+        "</MPD>\n";
+    mpd = insert_timing_elements(mpd, utc_timing, ProducerReference());
+
+    GError *err = NULL;
+    if (!g_file_set_contents(manifest_path.c_str(), mpd.c_str(), mpd.size(), &err)) {
+        g_printerr("Failed to write %s: %s\n", manifest_path.c_str(), err->message);
+        g_error_free(err);
+    }
+}
+
+void RTSPDashStreamer::watch_manifest_requests() {
+    if (demand_watch_fd >= 0) {
+        return;
+    }
+
+    // The web server opens a manifest for every fetch. Our own writes
+    // rename a temporary file into place and are not seen as one.
+    demand_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (demand_watch_fd < 0 ||
+        inotify_add_watch(demand_watch_fd, output_path.c_str(), IN_OPEN) < 0) {
+        g_printerr("Can't watch %s for manifest requests (%s), renditions start "
+                   "on request_rendition() only\n", output_path.c_str(), g_strerror(errno));
+        if (demand_watch_fd >= 0) {
+            close(demand_watch_fd);
+            demand_watch_fd = -1;
+        }
+        return;
+    }
+
+    GSource *source = g_unix_fd_source_new(demand_watch_fd, G_IO_IN);
+    g_source_set_callback(source, (GSourceFunc)on_manifest_opened, this, NULL);
+    demand_watch_id = g_source_attach(source, context);
+    g_source_unref(source);
+}
+
+gboolean RTSPDashStreamer::on_manifest_opened(gint fd, GIOCondition condition, gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+
+    alignas(struct inotify_event) char events[4096];
+    ssize_t length;
+    while ((length = read(fd, events, sizeof(events))) > 0) {
+        for (char *pos = events; pos < events + length; ) {
+            const struct inotify_event *event = reinterpret_cast<struct inotify_event*>(pos);
+            pos += sizeof(struct inotify_event) + event->len;
+
+            // Staging manifests end in .staging.mpd and don't match
+            if (event->len > 0 && g_str_has_suffix(event->name, MANIFEST_SUFFIX)) {
+                std::string name(event->name, strlen(event->name) - strlen(MANIFEST_SUFFIX));
+                streamer->request_rendition(name);
+            }
+        }
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean RTSPDashStreamer::evaluate_demand(gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+    std::lock_guard<std::mutex> guard(streamer->branches_lock);
+
+    gint64 now = g_get_monotonic_time();
+    gint64 idle_us = (gint64)streamer->demand_idle * G_USEC_PER_SEC;
+    for (RenditionBranch *branch : streamer->branches) {
+        if (!branch->encoder || branch->removing || streamer->always_on(branch) ||
+            now - branch->demanded_us < idle_us) {
+            continue;
+        }
+
+        g_print("No requests for %s rendition in %u s, stopping it\n",
+                branch->config.name.c_str(), streamer->demand_idle);
+        branch->idle = true;
+        branch->rebuild = false;
+        branch->deactivated_us = now;
+        branch->activated_us = 0;
+        streamer->teardown_dash_pipeline(branch);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+std::string RTSPDashStreamer::input_cost_key() const {
+    // The decoder and the prefilters that run on its thread
+    std::string key = "avdec_h264";
+    if (denoise.mode != DENOISE_OFF) {
+        key += "+denoise";
+    }
+    if (!privacy_masks.empty() || timestamp_overlay) {
+        key += "+overlay";
+    }
+    return key;
+}
+
+double RTSPDashStreamer::input_pixel_rate() {
+    // The camera size is only known once it sends, until then the
+    // largest rendition stands in for it
+    double pixels = 0;
+    for (RenditionBranch *branch : branches) {
+        pixels = MAX(pixels, (double)branch->config.width * branch->config.height);
+    }
+    return pixels * RENDITION_FPS;
+}
+
+static std::string encode_cost_key(const RenditionConfig& rendition) {
+    // The live settings are fixed per encoder, see make_video_encoder()
+    const gchar *factory = find_video_encoder(rendition.codec);
+    return factory ? factory : video_codec_name(rendition.codec);
+}
+
+static double rendition_pixel_rate(const RenditionConfig& rendition) {
+    return (double)rendition.width * rendition.height * RENDITION_FPS;
+}
+
+double RTSPDashStreamer::project_rendition(const RenditionConfig& rendition) {
+    return AdmissionControl::get().project(encode_cost_key(rendition),
+                                           rendition_pixel_rate(rendition),
+                                           ENCODE_SEED_NS_PER_PIXEL[rendition.codec]);
+}
+
+bool RTSPDashStreamer::admit() {
+    if (branches.empty()) {
+        set_renditions(default_ladder());
+    }
+
+    std::lock_guard<std::mutex> guard(branches_lock);
+    if (scaled_frame_callback) {
+        choose_scaled_frame_rendition();
+    }
+    double cores = AdmissionControl::get().project(input_cost_key(), input_pixel_rate(),
+                                                   DECODE_SEED_NS_PER_PIXEL);
+    for (RenditionBranch *branch : branches) {
+        if (!on_demand || always_on(branch)) {
+            cores += project_rendition(branch->config);
+        }
+    }
+    return AdmissionControl::get().fits(cores);
+}
+
+bool RTSPDashStreamer::admit_rendition(const RenditionConfig& rendition, double replaced_cores,
+                                       bool report) {
+    AdmissionControl& admission = AdmissionControl::get();
+    double cores = project_rendition(rendition);
+    if (admission.fits(cores - replaced_cores)) {
+        return true;
+    }
+
+    if (report) {
+        admissions_refused++;
+        g_printerr("Camera %s: %s rendition refused, it needs %.2f cores and %.2f of %.2f "
+                   "are taken\n", camera_id.c_str(), rendition.name.c_str(), cores,
+                   admission.projected_total(), admission.capacity());
+    }
+    return false;
+}
+
+void RTSPDashStreamer::reserve_branch(RenditionBranch *branch) {
+    const RenditionConfig& config = branch->config;
+    branch->reservation = AdmissionControl::get().reserve(encode_cost_key(config),
+                                                          rendition_pixel_rate(config),
+                                                          ENCODE_SEED_NS_PER_PIXEL[config.codec]);
+    branch->frames_reserved = branch->frames;
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_branch_stream_start(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RenditionBranch *branch = static_cast<RenditionBranch*>(user_data);
+
+    // The branch's streaming thread, before anything behind the queue
+    // has opened and started threads of its own
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_STREAM_START) {
+        AdmissionControl::get().tag_thread(branch->reservation);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+gboolean RTSPDashStreamer::evaluate_cost(gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+    AdmissionControl& admission = AdmissionControl::get();
+    gint64 now = g_get_monotonic_time();
+
+    // The input runs at the camera's size and frame rate
+    guint64 frames = streamer->decoded_frames;
+    guint64 new_frames = frames - streamer->decoded_frames_seen;
+    GstCaps *caps = NULL;
+    if (streamer->rtsp_decoder) {
+        GstPad *decoder_src = gst_element_get_static_pad(streamer->rtsp_decoder, "src");
+        caps = gst_pad_get_current_caps(decoder_src);
+        gst_object_unref(decoder_src);
+    }
+    GstVideoInfo info;
+    if (caps && gst_video_info_from_caps(&info, caps) && new_frames > 0 &&
+        streamer->cost_evaluated_us > 0) {
+        double frame_pixels = (double)GST_VIDEO_INFO_WIDTH(&info) * GST_VIDEO_INFO_HEIGHT(&info);
+        double seconds = (now - streamer->cost_evaluated_us) / (double)G_USEC_PER_SEC;
+        streamer->decoded_pixels += new_frames * (guint64)frame_pixels;
+        admission.update(streamer->input_reservation, streamer->decoded_pixels,
+                         new_frames * frame_pixels / seconds);
+    }
+    if (caps) {
+        gst_caps_unref(caps);
+    }
+    streamer->decoded_frames_seen = frames;
+    streamer->cost_evaluated_us = now;
+
+    {
+        std::lock_guard<std::mutex> guard(streamer->branches_lock);
+        for (RenditionBranch *branch : streamer->branches) {
+            if (!branch->reservation) {
+                continue;
+            }
+            const RenditionConfig& config = branch->config;
+            admission.update(branch->reservation,
+                             (branch->frames - branch->frames_reserved) *
+                                 (guint64)config.width * config.height,
+                             rendition_pixel_rate(config));
+        }
+    }
+
+    admission.sample();
+    return G_SOURCE_CONTINUE;
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_crop_caps(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    const FrameRegion *region = static_cast<const FrameRegion*>(user_data);
+
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstCaps *caps = NULL;
+    GstVideoInfo video_info;
+    gst_event_parse_caps(event, &caps);
+    if (!gst_video_info_from_caps(&video_info, caps)) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    // Set before videocrop sees the caps. A region reaching past the
+    // frame, e.g. on the slate, is clipped to it.
+    int frame_width = GST_VIDEO_INFO_WIDTH(&video_info);
+    int frame_height = GST_VIDEO_INFO_HEIGHT(&video_info);
+    int left = MIN(region->x, frame_width - 2);
+    int top = MIN(region->y, frame_height - 2);
+    int width = MIN(region->width, frame_width - left);
+    int height = MIN(region->height, frame_height - top);
+    GstElement *crop = GST_ELEMENT(GST_OBJECT_PARENT(pad));
+    g_object_set(crop,
+        "left", left,
+        "top", top,
+        "right", frame_width - left - width,
+        "bottom", frame_height - top - height,
+        NULL);
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_encoded_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RenditionBranch *branch = static_cast<RenditionBranch*>(user_data);
+    RTSPDashStreamer *streamer = branch->owner;
+
+    branch->frames++;
+    if (streamer->frame_callback) {
+        streamer->frame_callback(branch->config.name.c_str(),
+            GST_PAD_PROBE_INFO_BUFFER(info), streamer->frame_user_data);
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_scaled_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RenditionBranch *branch = static_cast<RenditionBranch*>(user_data);
+    RTSPDashStreamer *streamer = branch->owner;
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+            GstCaps *caps = NULL;
+            gst_event_parse_caps(event, &caps);
+            branch->scaled_info_valid = gst_video_info_from_caps(&branch->scaled_info, caps);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (branch->scaled_info_valid) {
+        streamer->scaled_frame_callback(GST_PAD_PROBE_INFO_BUFFER(info), &branch->scaled_info,
+                                        streamer->scaled_frame_user_data);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_encoder_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RenditionBranch *branch = static_cast<RenditionBranch*>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    // The first frame starts this branch's timeline, on-demand, restarted
+    // and rebuilt branches start later than the pipeline
+    if (!GST_CLOCK_TIME_IS_VALID(branch->base_running_time) && GST_BUFFER_PTS_IS_VALID(buffer)) {
+        GstEvent *event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+        if (event) {
+            const GstSegment *segment = NULL;
+            gst_event_parse_segment(event, &segment);
+            branch->base_running_time = gst_segment_to_running_time(segment, GST_FORMAT_TIME,
+                                                                    GST_BUFFER_PTS(buffer));
+            gst_event_unref(event);
+        }
+    }
+
+    guint divisor = branch->frame_divisor;
+    if (divisor <= 1) {
+        return GST_PAD_PROBE_OK;
+    }
+    if (branch->skip_counter++ % divisor != 0) {
+        return GST_PAD_PROBE_DROP;
+    }
+
+    if (GST_BUFFER_DURATION_IS_VALID(buffer)) {
+        buffer = gst_buffer_make_writable(buffer);
+        GST_BUFFER_DURATION(buffer) *= divisor;
+        GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+#ifdef ENABLE_USDT
+GstPadProbeReturn RTSPDashStreamer::on_encoder_enter(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RenditionBranch *branch = static_cast<RenditionBranch*>(user_data);
+
+    RTSP_DASH_TRACE3(encoder_enter, branch->owner->camera_id.c_str(),
+        branch->config.name.c_str(), GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info)));
+
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_encoder_exit(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RenditionBranch *branch = static_cast<RenditionBranch*>(user_data);
+
+    RTSP_DASH_TRACE3(encoder_exit, branch->owner->camera_id.c_str(),
+        branch->config.name.c_str(), GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info)));
+
+    return GST_PAD_PROBE_OK;
+}
+#endif
+
+RTSPDashStreamer::RenditionBranch *RTSPDashStreamer::find_branch(const std::string& name) {
+    for (RenditionBranch *branch : branches) {
+        if (branch->config.name == name) {
+            return branch;
+        }
+    }
+    return nullptr;
+}
+
+RTSPDashStreamer::RenditionBranch *RTSPDashStreamer::find_branch_for_object(GstObject *object) {
+    for (RenditionBranch *branch : branches) {
+        GstElement *elements[] = {
+            branch->queue, branch->crop, branch->convert, branch->scale, branch->rate,
+            branch->capsfilter, branch->encoder, branch->parse, branch->dash_sink,
+            branch->audio_queue, branch->parse_tee, branch->video_queue, branch->trick_queue
+        };
+        for (GstElement *element : elements) {
+            if (element &&
+                (object == GST_OBJECT(element) ||
+                 gst_object_has_as_ancestor(object, GST_OBJECT(element)))) {
+                return branch;
+            }
+        }
+    }
+    return nullptr;
+}
+
+bool RTSPDashStreamer::connect_dummy_source() {
+    // Create caps filter for dummy source
+    GstElement *dummy_caps = gst_element_factory_make("capsfilter", "dummy-caps");
+    GstElement *dummy_convert = gst_element_factory_make("videoconvert", "dummy-convert");
+
+    if (!dummy_caps || !dummy_convert) {
+        g_printerr("Failed to create dummy source elements\n");
+        return false;
+    }
+
+    // Set caps for dummy source
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+        "width", G_TYPE_INT, 1920,
+        "height", G_TYPE_INT, 1080,
+        "framerate", GST_TYPE_FRACTION, 25, 1,
+        NULL);
+    g_object_set(dummy_caps, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    gst_bin_add_many(GST_BIN(pipeline), dummy_caps, dummy_convert, NULL);
+
+    // Link dummy source chain
+    if (!gst_element_link_many(dummy_src, dummy_caps, dummy_convert, NULL)) {
+        g_printerr("Failed to link dummy source elements\n");
+        return false;
+    }
+
+    // Connect to input selector, the request pad is kept for activation
+    // and released in cleanup()
+    GstPad *dummy_pad = gst_element_get_static_pad(dummy_convert, "src");
+    dummy_selector_pad = gst_element_get_request_pad(input_selector, "sink_%u");
+
+    GstPadLinkReturn ret = gst_pad_link(dummy_pad, dummy_selector_pad);
+    gst_object_unref(dummy_pad);
+
+    if (ret != GST_PAD_LINK_OK) {
+        g_printerr("Failed to link dummy source to input selector\n");
+        return false;
+    }
+
+    return link_tee_input();
+}
+
+bool RTSPDashStreamer::link_tee_input() {
+    GstPad *reference_pad = gst_element_get_static_pad(tee, "sink");
+    gst_pad_add_probe(reference_pad, GST_PAD_PROBE_TYPE_BUFFER, on_reference_time, this, NULL);
+    gst_object_unref(reference_pad);
+
+    overlay.configure(privacy_masks, timestamp_overlay, overlay_text);
+    if (denoise.mode == DENOISE_OFF && !overlay.enabled()) {
+        if (!gst_element_link(input_selector, tee)) {
+            g_printerr("Failed to link input selector to tee\n");
+            return false;
+        }
+        return true;
+    }
+
+    // The denoiser and the overlay work on I420, which the decoders put
+    // out anyway, and run once here so every rendition and the thumbnail
+    // get them; masks in particular must not depend on the rendition
+    GstElement *prefilter_caps = gst_element_factory_make("capsfilter", "prefilter-caps");
+    if (!prefilter_caps) {
+        g_printerr("Failed to create prefilter caps filter\n");
+        return false;
+    }
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+        "format", G_TYPE_STRING, "I420",
+        NULL);
+    g_object_set(prefilter_caps, "caps", caps, NULL);
+    gst_caps_unref(caps);
+    gst_bin_add(GST_BIN(pipeline), prefilter_caps);
+
+    if (!gst_element_link_many(input_selector, prefilter_caps, tee, NULL)) {
+        g_printerr("Failed to link input selector to tee\n");
+        return false;
+    }
+
+    denoiser.configure(denoise);
+    GstPad *tee_sink = gst_element_get_static_pad(tee, "sink");
+    gst_pad_add_probe(tee_sink,
+        (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+        on_tee_input, this, NULL);
+    gst_object_unref(tee_sink);
+    return true;
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_tee_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+
+    // A new source or size starts over with a fresh reference frame
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+            GstCaps *caps = NULL;
+            gst_event_parse_caps(event, &caps);
+            streamer->frame_info_valid = gst_video_info_from_caps(&streamer->frame_info, caps);
+            streamer->denoiser.reset();
+            if (streamer->frame_info_valid) {
+                streamer->overlay.set_frame_info(&streamer->frame_info);
+            }
+        }
+        return GST_PAD_PROBE_OK;
+    }
+    if (!streamer->frame_info_valid) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstMapInfo map;
+    if (streamer->denoiser.estimate_due() && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        streamer->denoiser.observe(map.data, &streamer->frame_info);
+        gst_buffer_unmap(buffer, &map);
+    }
+    bool denoising = streamer->denoiser.is_active();
+    if (!denoising && !streamer->overlay.enabled()) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    // Decoders keep their output as reference, writing copies it then,
+    // once for both
+    buffer = gst_buffer_make_writable(buffer);
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READWRITE)) {
+        return GST_PAD_PROBE_OK;
+    }
+    gint64 started_us = g_get_monotonic_time();
+    if (denoising && streamer->denoiser.filter(map.data, &streamer->frame_info)) {
+        gint64 filtered_us = g_get_monotonic_time();
+        streamer->denoise_us += filtered_us - started_us;
+        streamer->denoised_frames++;
+        started_us = filtered_us;
+    }
+    // After the denoiser, which would otherwise smear the digits
+    if (streamer->overlay.enabled()) {
+        streamer->overlay.apply(map.data, g_get_real_time());
+        streamer->overlay_us += g_get_monotonic_time() - started_us;
+        streamer->overlaid_frames++;
+    }
+    gst_buffer_unmap(buffer, &map);
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_reference_time(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    // A mapping a second is plenty, the manifests change per segment
+    gint64 now_us = g_get_monotonic_time();
+    if (now_us - streamer->reference_sampled_us < G_USEC_PER_SEC ||
+        !GST_BUFFER_PTS_IS_VALID(buffer)) {
+        return GST_PAD_PROBE_OK;
+    }
+    streamer->reference_sampled_us = now_us;
+
+    // dashsink times the segments by running time
+    GstEvent *event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+    if (!event) {
+        return GST_PAD_PROBE_OK;
+    }
+    const GstSegment *segment = NULL;
+    gst_event_parse_segment(event, &segment);
+    GstClockTime running_time = gst_segment_to_running_time(segment, GST_FORMAT_TIME,
+                                                             GST_BUFFER_PTS(buffer));
+    gst_event_unref(event);
+    if (!GST_CLOCK_TIME_IS_VALID(running_time)) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    ProducerReference reference;
+    reference.valid = true;
+    reference.running_time = running_time;
+    reference.wall_clock_us = g_get_real_time();
+
+    // Camera frames carry their capture time once a sender report came
+    // in, the slate never does
+    GstCaps *ntp = gst_caps_new_empty_simple("timestamp/x-ntp");
+    GstReferenceTimestampMeta *meta = gst_buffer_get_reference_timestamp_meta(buffer, ntp);
+    gst_caps_unref(ntp);
+    if (meta) {
+        // NTP counts from 1900
+        reference.wall_clock_us = (gint64)(meta->timestamp / GST_USECOND) -
+                                  G_GINT64_CONSTANT(2208988800) * G_USEC_PER_SEC;
+        reference.captured = true;
+        streamer->capture_delay_ms = (g_get_real_time() - reference.wall_clock_us) / 1000;
+    } else {
+        streamer->capture_delay_ms = -1;
+    }
+
+    std::lock_guard<std::mutex> guard(streamer->reference_lock);
+    streamer->producer_reference = reference;
+    return GST_PAD_PROBE_OK;
+}
+
+void RTSPDashStreamer::setup_bus_monitoring() {
+    bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+
+    // Attach the watch to our own context rather than the default one
+    GSource *source = gst_bus_create_watch(bus);
+    g_source_set_callback(source, (GSourceFunc)bus_message_handler, this, NULL);
+    bus_watch_id = g_source_attach(source, context);
+    g_source_unref(source);
+
+    // Marks a failing rendition on its own thread, see on_sync_error()
+    gst_bus_enable_sync_message_emission(bus);
+    g_signal_connect(bus, "sync-message::error", G_CALLBACK(on_sync_error), this);
+}
+
+gboolean RTSPDashStreamer::bus_message_handler(GstBus *bus, GstMessage *msg, gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+    return streamer->handle_bus_message(msg);
+}
+
+gboolean RTSPDashStreamer::handle_bus_message(GstMessage *msg) {
+    switch (GST_MESSAGE_TYPE(msg)) {
+        case GST_MESSAGE_ERROR: {
+            GError *err;
+            gchar *debug;
+            gst_message_parse_error(msg, &err, &debug);
+
+            // Check if error is from RTSP source
+            if (GST_MESSAGE_SRC(msg) == GST_OBJECT(rtsp_src)) {
+                g_printerr("RTSP Error: %s\n", err->message);
+                g_printerr("Debug info: %s\n", debug ? debug : "none");
+
+                // Fail over to the backup or the slate and try to reconnect
+                handle_primary_lost();
+                schedule_rtsp_reconnect();
+            } else if (backup_src && GST_MESSAGE_SRC(msg) == GST_OBJECT(backup_src)) {
+                g_printerr("Backup RTSP Error: %s\n", err->message);
+                g_printerr("Debug info: %s\n", debug ? debug : "none");
+                handle_backup_lost();
+            } else {
+                g_printerr("Pipeline Error: %s\n", err->message);
+                g_printerr("Debug info: %s\n", debug ? debug : "none");
+
+                // A rendition's error only restarts that rendition, the
+                // others and the RTSP session keep going
+                if (!fail_branch(GST_MESSAGE_SRC(msg), err)) {
+                    stop();
+                }
+            }
+
+            g_error_free(err);
+            g_free(debug);
+            break;
+        }
+        case GST_MESSAGE_EOS:
+            g_print("End of stream\n");
+            stop();
+            break;
+
+        case GST_MESSAGE_STATE_CHANGED: {
+            if (GST_MESSAGE_SRC(msg) == GST_OBJECT(rtsp_src)) {
+                GstState old_state, new_state;
+                gst_message_parse_state_changed(msg, &old_state, &new_state, NULL);
+
+                if (new_state == GST_STATE_PLAYING) {
+                    g_print("RTSP source connected successfully\n");
+                    is_rtsp_connected = true;
+                    rtsp_connections++;
+                    update_transport();
+                    switch_to_rtsp_source();
+                } else if (old_state == GST_STATE_PLAYING && new_state < GST_STATE_PLAYING) {
+                    if (rtsp_restarting) {
+                        // Our own reset in reconnect_rtsp_source()
+                        rtsp_restarting = false;
+                        break;
+                    }
+                    g_print("RTSP source disconnected\n");
+                    is_rtsp_connected = false;
+                    rtp_transport = RTP_TRANSPORT_NONE;
+                    handle_primary_lost();
+                    schedule_rtsp_reconnect();
+                }
+            } else if (backup_src && GST_MESSAGE_SRC(msg) == GST_OBJECT(backup_src)) {
+                GstState old_state, new_state;
+                gst_message_parse_state_changed(msg, &old_state, &new_state, NULL);
+
+                if (new_state == GST_STATE_PLAYING) {
+                    g_print("Backup RTSP source ready\n");
+                    backup_connected = true;
+                    if (!showing_primary()) {
+                        activate_backup();
+                    }
+                } else if (old_state == GST_STATE_PLAYING && new_state < GST_STATE_PLAYING) {
+                    if (backup_restarting) {
+                        // Our own reset in reconnect_backup_source()
+                        backup_restarting = false;
+                        break;
+                    }
+                    g_print("Backup RTSP source disconnected\n");
+                    handle_backup_lost();
+                }
+            }
+            break;
+        }
+        case GST_MESSAGE_ELEMENT:
+            handle_element_message(msg);
+            break;
+
+        case GST_MESSAGE_WARNING:
+            handle_warning_message(msg);
+            break;
+
+        case GST_MESSAGE_QOS:
+            handle_qos_message(msg);
+            break;
+
+        case GST_MESSAGE_LATENCY:
+            // An element's latency changed (jitterbuffer, encoder, queue)
+            gst_bin_recalculate_latency(GST_BIN(pipeline));
+            latency_recalculations++;
+            break;
+
+        default:
+            break;
+    }
+    return TRUE;
+}
+
+void RTSPDashStreamer::handle_element_message(GstMessage *msg) {
+    const GstStructure *structure = gst_message_get_structure(msg);
+    if (!structure || !gst_structure_has_name(structure, "splitmuxsink-fragment-closed")) {
+        return;
+    }
+
+    // dashsink forwards the fragment notifications of its splitmuxsink
+    const gchar *location = gst_structure_get_string(structure, "location");
+    std::string rendition;
+    {
+        std::lock_guard<std::mutex> guard(branches_lock);
+        RenditionBranch *branch = find_branch_for_object(GST_MESSAGE_SRC(msg));
+        if (!branch) {
+            return;
+        }
+
+        // dashsink has just rewritten its manifest for this fragment
+        publish_manifest(branch);
+        if (branch->activated_us) {
+            branch->first_segment_ms = (g_get_monotonic_time() - branch->activated_us) / 1000;
+            branch->activated_us = 0;
+            g_print("%s rendition: first segment %u ms after the request\n",
+                    branch->config.name.c_str(), branch->first_segment_ms);
+        }
+        if (branch->trick_queue) {
+
+            // Segments are named after the Representation, i.e. the pad
+            gchar *basename = location ? g_path_get_basename(location) : NULL;
+            bool trick = basename && g_str_has_prefix(basename, branch->trick_pad.c_str());
+            g_free(basename);
+            if (trick) {
+                branch->trick_segments++;
+                return;
+            }
+        }
+
+        branch->segments++;
+        rendition = branch->config.name;
+    }
+
+    GstClockTime running_time = GST_CLOCK_TIME_NONE;
+    gst_structure_get_uint64(structure, "running-time", &running_time);
+
+    RTSP_DASH_TRACE4(segment, camera_id.c_str(), rendition.c_str(), location, running_time);
+
+    if (segment_callback) {
+        segment_callback(rendition.c_str(), location, running_time, segment_user_data);
+    }
+}
+
+void RTSPDashStreamer::handle_warning_message(GstMessage *msg) {
+    GError *err;
+    gchar *debug;
+    gst_message_parse_warning(msg, &err, &debug);
+
+    // rtspsrc warns about packet loss, timeouts and transport fallbacks
+    GstObject *src = GST_MESSAGE_SRC(msg);
+    if (src == GST_OBJECT(rtsp_src) || gst_object_has_as_ancestor(src, GST_OBJECT(rtsp_src))) {
+        g_printerr("RTSP Warning: %s\n", err->message);
+        rtsp_warnings++;
+    } else {
+        g_printerr("Pipeline Warning: %s\n", err->message);
+        pipeline_warnings++;
+
+        // Decode errors are warnings since max-errors is disabled
+        if (rtsp_decoder && src == GST_OBJECT(rtsp_decoder)) {
+            request_keyframe("decode-error");
+        }
+    }
+    g_printerr("Debug info: %s\n", debug ? debug : "none");
+
+    {
+        std::lock_guard<std::mutex> guard(branches_lock);
+        last_warning = err->message;
+    }
+
+    g_error_free(err);
+    g_free(debug);
+}
+
+void RTSPDashStreamer::handle_qos_message(GstMessage *msg) {
+    GstFormat format;
+    guint64 processed, dropped;
+    gst_message_parse_qos_stats(msg, &format, &processed, &dropped);
+
+    qos_events++;
+    if (dropped == G_MAXUINT64) {
+        return;
+    }
+
+    // The counters in QoS messages are running totals per element
+    GstObject *src = GST_MESSAGE_SRC(msg);
+    guint64& last = qos_dropped_by_element[src];
+    guint64 delta = dropped >= last ? dropped - last : dropped;
+    last = dropped;
+
+    std::lock_guard<std::mutex> guard(branches_lock);
+    RenditionBranch *branch = find_branch_for_object(src);
+    if (branch) {
+        branch->qos_dropped += delta;
+    } else {
+        decoder_qos_dropped += delta;
+    }
+}
+
+gboolean RTSPDashStreamer::evaluate_health(gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+    std::lock_guard<std::mutex> guard(streamer->branches_lock);
+
+    guint64 decoder_dropped = streamer->decoder_qos_dropped;
+    bool saturated = decoder_dropped > streamer->decoder_qos_dropped_seen;
+    streamer->decoder_qos_dropped_seen = decoder_dropped;
+
+    for (RenditionBranch *branch : streamer->branches) {
+        if (!branch->encoder || branch->removing) {
+            continue;
+        }
+
+        guint64 dropped = branch->qos_dropped;
+        bool dropping = dropped > branch->qos_dropped_seen;
+        branch->qos_dropped_seen = dropped;
+
+        // A filling queue means the encoder already can't keep up, act
+        // before it overflows
+        guint level = 0, max_level = 0;
+        g_object_get(branch->queue,
+            "current-level-buffers", &level,
+            "max-size-buffers", &max_level,
+            NULL);
+        bool backlog = max_level > 0 && level * 2 > max_level;
+        saturated = saturated ||
+                    ((dropping || backlog) && branch->load_level == MAX_LOAD_LEVEL);
+
+        if (dropping || backlog) {
+            branch->calm_windows = 0;
+            if (++branch->pressure_windows >= PRESSURE_WINDOWS &&
+                branch->load_level < MAX_LOAD_LEVEL) {
+                streamer->set_load_level(branch, branch->load_level + 1);
+                branch->pressure_windows = 0;
+            }
+        } else {
+            branch->pressure_windows = 0;
+            if (++branch->calm_windows >= CALM_WINDOWS && branch->load_level > 0) {
+                streamer->set_load_level(branch, branch->load_level - 1);
+                branch->calm_windows = 0;
+            }
+        }
+    }
+
+    streamer->evaluate_decode_skip(saturated);
+    return G_SOURCE_CONTINUE;
+}
+
+void RTSPDashStreamer::set_load_level(RenditionBranch *branch, int level) {
+    g_print("%s: %s rendition load level %d -> %d\n", camera_id.c_str(),
+            branch->config.name.c_str(), branch->load_level, level);
+
+    // Thinning the input cuts encoder work without renegotiating caps,
+    // which the muxer inside dashsink could not follow
+    branch->load_level = level;
+    branch->frame_divisor = LOAD_LEVEL_FRAME_DIVISOR[level];
+}
+
+void RTSPDashStreamer::evaluate_decode_skip(bool pressure) {
+    // Same hysteresis as the load levels of the branches
+    int level = decode_skip_level;
+    int next = level;
+    if (pressure) {
+        decode_calm_windows = 0;
+        if (++decode_pressure_windows >= PRESSURE_WINDOWS && level < DECODE_SKIP_NONKEY) {
+            next = level + 1;
+            decode_pressure_windows = 0;
+        }
+    } else {
+        decode_pressure_windows = 0;
+        if (++decode_calm_windows >= CALM_WINDOWS && level > DECODE_SKIP_NONE) {
+            next = level - 1;
+            decode_calm_windows = 0;
+        }
+    }
+    if (next != level) {
+        g_print("%s: decoder skips %s frames (was %s)\n", camera_id.c_str(),
+                decode_skip_name(next), decode_skip_name(level));
+        decode_skip_level = next;
+
+        // Called with branches_lock held, from evaluate_health()
+        for (RenditionBranch *branch : branches) {
+            if (branch->rate) {
+                set_rate_drop_only(branch->rate, next > DECODE_SKIP_NONE);
+            }
+        }
+    }
+
+    gint64 now = g_get_monotonic_time();
+    guint64 frames = decoded_frames;
+    if (decode_rate_us && now > decode_rate_us) {
+        decode_fps = (frames - decode_rate_frames_seen) * (double)G_USEC_PER_SEC /
+                     (now - decode_rate_us);
+    }
+    decode_rate_frames_seen = frames;
+    decode_rate_us = now;
+}
+
+void RTSPDashStreamer::on_new_manager(GstElement *src, GstElement *manager, gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+
+    // rtspsrc creates a new rtpbin for every session, so the jitterbuffers
+    // and counters of the previous one are gone
+    {
+        std::lock_guard<std::mutex> guard(streamer->jitter_lock);
+        streamer->release_rtp_session();
+        streamer->rtp_manager = GST_ELEMENT(gst_object_ref(manager));
+    }
+    g_signal_connect(manager, "new-jitterbuffer", G_CALLBACK(on_new_jitterbuffer), streamer);
+}
+
+void RTSPDashStreamer::on_new_jitterbuffer(GstElement *manager, GstElement *jitterbuffer,
+                                           guint session, guint ssrc, gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+
+    std::lock_guard<std::mutex> guard(streamer->jitter_lock);
+    streamer->jitterbuffers.push_back(GST_ELEMENT(gst_object_ref(jitterbuffer)));
+}
+
+gboolean RTSPDashStreamer::evaluate_latency(gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+    guint64 pushed = 0, lost = 0, late = 0, jitter = 0;
+    guint64 pushed_delta, lost_delta, late_delta;
+
+    {
+        std::lock_guard<std::mutex> guard(streamer->jitter_lock);
+        if (streamer->jitterbuffers.empty()) {
+            return G_SOURCE_CONTINUE;
+        }
+
+        // Sum the counters over all streams, the worst jitter decides
+        for (GstElement *jitterbuffer : streamer->jitterbuffers) {
+            GstStructure *stats = NULL;
+            g_object_get(jitterbuffer, "stats", &stats, NULL);
+            if (!stats) {
+                continue;
+            }
+
+            guint64 value;
+            if (gst_structure_get_uint64(stats, "num-pushed", &value)) {
+                pushed += value;
+            }
+            if (gst_structure_get_uint64(stats, "num-lost", &value)) {
+                lost += value;
+            }
+            if (gst_structure_get_uint64(stats, "num-late", &value)) {
+                late += value;
+            }
+            if (gst_structure_get_uint64(stats, "avg-jitter", &value)) {
+                jitter = std::max(jitter, value);
+            }
+            gst_structure_free(stats);
+        }
+
+        pushed_delta = pushed - streamer->rtp_pushed_seen;
+        lost_delta = lost - streamer->rtp_lost_seen;
+        late_delta = late - streamer->rtp_late_seen;
+        streamer->rtp_pushed_seen = pushed;
+        streamer->rtp_lost_seen = lost;
+        streamer->rtp_late_seen = late;
+    }
+
+    // Nothing arrived, e.g. while showing the slate
+    if (pushed_delta + lost_delta == 0) {
+        return G_SOURCE_CONTINUE;
+    }
+
+    double loss = (double)lost_delta / (pushed_delta + lost_delta);
+    streamer->rtp_jitter_us = jitter / GST_USECOND;
+    streamer->rtp_loss_rate = loss;
+
+    if (!streamer->adaptive_latency) {
+        return G_SOURCE_CONTINUE;
+    }
+
+    guint current = streamer->current_latency_ms;
+    guint target = JITTER_MULTIPLIER * (jitter / GST_MSECOND) + LATENCY_HEADROOM_MS;
+    if (late_delta > 0 || loss > LOSS_THRESHOLD) {
+        // Packets missed their deadline, give reordering and
+        // retransmission more room than the jitter alone asks for
+        target = std::max(target, current + current / 4);
+    } else if (target < current) {
+        // Shrink slowly so a single calm window doesn't undo a raise
+        target = std::max(target, current - current / 10);
+    }
+    target = CLAMP(target, streamer->min_latency_ms, streamer->max_latency_ms);
+
+    if (target >= current + LATENCY_MIN_STEP_MS || target + LATENCY_MIN_STEP_MS <= current) {
+        g_print("%s: jitter %.1f ms, loss %.2f%%, late %" G_GUINT64_FORMAT
+                ", latency %u -> %u ms\n", streamer->camera_id.c_str(),
+                (double)jitter / GST_MSECOND, loss * 100, late_delta, current, target);
+        streamer->set_latency(target);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+void RTSPDashStreamer::set_latency(guint latency) {
+    current_latency_ms = latency;
+
+    // rtspsrc hands its latency to the rtpbin of the next session, the
+    // running jitterbuffers are changed in place and post a LATENCY
+    // message that makes the pipeline recalculate
+    g_object_set(rtsp_src, "latency", latency, NULL);
+
+    std::lock_guard<std::mutex> guard(jitter_lock);
+    for (GstElement *jitterbuffer : jitterbuffers) {
+        g_object_set(jitterbuffer, "latency", latency, NULL);
+    }
+}
+
+void RTSPDashStreamer::release_rtp_session() {
+    for (GstElement *jitterbuffer : jitterbuffers) {
+        gst_object_unref(jitterbuffer);
+    }
+    jitterbuffers.clear();
+    if (rtp_manager) {
+        gst_object_unref(rtp_manager);
+        rtp_manager = nullptr;
+    }
+    rtp_pushed_seen = rtp_lost_seen = rtp_late_seen = 0;
+    rtcp_received_seen = rtcp_lost_seen = rtcp_requests_seen = 0;
+}
+
+gboolean RTSPDashStreamer::poll_rtcp_stats(gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+    GstElement *manager = nullptr;
+
+    {
+        std::lock_guard<std::mutex> guard(streamer->jitter_lock);
+        if (streamer->rtp_manager) {
+            manager = GST_ELEMENT(gst_object_ref(streamer->rtp_manager));
+        }
+    }
+    if (!manager) {
+        return G_SOURCE_CONTINUE;
+    }
+
+    // rtspsrc numbers the sessions after the SDP media, walk until the
+    // first one that doesn't exist
+    guint64 received = 0, lost = 0, requests = 0;
+    guint jitter_us = 0;
+    for (guint id = 0; id < MAX_RTP_SESSIONS; id++) {
+        GObject *session = NULL;
+        g_signal_emit_by_name(manager, "get-internal-session", id, &session);
+        if (!session) {
+            break;
+        }
+
+        GstStructure *stats = NULL;
+        g_object_get(session, "stats", &stats, NULL);
+        g_object_unref(session);
+        if (!stats) {
+            continue;
+        }
+
+        // rtpsession still hands out a GValueArray
+        const GValue *value = gst_structure_get_value(stats, "source-stats");
+G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+        GValueArray *sources = value ? (GValueArray*)g_value_get_boxed(value) : NULL;
+        guint n_sources = sources ? sources->n_values : 0;
+        GValue *source_values = sources ? sources->values : NULL;
+G_GNUC_END_IGNORE_DEPRECATIONS
+
+        for (guint i = 0; i < n_sources; i++) {
+            const GstStructure *source = gst_value_get_structure(&source_values[i]);
+            gboolean internal = FALSE;
+            gst_structure_get_boolean(source, "internal", &internal);
+
+            if (internal) {
+                // Our own receiver: feedback it sent towards the camera
+                guint pli = 0, fir = 0;
+                gst_structure_get_uint(source, "sent-pli-count", &pli);
+                gst_structure_get_uint(source, "sent-fir-count", &fir);
+                requests += pli + fir;
+                continue;
+            }
+
+            // The camera as seen by our receiver report
+            guint64 packets = 0;
+            gint packets_lost = 0, clock_rate = 0;
+            guint jitter = 0;
+            gst_structure_get_uint64(source, "packets-received", &packets);
+            gst_structure_get_int(source, "packets-lost", &packets_lost);
+            gst_structure_get_uint(source, "jitter", &jitter);
+            gst_structure_get_int(source, "clock-rate", &clock_rate);
+
+            received += packets;
+            lost += std::max(packets_lost, 0);
+            if (clock_rate > 0) {
+                jitter_us = std::max(jitter_us,
+                    (guint)((guint64)jitter * G_USEC_PER_SEC / clock_rate));
+            }
+        }
+        gst_structure_free(stats);
+    }
+    gst_object_unref(manager);
+
+    // Totals restart with every session, keep ours monotonic
+    {
+        std::lock_guard<std::mutex> guard(streamer->jitter_lock);
+        if (received >= streamer->rtcp_received_seen && lost >= streamer->rtcp_lost_seen &&
+            requests >= streamer->rtcp_requests_seen) {
+            streamer->rtcp_packets_received += received - streamer->rtcp_received_seen;
+            streamer->rtcp_packets_lost += lost - streamer->rtcp_lost_seen;
+            streamer->rtcp_keyframe_requests_sent += requests - streamer->rtcp_requests_seen;
+            if (streamer->rtp_transport == RTP_TRANSPORT_UDP_MCAST) {
+                streamer->multicast_packets_lost += lost - streamer->rtcp_lost_seen;
+            }
+        }
+        streamer->rtcp_received_seen = received;
+        streamer->rtcp_lost_seen = lost;
+        streamer->rtcp_requests_seen = requests;
+    }
+    streamer->rtcp_jitter_us = jitter_us;
+
+    return G_SOURCE_CONTINUE;
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_depay_event(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+
+    // The thread that depayloads also decodes and runs the prefilters;
+    // the decoder starts its own threads when it sees the caps
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_STREAM_START) {
+        AdmissionControl::get().tag_thread(streamer->input_reservation);
+    }
+
+    // The jitterbuffer gave up on a packet, retransmission included, so
+    // the next frames reference data the decoder will never see
+    if (gst_event_has_name(GST_PAD_PROBE_INFO_EVENT(info), "GstRTPPacketLost")) {
+        streamer->request_keyframe("packet-lost");
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_decoded_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+    streamer->decoded_frames++;
+
+    // avdec_h264 flags frames decoded with missing references
+    if (GST_BUFFER_FLAG_IS_SET(GST_PAD_PROBE_INFO_BUFFER(info), GST_BUFFER_FLAG_CORRUPTED)) {
+        streamer->request_keyframe("corrupted-frame");
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+// Whether an H.264 byte-stream access unit is a picture others may refer
+// to: nal_ref_idc is the same for all slices of a picture, so the first
+// one decides. Units without slices are kept.
+static bool is_reference_frame(GstBuffer *buffer) {
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        return true;
+    }
+    bool reference = true;
+    for (gsize i = 0; i + 3 < map.size; i++) {
+        if (map.data[i] != 0 || map.data[i + 1] != 0 || map.data[i + 2] != 1) {
+            continue;
+        }
+        guint8 header = map.data[i + 3];
+        guint8 type = header & 0x1f;
+        if (type == 1 || type == 5) {
+            reference = (header & 0x60) != 0;
+            break;
+        }
+        i += 3;
+    }
+    gst_buffer_unmap(buffer, &map);
+    return reference;
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_decoder_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    if (!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+        streamer->decode_resync = false;
+        return GST_PAD_PROBE_OK;
+    }
+
+    // Once a reference frame is skipped the frames after it can't be
+    // decoded either, so decoding resumes at the next keyframe
+    int level = streamer->decode_skip_level;
+    bool skip;
+    if (level >= DECODE_SKIP_NONKEY || streamer->decode_resync) {
+        streamer->decode_resync = true;
+        skip = true;
+    } else {
+        skip = level >= DECODE_SKIP_NONREF && !is_reference_frame(buffer);
+    }
+    if (!skip) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    streamer->decode_skipped++;
+    return GST_PAD_PROBE_DROP;
+}
+
+void RTSPDashStreamer::request_keyframe(const gchar *reason) {
+    gint64 now = g_get_monotonic_time();
+    gint64 last = last_keyframe_request_us;
+
+    // Called from streaming threads and the bus, only one of them wins
+    if ((last != 0 && now - last < KEYFRAME_REQUEST_INTERVAL) ||
+        !last_keyframe_request_us.compare_exchange_strong(last, now)) {
+        keyframe_requests_suppressed++;
+        return;
+    }
+
+    // rtpsession turns the upstream force-key-unit event into an RTCP
+    // PLI or FIR, whichever the camera announced in its SDP
+    GstPad *decoder_sink = gst_element_get_static_pad(rtsp_decoder, "sink");
+    gst_pad_push_event(decoder_sink,
+        gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+    gst_object_unref(decoder_sink);
+
+    keyframe_requests++;
+    RTSP_DASH_TRACE2(keyframe_request, camera_id.c_str(), reason);
+}
+
+static bool is_multicast_address(const gchar *address) {
+    unsigned int first = 0;
+
+    if (!address) {
+        return false;
+    }
+    if (strchr(address, ':')) {
+        // IPv6 multicast is ff00::/8
+        return g_ascii_strncasecmp(address, "ff", 2) == 0;
+    }
+    return sscanf(address, "%u.", &first) == 1 && first >= 224 && first <= 239;
+}
+
+void RTSPDashStreamer::update_transport() {
+    // rtspsrc only creates udpsrc elements for UDP transports, their
+    // address is the joined group in the multicast case
+    RtpTransport transport = RTP_TRANSPORT_TCP;
+    std::string group;
+
+    GstIterator *it = gst_bin_iterate_recurse(GST_BIN(rtsp_src));
+    GValue item = G_VALUE_INIT;
+    bool done = false;
+
+    while (!done) {
+        switch (gst_iterator_next(it, &item)) {
+            case GST_ITERATOR_OK: {
+                GstElement *element = GST_ELEMENT(g_value_get_object(&item));
+                GstElementFactory *factory = gst_element_get_factory(element);
+                if (factory && g_strcmp0(GST_OBJECT_NAME(factory), "udpsrc") == 0) {
+                    gchar *address = NULL;
+                    g_object_get(element, "address", &address, NULL);
+                    if (is_multicast_address(address)) {
+                        transport = RTP_TRANSPORT_UDP_MCAST;
+                        if (group.empty()) {
+                            group = address;
+                        }
+                    } else if (transport == RTP_TRANSPORT_TCP) {
+                        transport = RTP_TRANSPORT_UDP;
+                    }
+                    g_free(address);
+                }
+                g_value_reset(&item);
+                break;
+            }
+            case GST_ITERATOR_RESYNC:
+                transport = RTP_TRANSPORT_TCP;
+                group.clear();
+                gst_iterator_resync(it);
+                break;
+            default:
+                done = true;
+                break;
+        }
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+
+    rtp_transport = transport;
+    {
+        std::lock_guard<std::mutex> guard(jitter_lock);
+        multicast_group = group;
+    }
+
+    if (transport == RTP_TRANSPORT_UDP_MCAST) {
+        multicast_joins++;
+        g_print("%s: joined multicast group %s\n", camera_id.c_str(), group.c_str());
+    } else if (transport == RTP_TRANSPORT_TCP && transport_policy != TRANSPORT_TCP) {
+        // UDP was refused by the camera or blocked on the way
+        tcp_fallbacks++;
+        g_print("%s: receiving RTP over TCP\n", camera_id.c_str());
+    }
+}
+
+void RTSPDashStreamer::on_rtsp_pad_added(GstElement *src, GstPad *pad, gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+    streamer->connect_rtsp_pad(pad, false);
+}
+
+void RTSPDashStreamer::on_rtsp_no_more_pads(GstElement *src, gpointer user_data) {
+    g_print("RTSP: No more pads\n");
+}
+
+void RTSPDashStreamer::connect_rtsp_pad(GstPad *pad, bool backup) {
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    if (!caps) {
+        caps = gst_pad_query_caps(pad, NULL);
+    }
+
+    if (caps) {
+        GstStructure *structure = gst_caps_get_structure(caps, 0);
+        const gchar *name = gst_structure_get_name(structure);
+
+        g_print("RTSP %spad added: %s\n", backup ? "backup " : "", name);
+        RTSP_DASH_TRACE2(connect_pad, camera_id.c_str(), name);
+
+        // We're interested in video streams
+        if (g_str_has_prefix(name, "application/x-rtp") &&
+            gst_structure_has_field(structure, "media")) {
+            const gchar *media = gst_structure_get_string(structure, "media");
+
+            if (g_strcmp0(media, "video") == 0) {
+                // Create RTP depayloader and decoder chain
+                if (backup) {
+                    create_backup_decode_chain(pad);
+                } else {
+                    create_rtsp_decode_chain(pad);
+                }
+            } else if (g_strcmp0(media, "audio") == 0 && !backup) {
+                // The backup stays silent, its audio may be out of sync
+                create_rtsp_audio_chain(pad, structure);
+            }
+        }
+
+        gst_caps_unref(caps);
+    }
+}
+
+bool RTSPDashStreamer::build_decode_chain(const std::string& prefix, GstElement *&depay_out,
+                                          GstElement *&decoder_out, GstPad *&selector_pad) {
+    // Create decode chain elements
+    GstElement *depay = gst_element_factory_make("rtph264depay", (prefix + "-depay").c_str());
+    GstElement *parse = gst_element_factory_make("h264parse", (prefix + "-parse").c_str());
+    GstElement *decode = gst_element_factory_make("avdec_h264", (prefix + "-decode").c_str());
+    GstElement *convert = gst_element_factory_make("videoconvert", (prefix + "-convert").c_str());
+
+    if (!depay || !parse || !decode || !convert) {
+        g_printerr("Failed to create %s decode chain elements\n", prefix.c_str());
+        return false;
+    }
+
+    // Repeat SPS/PPS with every IDR so decoding can start at any of them
+    g_object_set(parse, "config-interval", -1, NULL);
+
+    gst_bin_add_many(GST_BIN(pipeline), depay, parse, decode, convert, NULL);
+
+    // Link decode chain; byte-stream access units so on_decoder_input()
+    // can read the NAL headers
+    GstCaps *caps = gst_caps_from_string("video/x-h264,stream-format=byte-stream,alignment=au");
+    bool linked = gst_element_link(depay, parse) &&
+                  gst_element_link_filtered(parse, decode, caps) &&
+                  gst_element_link(decode, convert);
+    gst_caps_unref(caps);
+    if (!linked) {
+        g_printerr("Failed to link %s decode chain\n", prefix.c_str());
+        return false;
+    }
+
+    // Connect convert output to input selector
+    GstPad *convert_src = gst_element_get_static_pad(convert, "src");
+    selector_pad = gst_element_get_request_pad(input_selector, "sink_%u");
+
+    if (gst_pad_link(convert_src, selector_pad) != GST_PAD_LINK_OK) {
+        g_printerr("Failed to link %s chain to input selector\n", prefix.c_str());
+    }
+    gst_object_unref(convert_src);
+
+    // Sync states
+    gst_element_sync_state_with_parent(depay);
+    gst_element_sync_state_with_parent(parse);
+    gst_element_sync_state_with_parent(decode);
+    gst_element_sync_state_with_parent(convert);
+
+    depay_out = depay;
+    decoder_out = decode;
+    return true;
+}
+
+void RTSPDashStreamer::link_depay(GstPad *pad, GstElement *depay) {
+    GstPad *depay_sink = gst_element_get_static_pad(depay, "sink");
+    if (gst_pad_is_linked(depay_sink)) {
+        g_print("Ignoring additional RTSP stream for %s\n", GST_OBJECT_NAME(depay));
+    } else if (gst_pad_link(pad, depay_sink) != GST_PAD_LINK_OK) {
+        g_printerr("Failed to link RTSP pad to depayloader\n");
+    }
+    gst_object_unref(depay_sink);
+}
+
+void RTSPDashStreamer::create_rtsp_decode_chain(GstPad *pad) {
+    // The decode chain is built once and outlives rtspsrc's pads, which
+    // are removed on every reconnect; later pads are only relinked
+    if (!rtsp_depay) {
+        GstElement *depay, *decode;
+        if (!build_decode_chain("rtsp", depay, decode, rtsp_selector_pad)) {
+            return;
+        }
+
+        // Recover from loss with a keyframe request instead of waiting for
+        // the next periodic IDR; the decoder must not give up meanwhile
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(decode), "max-errors")) {
+            g_object_set(decode, "max-errors", -1, NULL);
+        }
+
+        GstPad *depay_pad = gst_element_get_static_pad(depay, "sink");
+        gst_pad_add_probe(depay_pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+            on_depay_event, this, NULL);
+        gst_object_unref(depay_pad);
+
+        GstPad *decode_pad = gst_element_get_static_pad(decode, "src");
+        gst_pad_add_probe(decode_pad, GST_PAD_PROBE_TYPE_BUFFER,
+            on_decoded_frame, this, NULL);
+        gst_object_unref(decode_pad);
+
+        // Frame skipping under overload, see evaluate_decode_skip()
+        GstPad *decode_sink = gst_element_get_static_pad(decode, "sink");
+        gst_pad_add_probe(decode_sink, GST_PAD_PROBE_TYPE_BUFFER,
+            on_decoder_input, this, NULL);
+        gst_object_unref(decode_sink);
+
+        rtsp_depay = depay;
+        rtsp_decoder = decode;
+    }
+
+    // Connect RTSP pad to depayloader
+    link_depay(pad, rtsp_depay);
+}
+
+static GstElement *make_aac_encoder() {
+    // Whichever AAC encoder the installation has
+    const gchar *factories[] = { "avenc_aac", "fdkaacenc", "voaacenc" };
+    for (const gchar *factory : factories) {
+        GstElement *encoder = gst_element_factory_make(factory, "audio-encoder");
+        if (encoder) {
+            return encoder;
+        }
+    }
+    return NULL;
+}
+
+// AudioSpecificConfig of AAC LC at rate and channels, empty for rates
+// AAC has no index for
+static std::vector<guint8> aac_lc_config(int rate, int channels) {
+    static const int rates[] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000,
+                                 22050, 16000, 12000, 11025, 8000, 7350 };
+    std::vector<guint8> config;
+    for (guint index = 0; index < G_N_ELEMENTS(rates); index++) {
+        if (rates[index] == rate) {
+            guint bits = (2 << 11) | (index << 7) | ((channels & 0xf) << 3);
+            config.push_back(bits >> 8);
+            config.push_back(bits & 0xff);
+            break;
+        }
+    }
+    return config;
+}
+
+// AudioSpecificConfig of camera AAC from the SDP's config parameter, as is
+// for MPEG4-GENERIC and out of the StreamMuxConfig for MP4A-LATM. Empty
+// when it is missing or not the plain 2 byte form in the latter.
+static std::vector<guint8> rtp_aac_config(const GstStructure *structure, bool latm) {
+    std::vector<guint8> bytes;
+    const gchar *hex = gst_structure_get_string(structure, "config");
+    for (gsize i = 0; hex && g_ascii_isxdigit(hex[i]) && g_ascii_isxdigit(hex[i + 1]); i += 2) {
+        bytes.push_back(g_ascii_xdigit_value(hex[i]) << 4 | g_ascii_xdigit_value(hex[i + 1]));
+    }
+    if (!latm) {
+        return bytes;
+    }
+
+    // audioMuxVersion 0 with one subframe, program and layer, then the
+    // config and frameLengthType 0 right behind its 16 bits, which rules
+    // out an SBR extension signalled there
+    std::vector<guint8> config;
+    if (bytes.size() < 5) {
+        return config;
+    }
+    guint64 bits = 0;
+    for (int i = 0; i < 5; i++) {
+        bits = bits << 8 | bytes[i];
+    }
+    if (((bits >> 25) & 0x5fff) != 0 || ((bits >> 6) & 0x7) != 0) {
+        return config;
+    }
+    config.push_back((bits >> 17) & 0xff);
+    config.push_back((bits >> 9) & 0xff);
+    return config;
+}
+
+bool RTSPDashStreamer::create_audio_chain() {
+    // silence -> raw selector -> convert/resample -> AAC encoder ->
+    // encoded selector -> aacparse -> audio tee. Camera AAC with the
+    // encoder's AudioSpecificConfig (profile, rate and channels) enters
+    // at the encoded selector, anything else at the raw one, so the
+    // muxers never see a caps change.
+    GstElement *silence = gst_element_factory_make("audiotestsrc", "audio-silence");
+    GstElement *silence_caps = gst_element_factory_make("capsfilter", "audio-silence-caps");
+    GstElement *raw_selector = gst_element_factory_make("input-selector", "audio-raw-selector");
+    GstElement *convert = gst_element_factory_make("audioconvert", "audio-convert");
+    GstElement *resample = gst_element_factory_make("audioresample", "audio-resample");
+    GstElement *caps_filter = gst_element_factory_make("capsfilter", "audio-caps");
+    GstElement *encoder = make_aac_encoder();
+    GstElement *encoded_selector = gst_element_factory_make("input-selector", "audio-encoded-selector");
+    GstElement *parse = gst_element_factory_make("aacparse", "audio-parse");
+    GstElement *tee = gst_element_factory_make("tee", "audio-tee");
+
+    GstElement *elements[] = {
+        silence, silence_caps, raw_selector, convert, resample,
+        caps_filter, encoder, encoded_selector, parse, tee
+    };
+    for (GstElement *element : elements) {
+        if (!element) {
+            for (GstElement *created : elements) {
+                if (created) {
+                    gst_object_unref(created);
+                }
+            }
+            return false;
+        }
+    }
+
+    g_object_set(silence,
+        "wave", 4, // Silence
+        "is-live", TRUE,
+        NULL);
+
+    GstCaps *caps = gst_caps_new_simple("audio/x-raw",
+        "rate", G_TYPE_INT, audio_rate,
+        "channels", G_TYPE_INT, audio_channels,
+        NULL);
+    g_object_set(silence_caps, "caps", caps, NULL);
+    g_object_set(caps_filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    g_object_set(encoder, "bitrate", audio_bitrate * 1000, NULL);
+
+    // Renditions come and go, the audio must keep flowing meanwhile
+    g_object_set(tee, "allow-not-linked", TRUE, NULL);
+
+    gst_bin_add_many(GST_BIN(pipeline), silence, silence_caps, raw_selector, convert,
+        resample, caps_filter, encoder, encoded_selector, parse, tee, NULL);
+
+    if (!gst_element_link(silence, silence_caps) ||
+        !gst_element_link_many(raw_selector, convert, resample, caps_filter, encoder, NULL) ||
+        !gst_element_link_many(encoded_selector, parse, tee, NULL)) {
+        g_printerr("Failed to link audio chain\n");
+        return false;
+    }
+
+    // Selector pads are kept for switching and released in cleanup()
+    GstPad *silence_src = gst_element_get_static_pad(silence_caps, "src");
+    silence_selector_pad = gst_element_get_request_pad(raw_selector, "sink_%u");
+    GstPadLinkReturn silence_ret = gst_pad_link(silence_src, silence_selector_pad);
+    gst_object_unref(silence_src);
+
+    GstPad *encoder_src = gst_element_get_static_pad(encoder, "src");
+    audio_encoder_pad = gst_element_get_request_pad(encoded_selector, "sink_%u");
+    GstPadLinkReturn encoder_ret = gst_pad_link(encoder_src, audio_encoder_pad);
+    gst_object_unref(encoder_src);
+
+    if (silence_ret != GST_PAD_LINK_OK || encoder_ret != GST_PAD_LINK_OK) {
+        g_printerr("Failed to link audio selectors\n");
+        return false;
+    }
+
+    audio_raw_selector = raw_selector;
+    audio_encoded_selector = encoded_selector;
+    audio_tee = tee;
+    select_silence();
+    return true;
+}
+
+void RTSPDashStreamer::create_rtsp_audio_chain(GstPad *pad, const GstStructure *structure) {
+    if (!audio_tee) {
+        return;
+    }
+
+    // Built for the codec of the first session and relinked afterwards
+    if (!rtsp_audio_depay) {
+        const gchar *encoding = gst_structure_get_string(structure, "encoding-name");
+        const gchar *params = gst_structure_get_string(structure, "encoding-params");
+        gint clock_rate = 0;
+        gst_structure_get_int(structure, "clock-rate", &clock_rate);
+        gint channels = params ? atoi(params) : 1;
+
+        std::vector<GstElement*> chain;
+        bool aac = false;
+        if (g_ascii_strcasecmp(encoding ? encoding : "", "MPEG4-GENERIC") == 0) {
+            chain.push_back(gst_element_factory_make("rtpmp4gdepay", "rtsp-audio-depay"));
+            aac = true;
+        } else if (g_ascii_strcasecmp(encoding ? encoding : "", "MP4A-LATM") == 0) {
+            chain.push_back(gst_element_factory_make("rtpmp4adepay", "rtsp-audio-depay"));
+            aac = true;
+        } else if (g_ascii_strcasecmp(encoding ? encoding : "", "PCMU") == 0) {
+            chain.push_back(gst_element_factory_make("rtppcmudepay", "rtsp-audio-depay"));
+            chain.push_back(gst_element_factory_make("mulawdec", "rtsp-audio-decode"));
+        } else if (g_ascii_strcasecmp(encoding ? encoding : "", "PCMA") == 0) {
+            chain.push_back(gst_element_factory_make("rtppcmadepay", "rtsp-audio-depay"));
+            chain.push_back(gst_element_factory_make("alawdec", "rtsp-audio-decode"));
+        } else {
+            g_print("Ignoring %s audio, only AAC and G.711 are supported\n",
+                    encoding ? encoding : "unknown");
+            return;
+        }
+
+        // Passed through only when it is what the encoder would put out,
+        // the negotiated codec_data once the silence went through it
+        bool passthrough = false;
+        if (aac) {
+            std::vector<guint8> expected = aac_lc_config(audio_rate, audio_channels);
+            GstCaps *encoded = gst_pad_get_current_caps(audio_encoder_pad);
+            if (encoded) {
+                const GValue *value = gst_structure_get_value(gst_caps_get_structure(encoded, 0),
+                                                              "codec_data");
+                GstMapInfo map;
+                if (value && G_VALUE_HOLDS(value, GST_TYPE_BUFFER) &&
+                    gst_buffer_map(gst_value_get_buffer(value), &map, GST_MAP_READ)) {
+                    expected.assign(map.data, map.data + map.size);
+                    gst_buffer_unmap(gst_value_get_buffer(value), &map);
+                }
+                gst_caps_unref(encoded);
+            }
+            std::vector<guint8> config = rtp_aac_config(structure,
+                g_ascii_strcasecmp(encoding, "MP4A-LATM") == 0);
+            passthrough = !expected.empty() && config == expected;
+        }
+        if (aac) {
+            chain.push_back(gst_element_factory_make("aacparse", "rtsp-audio-parse"));
+            if (!passthrough) {
+                chain.push_back(gst_element_factory_make("avdec_aac", "rtsp-audio-decode"));
+            }
+        }
+        if (!passthrough) {
+            chain.push_back(gst_element_factory_make("audioconvert", "rtsp-audio-convert"));
+            chain.push_back(gst_element_factory_make("audioresample", "rtsp-audio-resample"));
+        }
+
+        if (std::find(chain.begin(), chain.end(), nullptr) != chain.end()) {
+            g_printerr("Failed to create %s audio elements\n", encoding);
+            for (GstElement *element : chain) {
+                if (element) {
+                    gst_object_unref(element);
+                }
+            }
+            return;
+        }
+
+        for (gsize i = 0; i < chain.size(); i++) {
+            gst_bin_add(GST_BIN(pipeline), chain[i]);
+            if (i > 0 && !gst_element_link(chain[i - 1], chain[i])) {
+                g_printerr("Failed to link RTSP audio chain\n");
+                return;
+            }
+        }
+
+        GstElement *selector = passthrough ? audio_encoded_selector : audio_raw_selector;
+        GstPad *chain_src = gst_element_get_static_pad(chain.back(), "src");
+        rtsp_audio_pad = gst_element_get_request_pad(selector, "sink_%u");
+        if (gst_pad_link(chain_src, rtsp_audio_pad) != GST_PAD_LINK_OK) {
+            g_printerr("Failed to link RTSP audio chain to selector\n");
+        }
+        gst_object_unref(chain_src);
+
+        for (GstElement *element : chain) {
+            gst_element_sync_state_with_parent(element);
+        }
+
+        g_print("RTSP audio %s (%d Hz, %d ch): %s\n", encoding, clock_rate, channels,
+                passthrough ? "passthrough" : "transcoding to AAC");
+        rtsp_audio_depay = chain.front();
+        rtsp_audio_passthrough = passthrough;
+        std::lock_guard<std::mutex> guard(branches_lock);
+        rtsp_audio_codec = encoding;
+    }
+
+    link_depay(pad, rtsp_audio_depay);
+
+    // Pads may show up after the session is already selected
+    if (is_rtsp_connected && showing_primary()) {
+        select_camera_audio();
+    }
+}
+
+void RTSPDashStreamer::select_camera_audio() {
+    if (!rtsp_audio_pad) {
+        return;
+    }
+
+    if (rtsp_audio_passthrough) {
+        g_object_set(audio_encoded_selector, "active-pad", rtsp_audio_pad, NULL);
+        audio_source = AUDIO_SOURCE_PASSTHROUGH;
+    } else {
+        g_object_set(audio_raw_selector, "active-pad", rtsp_audio_pad, NULL);
+        g_object_set(audio_encoded_selector, "active-pad", audio_encoder_pad, NULL);
+        audio_source = AUDIO_SOURCE_TRANSCODE;
+    }
+}
+
+void RTSPDashStreamer::select_silence() {
+    if (!audio_tee) {
+        return;
+    }
+
+    g_object_set(audio_raw_selector, "active-pad", silence_selector_pad, NULL);
+    g_object_set(audio_encoded_selector, "active-pad", audio_encoder_pad, NULL);
+    audio_source = AUDIO_SOURCE_SILENCE;
+}
+
+bool RTSPDashStreamer::create_thumbnail_branch() {
+    // tee -> leaky queue -> videorate -> scale -> convert -> 1/N fps caps
+    // -> image encoder -> fakesink. The queue holds a single frame and
+    // drops the older one when the branch falls behind, so the tee never
+    // waits for it; videorate thins the rest out before anything is
+    // scaled or encoded.
+    GstElement *queue = gst_element_factory_make("queue", "thumbnail-queue");
+    GstElement *rate = gst_element_factory_make("videorate", "thumbnail-rate");
+    GstElement *scale = gst_element_factory_make("videoscale", "thumbnail-scale");
+    GstElement *convert = gst_element_factory_make("videoconvert", "thumbnail-convert");
+    GstElement *capsfilter = gst_element_factory_make("capsfilter", "thumbnail-caps");
+    GstElement *encoder = gst_element_factory_make(
+        thumbnail.format == THUMBNAIL_WEBP ? "webpenc" : "jpegenc", "thumbnail-encoder");
+    GstElement *sink = gst_element_factory_make("fakesink", "thumbnail-sink");
+
+    GstElement *elements[] = { queue, rate, scale, convert, capsfilter, encoder, sink };
+    for (GstElement *element : elements) {
+        if (!element) {
+            for (GstElement *created : elements) {
+                if (created) {
+                    gst_object_unref(created);
+                }
+            }
+            return false;
+        }
+    }
+
+    g_object_set(queue,
+        "leaky", 2, // Downstream, drop the oldest frame
+        "max-size-buffers", 1,
+        "max-size-bytes", 0,
+        "max-size-time", (guint64)0,
+        NULL);
+    g_object_set(rate, "drop-only", TRUE, NULL);
+
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+        "width", G_TYPE_INT, thumbnail.width,
+        "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
+        "framerate", GST_TYPE_FRACTION, 1, thumbnail.interval,
+        NULL);
+    g_object_set(capsfilter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    g_object_set(sink,
+        "signal-handoffs", TRUE,
+        "sync", FALSE,
+        "async", FALSE,
+        NULL);
+    g_signal_connect(sink, "handoff", G_CALLBACK(on_thumbnail), this);
+
+    gst_bin_add_many(GST_BIN(pipeline), queue, rate, scale, convert, capsfilter,
+        encoder, sink, NULL);
+    if (!gst_element_link_many(queue, rate, scale, convert, capsfilter, encoder, sink, NULL)) {
+        g_printerr("Failed to link thumbnail branch\n");
+        return false;
+    }
+
+    GstPad *queue_pad = gst_element_get_static_pad(queue, "sink");
+    thumbnail_tee_pad = gst_element_get_request_pad(tee, "src_%u");
+    GstPadLinkReturn ret = gst_pad_link(thumbnail_tee_pad, queue_pad);
+    gst_object_unref(queue_pad);
+    if (ret != GST_PAD_LINK_OK) {
+        g_printerr("Failed to link tee to thumbnail queue\n");
+        return false;
+    }
+
+    g_print("Thumbnail every %d s at %d px%s%s\n", thumbnail.interval, thumbnail.width,
+            thumbnail.path.empty() ? "" : " to ", thumbnail.path.c_str());
+    return true;
+}
+
+void RTSPDashStreamer::on_thumbnail(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+    GstMapInfo map;
+
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(streamer->snapshot_lock);
+        streamer->snapshot.assign(map.data, map.data + map.size);
+        streamer->snapshot_taken_us = g_get_real_time();
+    }
+    streamer->snapshots++;
+
+    // g_file_set_contents() renames a temporary file into place, so
+    // readers never see a partially written image
+    if (!streamer->thumbnail.path.empty()) {
+        GError *err = NULL;
+        if (!g_file_set_contents(streamer->thumbnail.path.c_str(),
+                                 (const gchar *)map.data, map.size, &err)) {
+            if (!streamer->thumbnail_write_failed) {
+                g_printerr("Failed to write thumbnail: %s\n", err->message);
+            }
+            g_error_free(err);
+            streamer->thumbnail_write_failed = true;
+        } else {
+            streamer->thumbnail_write_failed = false;
+        }
+    }
+
+    gst_buffer_unmap(buffer, &map);
+}
+
+bool RTSPDashStreamer::get_snapshot(std::vector<guint8>& image, gint64 *taken_us) {
+    std::lock_guard<std::mutex> guard(snapshot_lock);
+    if (snapshot.empty()) {
+        return false;
+    }
+
+    image = snapshot;
+    if (taken_us) {
+        *taken_us = snapshot_taken_us;
+    }
+    return true;
+}
+
+void RTSPDashStreamer::create_backup_decode_chain(GstPad *pad) {
+    if (!backup_depay) {
+        GstElement *depay, *decode;
+        if (!build_decode_chain("backup", depay, decode, backup_selector_pad)) {
+            return;
+        }
+
+        // In standby only depayloader and parser run, the decoder is fed
+        // once the backup takes over
+        GstPad *decode_sink = gst_element_get_static_pad(decode, "sink");
+        gst_pad_add_probe(decode_sink, GST_PAD_PROBE_TYPE_BUFFER,
+            on_backup_input, this, NULL);
+        gst_object_unref(decode_sink);
+
+        GstPad *decode_src = gst_element_get_static_pad(decode, "src");
+        gst_pad_add_probe(decode_src, GST_PAD_PROBE_TYPE_BUFFER,
+            on_backup_decoded, this, NULL);
+        gst_object_unref(decode_src);
+
+        backup_depay = depay;
+        backup_decoder = decode;
+    }
+
+    link_depay(pad, backup_depay);
+}
+
+void RTSPDashStreamer::on_backup_pad_added(GstElement *src, GstPad *pad, gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+    streamer->connect_rtsp_pad(pad, true);
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_backup_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+
+    if (!streamer->backup_active) {
+        return GST_PAD_PROBE_DROP;
+    }
+
+    // Start decoding at an IDR so the first frame shown is a clean one
+    if (streamer->backup_waiting_keyframe) {
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+            return GST_PAD_PROBE_DROP;
+        }
+        streamer->backup_waiting_keyframe = false;
+
+        buffer = gst_buffer_make_writable(buffer);
+        GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DISCONT);
+        GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn RTSPDashStreamer::on_backup_decoded(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+
+    // The first decoded frame flips the selector, on the streamer thread
+    if (streamer->backup_active && !streamer->backup_selected &&
+        !streamer->backup_switch_pending.exchange(true)) {
+        GSource *source = g_idle_source_new();
+        g_source_set_callback(source, select_backup_source, streamer, NULL);
+        g_source_attach(source, streamer->context);
+        g_source_unref(source);
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+gboolean RTSPDashStreamer::select_backup_source(gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+
+    // Cleared by switch_to_rtsp_source() when the primary came back first
+    streamer->backup_switch_pending = false;
+    if (!streamer->backup_active) {
+        return G_SOURCE_REMOVE;
+    }
+
+    g_object_set(streamer->input_selector, "active-pad", streamer->backup_selector_pad, NULL);
+    streamer->backup_selected = true;
+    streamer->failovers++;
+    streamer->last_failover_ms =
+        (g_get_monotonic_time() - streamer->failover_started_us) / 1000;
+
+    g_print("Switched to backup RTSP source after %u ms\n", (guint)streamer->last_failover_ms);
+    RTSP_DASH_TRACE1(switch_to_backup, streamer->camera_id.c_str());
+    return G_SOURCE_REMOVE;
+}
+
+bool RTSPDashStreamer::showing_primary() {
+    GstPad *active = NULL;
+    g_object_get(input_selector, "active-pad", &active, NULL);
+    bool primary = active && active == rtsp_selector_pad;
+    if (active) {
+        gst_object_unref(active);
+    }
+    return primary;
+}
+
+void RTSPDashStreamer::activate_backup() {
+    if (!backup_connected || backup_active) {
+        return;
+    }
+
+    failover_started_us = g_get_monotonic_time();
+    backup_waiting_keyframe = true;
+    backup_active = true;
+
+    // Ask for an IDR now rather than waiting for the next periodic one
+    if (backup_decoder) {
+        GstPad *decoder_sink = gst_element_get_static_pad(backup_decoder, "sink");
+        gst_pad_push_event(decoder_sink,
+            gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+        gst_object_unref(decoder_sink);
+    }
+}
+
+void RTSPDashStreamer::deactivate_backup() {
+    backup_active = false;
+    backup_selected = false;
+}
+
+void RTSPDashStreamer::handle_primary_lost() {
+    // Keep showing the backup while the primary is being reconnected
+    if (backup_selected) {
+        return;
+    }
+
+    // Slate covers the gap until the backup's next IDR is decoded
+    switch_to_dummy_source();
+    activate_backup();
+}
+
+void RTSPDashStreamer::handle_backup_lost() {
+    backup_connected = false;
+    if (backup_selected) {
+        switch_to_dummy_source();
+    }
+    deactivate_backup();
+    schedule_backup_reconnect();
+}
+
+void RTSPDashStreamer::schedule_backup_reconnect() {
+    remove_source(backup_reconnect_timeout_id);
+    backup_reconnect_timeout_id = add_timeout_seconds(5,
+        (GSourceFunc)reconnect_backup_source, this);
+}
+
+gboolean RTSPDashStreamer::reconnect_backup_source(gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+
+    g_print("Attempting backup RTSP reconnection...\n");
+    GstState state = GST_STATE_NULL;
+    gst_element_get_state(streamer->backup_src, &state, NULL, 0);
+    streamer->backup_restarting = state == GST_STATE_PLAYING;
+    gst_element_set_state(streamer->backup_src, GST_STATE_NULL);
+    gst_element_set_state(streamer->backup_src, GST_STATE_PLAYING);
+
+    streamer->backup_reconnect_timeout_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+void RTSPDashStreamer::switch_to_dummy_source() {
+    if (dummy_selector_pad) {
+        g_object_set(input_selector, "active-pad", dummy_selector_pad, NULL);
+        select_silence();
+        g_print("Switched to dummy source (blank frames)\n");
+        RTSP_DASH_TRACE1(switch_to_dummy, camera_id.c_str());
+    }
+}
+
+void RTSPDashStreamer::switch_to_rtsp_source() {
+    if (rtsp_selector_pad) {
+        g_object_set(input_selector, "active-pad", rtsp_selector_pad, NULL);
+        select_camera_audio();
+        deactivate_backup();
+        g_print("Switched to RTSP source\n");
+        RTSP_DASH_TRACE1(switch_to_rtsp, camera_id.c_str());
+    }
+}
+
+void RTSPDashStreamer::schedule_rtsp_reconnect() {
+    remove_source(reconnect_timeout_id);
+
+    // Try to reconnect after 5 seconds
+    reconnect_timeout_id = add_timeout_seconds(5,
+        (GSourceFunc)reconnect_rtsp_source, this);
+}
+
+void RTSPDashStreamer::request_reconnect() {
+    GSource *source = g_idle_source_new();
+    g_source_set_callback(source, (GSourceFunc)reconnect_now, this, NULL);
+    g_source_attach(source, context);
+    g_source_unref(source);
+}
+
+void RTSPDashStreamer::set_publishing(bool enabled) {
+    if (publishing.exchange(enabled) || !enabled) {
+        return;
+    }
+    GSource *source = g_idle_source_new();
+    g_source_set_callback(source, publish_manifests, this, NULL);
+    g_source_attach(source, context);
+    g_source_unref(source);
+}
+
+gboolean RTSPDashStreamer::publish_manifests(gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+
+    // The last manifests dashsink wrote, the next segments update them
+    std::lock_guard<std::mutex> guard(streamer->branches_lock);
+    for (RenditionBranch *branch : streamer->branches) {
+        if (branch->dash_sink) {
+            streamer->publish_manifest(branch);
+        } else if (branch->idle) {
+            streamer->write_idle_manifest(branch);
+        }
+    }
+    return G_SOURCE_REMOVE;
+}
+
+gboolean RTSPDashStreamer::reconnect_now(gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+
+    streamer->remove_source(streamer->reconnect_timeout_id);
+    reconnect_rtsp_source(streamer);
+    return G_SOURCE_REMOVE;
+}
+
+gboolean RTSPDashStreamer::reconnect_rtsp_source(gpointer user_data) {
+    RTSPDashStreamer *streamer = static_cast<RTSPDashStreamer*>(user_data);
+
+    g_print("Attempting RTSP reconnection...\n");
+    RTSP_DASH_TRACE1(reconnect, streamer->camera_id.c_str());
+
+    // Reset RTSP source state
+    streamer->rtsp_restarting = streamer->is_rtsp_connected;
+    streamer->is_rtsp_connected = false;
+    streamer->rtp_transport = RTP_TRANSPORT_NONE;
+    streamer->handle_primary_lost();
+    gst_element_set_state(streamer->rtsp_src, GST_STATE_NULL);
+    gst_element_set_state(streamer->rtsp_src, GST_STATE_PLAYING);
+
+    streamer->reconnect_timeout_id = 0;
+    return FALSE; // Remove timeout
+}
+
+guint RTSPDashStreamer::add_timeout_seconds(guint seconds, GSourceFunc func, gpointer data) {
+    GSource *source = g_timeout_source_new_seconds(seconds);
+    g_source_set_callback(source, func, data, NULL);
+    guint id = g_source_attach(source, context);
+    g_source_unref(source);
+    return id;
+}
+
+void RTSPDashStreamer::remove_source(guint& source_id) {
+    // g_source_remove() only looks at the default context
+    if (source_id > 0) {
+        GSource *source = g_main_context_find_source_by_id(context, source_id);
+        if (source) {
+            g_source_destroy(source);
+        }
+        source_id = 0;
+    }
+}
+
+void RTSPDashStreamer::cleanup() {
+    remove_source(reconnect_timeout_id);
+    remove_source(backup_reconnect_timeout_id);
+    remove_source(health_timeout_id);
+    remove_source(latency_timeout_id);
+    remove_source(rtcp_timeout_id);
+    remove_source(demand_timeout_id);
+    remove_source(demand_watch_id);
+    remove_source(cost_timeout_id);
+    remove_source(bus_watch_id);
+    if (demand_watch_fd >= 0) {
+        close(demand_watch_fd);
+        demand_watch_fd = -1;
+    }
+
+    if (pipeline) {
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+    }
+
+    struct { GstElement *element; GstPad **pad; } request_pads[] = {
+        { input_selector, &dummy_selector_pad },
+        { input_selector, &rtsp_selector_pad },
+        { input_selector, &backup_selector_pad },
+        { audio_raw_selector, &silence_selector_pad },
+        { audio_encoded_selector, &audio_encoder_pad },
+        { rtsp_audio_passthrough ? audio_encoded_selector : audio_raw_selector, &rtsp_audio_pad },
+        { tee, &thumbnail_tee_pad },
+    };
+    for (auto& request_pad : request_pads) {
+        if (*request_pad.pad) {
+            gst_element_release_request_pad(request_pad.element, *request_pad.pad);
+            gst_object_unref(*request_pad.pad);
+            *request_pad.pad = nullptr;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(jitter_lock);
+        release_rtp_session();
+    }
+
+    if (pipeline) {
+        gst_object_unref(pipeline);
+        pipeline = nullptr;
+    }
+
+    if (bus) {
+        g_signal_handlers_disconnect_by_data(bus, this);
+        gst_bus_disable_sync_message_emission(bus);
+        gst_object_unref(bus);
+        bus = nullptr;
+    }
+
+    AdmissionControl::get().release(input_reservation);
+    input_reservation = 0;
+    for (RenditionBranch *branch : branches) {
+        remove_source(branch->restart_timeout_id);
+        AdmissionControl::get().release(branch->reservation);
+        if (branch->tee_pad) {
+            gst_object_unref(branch->tee_pad);
+        }
+        if (branch->audio_tee_pad) {
+            gst_object_unref(branch->audio_tee_pad);
+        }
+        delete branch;
+    }
+    branches.clear();
+
+    if (context) {
+        g_main_context_unref(context);
+        context = nullptr;
+    }
+}
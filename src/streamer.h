@@ -0,0 +1,536 @@
+#ifndef RTSP_DASH_STREAMER_H
+#define RTSP_DASH_STREAMER_H
+
+#include "config.h"
+#include "denoise.h"
+#include "overlay.h"
+
+#include <gst/gst.h>
+#include <glib.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Totals over all renditions, cheap enough to poll from any thread
+struct StreamCounters {
+    bool connected;
+    guint64 connections;
+    guint64 frames;
+    guint64 segments;
+    guint64 warnings;
+    guint64 qos_dropped;
+    guint64 latency_recalculations;
+
+    // RTP receive side, see evaluate_latency()
+    guint rtp_jitter_us;
+    double rtp_loss_rate;
+    guint latency_ms;
+
+    // RTCP view of the camera's streams, totals over all sessions
+    guint rtcp_jitter_us;
+    guint64 rtcp_packets_lost;
+    guint64 keyframe_requests;
+
+    // Negotiated RTP transport, see update_transport()
+    RtpTransport transport;
+    guint64 multicast_joins;
+    guint64 multicast_packets_lost;
+    guint64 tcp_fallbacks;
+
+    // Hot standby, see activate_backup()
+    bool on_backup;
+    guint64 failovers;
+    guint last_failover_ms;
+
+    // Renditions rebuilt after an error, see fail_branch(), and rebuilds
+    // that failed themselves, see retry_branch()
+    guint64 branch_restarts;
+    guint64 branch_restart_failures;
+
+    // RTSP decoder under overload, see evaluate_decode_skip()
+    int decode_skip_level;
+    guint64 decode_skipped;
+    double decode_fps;
+
+    // Thumbnail branch, see on_thumbnail()
+    guint64 snapshots;
+
+    // Temporal prefilter, see on_tee_input()
+    bool denoise_active;
+    double noise_level;
+    guint64 denoised_frames;
+
+    // Cores of the input and the running renditions, projected by the
+    // cost model and measured, see evaluate_cost()
+    double cpu_projected;
+    double cpu_measured;
+    guint64 admissions_refused;
+};
+
+// Running time of a frame and the wall clock time it stands for, published
+// as the manifests' ProducerReferenceTime
+struct ProducerReference {
+    bool valid = false;
+    GstClockTime running_time = 0;
+    gint64 wall_clock_us = 0; // Unix time
+    bool captured = false;    // the camera's NTP capture time, else arrival at the tee
+};
+
+// Called on the streamer thread when a DASH segment has been finalized
+typedef void (*SegmentCallback)(const gchar *rendition, const gchar *location,
+                                GstClockTime running_time, gpointer user_data);
+
+// Called on the streaming thread for every encoded frame of a rendition
+typedef void (*FrameCallback)(const gchar *rendition, GstBuffer *buffer,
+                              gpointer user_data);
+
+// Called on the streaming thread for every scaled I420 frame of the
+// rendition that was the smallest at start, right before it is encoded
+typedef void (*ScaledFrameCallback)(GstBuffer *buffer, const GstVideoInfo *info,
+                                    gpointer user_data);
+
+class RTSPDashStreamer {
+public:
+    RTSPDashStreamer(const std::string& uri, const std::string& output);
+    explicit RTSPDashStreamer(const CameraConfig& camera);
+    ~RTSPDashStreamer();
+
+    // Ladder used when none is configured (1080p/5000 and 720p/3000)
+    static std::vector<RenditionConfig> default_ladder();
+
+    // Must be called before initialize()
+    void set_renditions(const std::vector<RenditionConfig>& ladder);
+    void set_backup_uri(const std::string& uri);
+    void set_thumbnail(const ThumbnailConfig& config);
+    void set_trickplay(const std::string& rendition);
+    void set_denoise(const DenoiseConfig& config);
+    void add_privacy_mask(const FrameRegion& region);
+    void set_timestamp_overlay(bool enabled, const std::string& text);
+    void set_utc_timing(const std::string& url);
+
+    // Segments and dashsink's own manifests go to this subdirectory of
+    // the output; the published manifests stay in the output and point
+    // there with a BaseURL, so nodes can stream the same camera side by
+    // side during a handover, see run_shard_worker()
+    void set_segment_subdirectory(const std::string& name);
+
+    void set_on_demand(bool enabled, int idle_seconds);
+    void set_segment_callback(SegmentCallback callback, gpointer user_data);
+    void set_frame_callback(FrameCallback callback, gpointer user_data);
+    void set_scaled_frame_callback(ScaledFrameCallback callback, gpointer user_data);
+
+    // Whether the input and the renditions initialize() starts fit the
+    // CPU headroom of the process, see AdmissionControl
+    bool admit();
+
+    bool initialize();
+    bool start();
+    void run();
+    void stop();
+
+    // Bitrate changes are applied in place, size changes rebuild the
+    // branch and unknown names add a new one. New and larger renditions
+    // are refused when they don't fit the CPU headroom.
+    bool reconfigure(const RenditionConfig& rendition);
+    bool remove_rendition(const std::string& name);
+
+    // On-demand mode: marks a rendition as watched and starts its encoder
+    // when it is idle. Fetches of <name>_manifest.mpd in the output
+    // directory call this already, origins that serve the files from
+    // elsewhere call it per request. From any thread.
+    bool request_rendition(const std::string& name);
+
+    // Restarts the RTSP session right away, from any thread
+    void request_reconnect();
+
+    // While off the published manifests are left alone, e.g. while another
+    // node still publishes the camera; turning it on publishes them right
+    // away. From any thread.
+    void set_publishing(bool enabled);
+
+    bool is_connected() const { return is_rtsp_connected; }
+    bool is_on_backup() const { return backup_selected; }
+    bool is_running() const { return is_loop_running; }
+    const std::string& get_camera_id() const { return camera_id; }
+
+    StreamCounters get_counters();
+
+    // Snapshot of the stream counters, free with gst_structure_free()
+    GstStructure *get_stats();
+
+    // Latest encoded thumbnail, false until the first one was taken
+    bool get_snapshot(std::vector<guint8>& image, gint64 *taken_us = nullptr);
+
+    // For diagnostics tools that walk the element tree
+    GstElement *get_pipeline() const { return pipeline; }
+
+private:
+    struct RenditionBranch {
+        RTSPDashStreamer *owner;
+        RenditionConfig config;
+        GstElement *queue;
+        GstElement *crop; // only for region of interest renditions
+        GstElement *convert;
+        GstElement *scale;
+        GstElement *rate;
+        GstElement *capsfilter;
+        GstElement *encoder;
+        GstElement *parse;
+        GstElement *dash_sink;
+        GstPad *tee_pad;
+        GstElement *audio_queue;
+        GstPad *audio_tee_pad;
+        std::atomic<guint64> frames;
+        std::atomic<guint64> segments;
+        bool removing;
+        bool rebuild;
+
+        // Adaptive load control, see evaluate_health()
+        std::atomic<guint64> qos_dropped;
+        guint64 qos_dropped_seen;
+        guint pressure_windows;
+        guint calm_windows;
+        int load_level;
+        std::atomic<guint> frame_divisor; // encoder gets every Nth frame
+        guint64 skip_counter;
+
+        // Running time of the branch's first frame, where its dashsink's
+        // timeline starts, see publish_manifest()
+        std::atomic<guint64> base_running_time;
+
+        // I-frame-only trick play Representation, see link_trickplay()
+        GstElement *parse_tee;
+        GstElement *video_queue;
+        GstElement *trick_queue;
+        std::string trick_pad;
+        guint frames_since_keyframe;
+        std::atomic<guint> gop_frames;
+        std::atomic<guint64> trick_segments;
+        bool trick_manifest_failed;
+
+        // Scaled frames handed to the scaled frame callback
+        GstVideoInfo scaled_info;
+        bool scaled_info_valid;
+
+        // On-demand mode, see request_rendition() and evaluate_demand()
+        bool idle;             // torn down for lack of viewers, kept for the next request
+        gint64 demanded_us;    // last request, monotonic
+        gint64 activated_us;   // reset once the first segment is out
+        gint64 deactivated_us;
+        guint64 activations;
+        guint first_segment_ms; // request to first segment, last activation
+        bool refused;           // last activation did not fit the CPU headroom
+
+        // CPU reservation of the running branch, see AdmissionControl
+        guint reservation;
+        guint64 frames_reserved; // frames when it was taken
+
+        // Error isolation, see fail_branch()
+        std::atomic<bool> failed;   // its input is dropped until it is rebuilt
+        guint64 restarts;
+        guint64 restart_failures;   // rebuilds that failed, retried as well
+        guint restart_delay;        // seconds, doubles while it keeps failing
+        guint64 segments_restarted; // segments written before the last restart
+        guint restart_timeout_id;
+        std::string last_error;
+    };
+
+    GstElement *pipeline;
+    GstElement *rtsp_src;
+    GstElement *dummy_src;
+    GstElement *input_selector;
+    GstElement *tee;
+    GstElement *rtsp_depay;
+    GstElement *rtsp_decoder;
+    GstElement *backup_src;
+    GstElement *backup_depay;
+    GstElement *backup_decoder;
+    GstPad *dummy_selector_pad;
+    GstPad *rtsp_selector_pad;
+    GstPad *backup_selector_pad;
+    std::vector<RenditionBranch*> branches;
+    std::mutex branches_lock;
+    GstBus *bus;
+    GMainContext *context;
+    guint bus_watch_id;
+    guint reconnect_timeout_id;
+    guint health_timeout_id;
+    guint latency_timeout_id;
+    guint rtcp_timeout_id;
+    guint backup_reconnect_timeout_id;
+    std::string camera_id;
+    std::string rtsp_uri;
+    std::string output_path;
+    std::atomic<bool> is_rtsp_connected;
+    std::atomic<guint64> rtsp_connections;
+    bool rtsp_restarting;
+    std::atomic<bool> is_loop_running;
+    std::atomic<bool> stop_requested;
+    SegmentCallback segment_callback;
+    gpointer segment_user_data;
+    FrameCallback frame_callback;
+    gpointer frame_user_data;
+    ScaledFrameCallback scaled_frame_callback;
+    gpointer scaled_frame_user_data;
+    std::string scaled_frame_rendition;
+
+    // Health counters fed from bus messages
+    std::atomic<guint64> rtsp_warnings;
+    std::atomic<guint64> pipeline_warnings;
+    std::atomic<guint64> qos_events;
+    std::atomic<guint64> decoder_qos_dropped;
+    std::atomic<guint64> latency_recalculations;
+    std::string last_warning;
+    std::map<GstObject*, guint64> qos_dropped_by_element;
+
+    // Jitterbuffer latency control, the jitterbuffers of the current
+    // RTSP session are collected from rtpbin and guarded by jitter_lock
+    guint min_latency_ms;
+    guint max_latency_ms;
+    bool adaptive_latency;
+    std::atomic<guint> current_latency_ms;
+    std::atomic<guint> rtp_jitter_us;
+    std::atomic<double> rtp_loss_rate;
+    GstElement *rtp_manager;
+    std::vector<GstElement*> jitterbuffers;
+    std::mutex jitter_lock;
+    guint64 rtp_pushed_seen;
+    guint64 rtp_lost_seen;
+    guint64 rtp_late_seen;
+
+    // RTCP receiver statistics and keyframe recovery, see poll_rtcp_stats()
+    // and request_keyframe()
+    std::atomic<guint> rtcp_jitter_us;
+    std::atomic<guint64> rtcp_packets_received;
+    std::atomic<guint64> rtcp_packets_lost;
+    std::atomic<guint64> rtcp_keyframe_requests_sent;
+    guint64 rtcp_received_seen;
+    guint64 rtcp_lost_seen;
+    guint64 rtcp_requests_seen;
+    std::atomic<gint64> last_keyframe_request_us;
+    std::atomic<guint64> keyframe_requests;
+    std::atomic<guint64> keyframe_requests_suppressed;
+
+    // RTP transport policy and what the camera actually granted
+    TransportPolicy transport_policy;
+    std::string multicast_iface;
+    std::atomic<RtpTransport> rtp_transport;
+    std::string multicast_group;
+    std::atomic<guint64> multicast_joins;
+    std::atomic<guint64> multicast_packets_lost;
+    std::atomic<guint64> tcp_fallbacks;
+
+    // Hot standby: backup_active opens the decoder of the backup chain,
+    // backup_selected is set once its first frame has been selected
+    std::string backup_uri;
+    std::atomic<bool> backup_connected;
+    std::atomic<bool> backup_active;
+    std::atomic<bool> backup_waiting_keyframe;
+    std::atomic<bool> backup_selected;
+    std::atomic<bool> backup_switch_pending;
+    bool backup_restarting;
+    gint64 failover_started_us;
+    std::atomic<guint64> failovers;
+    std::atomic<guint> last_failover_ms;
+
+    // Audio: silence or camera audio, encoded once and teed into every
+    // rendition's dashsink, which packages its own copy, see
+    // create_audio_chain()
+    bool audio_enabled;
+    int audio_rate;
+    int audio_channels;
+    int audio_bitrate;
+    GstElement *audio_raw_selector;
+    GstElement *audio_encoded_selector;
+    GstElement *audio_tee;
+    GstElement *rtsp_audio_depay;
+    GstPad *silence_selector_pad;
+    GstPad *audio_encoder_pad;
+    GstPad *rtsp_audio_pad;
+    bool rtsp_audio_passthrough;
+    std::string rtsp_audio_codec;
+    std::atomic<int> audio_source;
+
+    std::string trickplay_rendition;
+
+    // Thumbnail branch behind a leaky queue, see create_thumbnail_branch()
+    ThumbnailConfig thumbnail;
+    GstPad *thumbnail_tee_pad;
+    std::mutex snapshot_lock;
+    std::vector<guint8> snapshot;
+    gint64 snapshot_taken_us;
+    std::atomic<guint64> snapshots;
+    bool thumbnail_write_failed;
+
+    // Prefilters on the tee input, see link_tee_input()
+    GstVideoInfo frame_info;
+    bool frame_info_valid;
+    DenoiseConfig denoise;
+    TemporalDenoiser denoiser;
+    std::atomic<guint64> denoised_frames;
+    std::atomic<guint64> denoise_us;
+    std::vector<FrameRegion> privacy_masks;
+    bool timestamp_overlay;
+    std::string overlay_text;
+    FrameOverlay overlay;
+    std::atomic<guint64> overlaid_frames;
+    std::atomic<guint64> overlay_us;
+
+    // Where dashsink writes, see set_segment_subdirectory()
+    std::string segment_subdirectory;
+    std::atomic<bool> publishing;
+    std::string segment_path() const {
+        return segment_subdirectory.empty() ? output_path : output_path + "/" + segment_subdirectory;
+    }
+
+    // Timing elements of the manifests, see on_reference_time()
+    std::string utc_timing;
+    std::mutex reference_lock;
+    ProducerReference producer_reference;
+    gint64 reference_sampled_us;
+    std::atomic<gint64> capture_delay_ms;
+
+    // On-demand renditions, requests are seen through inotify on the
+    // output directory
+    bool on_demand;
+    guint demand_idle;
+    int demand_watch_fd;
+    guint demand_watch_id;
+    guint demand_timeout_id;
+
+    // CPU cost of the camera input (decode and prefilters) and the
+    // renditions, see evaluate_cost()
+    guint input_reservation;
+    std::atomic<guint64> decoded_frames;
+    guint64 decoded_frames_seen;
+    guint64 decoded_pixels;
+    gint64 cost_evaluated_us;
+    std::atomic<guint64> admissions_refused;
+    guint cost_timeout_id;
+
+    // RTSP decoder frame skipping under overload, see evaluate_decode_skip()
+    std::atomic<int> decode_skip_level;
+    bool decode_resync; // skipped a reference frame, waiting for a keyframe
+    std::atomic<guint64> decode_skipped;
+    guint decode_pressure_windows;
+    guint decode_calm_windows;
+    guint64 decoder_qos_dropped_seen;
+    guint64 decode_rate_frames_seen;
+    gint64 decode_rate_us;
+    std::atomic<double> decode_fps; // frames out of the decoder
+
+    bool create_dash_pipeline(RenditionBranch *branch);
+    void discard_dash_pipeline(RenditionBranch *branch);
+    void remove_branch_elements(RenditionBranch *branch);
+    void clear_branch_elements(RenditionBranch *branch);
+    void retry_branch(RenditionBranch *branch);
+    void teardown_dash_pipeline(RenditionBranch *branch);
+    static GstPadProbeReturn on_branch_idle(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn on_branch_audio_idle(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static void schedule_branch_teardown(RenditionBranch *branch);
+    static gboolean finish_branch_teardown(gpointer user_data);
+    static GstPadProbeReturn on_branch_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static void on_sync_error(GstBus *bus, GstMessage *msg, gpointer user_data);
+    bool fail_branch(GstObject *source, const GError *error);
+    static gboolean restart_branch(gpointer user_data);
+    bool link_trickplay(RenditionBranch *branch, GstElement *parse, GstElement *dash_sink);
+    static GstPadProbeReturn on_trickplay_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    void publish_manifest(RenditionBranch *branch);
+    bool always_on(RenditionBranch *branch) const;
+    void activate_branch(RenditionBranch *branch);
+    void write_idle_manifest(RenditionBranch *branch);
+    void watch_manifest_requests();
+    static gboolean on_manifest_opened(gint fd, GIOCondition condition, gpointer user_data);
+    static gboolean evaluate_demand(gpointer user_data);
+    std::string input_cost_key() const;
+    double input_pixel_rate();
+    double project_rendition(const RenditionConfig& rendition);
+    bool admit_rendition(const RenditionConfig& rendition, double replaced_cores, bool report);
+    void reserve_branch(RenditionBranch *branch);
+    static GstPadProbeReturn on_branch_stream_start(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static gboolean evaluate_cost(gpointer user_data);
+    static GstPadProbeReturn on_crop_caps(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn on_encoded_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    void choose_scaled_frame_rendition();
+    static GstPadProbeReturn on_scaled_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn on_encoder_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+#ifdef ENABLE_USDT
+    static GstPadProbeReturn on_encoder_enter(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn on_encoder_exit(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+#endif
+    RenditionBranch *find_branch(const std::string& name);
+    RenditionBranch *find_branch_for_object(GstObject *object);
+
+    bool connect_dummy_source();
+    bool link_tee_input();
+    static GstPadProbeReturn on_tee_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn on_reference_time(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    void setup_bus_monitoring();
+    static gboolean bus_message_handler(GstBus *bus, GstMessage *msg, gpointer user_data);
+    gboolean handle_bus_message(GstMessage *msg);
+    void handle_element_message(GstMessage *msg);
+    void handle_warning_message(GstMessage *msg);
+    void handle_qos_message(GstMessage *msg);
+    static gboolean evaluate_health(gpointer user_data);
+    void set_load_level(RenditionBranch *branch, int level);
+    void evaluate_decode_skip(bool pressure);
+
+    static void on_new_manager(GstElement *src, GstElement *manager, gpointer user_data);
+    static void on_new_jitterbuffer(GstElement *manager, GstElement *jitterbuffer,
+                                    guint session, guint ssrc, gpointer user_data);
+    static gboolean evaluate_latency(gpointer user_data);
+    void set_latency(guint latency);
+    void release_rtp_session();
+
+    static gboolean poll_rtcp_stats(gpointer user_data);
+    static GstPadProbeReturn on_depay_event(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn on_decoded_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn on_decoder_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    void request_keyframe(const gchar *reason);
+    void update_transport();
+
+    static void on_rtsp_pad_added(GstElement *src, GstPad *pad, gpointer user_data);
+    static void on_rtsp_no_more_pads(GstElement *src, gpointer user_data);
+    void configure_rtsp_source(GstElement *src, const std::string& uri);
+    void connect_rtsp_pad(GstPad *pad, bool backup);
+    bool build_decode_chain(const std::string& prefix, GstElement *&depay,
+                            GstElement *&decoder, GstPad *&selector_pad);
+    void link_depay(GstPad *pad, GstElement *depay);
+    void create_rtsp_decode_chain(GstPad *pad);
+
+    bool create_audio_chain();
+    void create_rtsp_audio_chain(GstPad *pad, const GstStructure *structure);
+    void select_camera_audio();
+    void select_silence();
+
+    bool create_thumbnail_branch();
+    static void on_thumbnail(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data);
+
+    static void on_backup_pad_added(GstElement *src, GstPad *pad, gpointer user_data);
+    void create_backup_decode_chain(GstPad *pad);
+    static GstPadProbeReturn on_backup_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn on_backup_decoded(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static gboolean select_backup_source(gpointer user_data);
+    bool showing_primary();
+    void activate_backup();
+    void deactivate_backup();
+    void handle_primary_lost();
+    void handle_backup_lost();
+    void schedule_backup_reconnect();
+    static gboolean reconnect_backup_source(gpointer user_data);
+
+    void switch_to_dummy_source();
+    void switch_to_rtsp_source();
+    void schedule_rtsp_reconnect();
+    static gboolean reconnect_rtsp_source(gpointer user_data);
+    static gboolean reconnect_now(gpointer user_data);
+    static gboolean publish_manifests(gpointer user_data);
+
+    guint add_timeout_seconds(guint seconds, GSourceFunc func, gpointer data);
+    void remove_source(guint& source_id);
+    void cleanup();
+};
+
+#endif // RTSP_DASH_STREAMER_H
@@ -0,0 +1,234 @@
+#include "supervisor.h"
+#include "worker.h"
+
+#include <gst/gst.h>
+#include <csignal>
+#include <cstdio>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Restart delay after a crash, doubled for every crash in a row
+static const gint64 MIN_RESTART_BACKOFF_US = 1 * G_USEC_PER_SEC;
+static const gint64 MAX_RESTART_BACKOFF_US = 30 * G_USEC_PER_SEC;
+// A worker that lived this long is considered healthy again
+static const gint64 HEALTHY_UPTIME_US = 60 * G_USEC_PER_SEC;
+static const gint64 STOP_GRACE_US = 10 * G_USEC_PER_SEC;
+
+static volatile sig_atomic_t supervisor_stop = 0;
+
+static void supervisor_signal_handler(int signal) {
+    supervisor_stop = 1;
+}
+
+// Parses a sysfs cpu list such as "0-3,8,10-11"
+static std::vector<int> parse_cpu_list(const gchar *text) {
+    std::vector<int> cpus;
+    gchar **ranges = g_strsplit(text, ",", -1);
+
+    for (gchar **range = ranges; *range; range++) {
+        int first, last;
+        int n = sscanf(*range, "%d-%d", &first, &last);
+        if (n == 1) {
+            last = first;
+        } else if (n != 2) {
+            continue;
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+
+    g_strfreev(ranges);
+    return cpus;
+}
+
+static std::vector<std::vector<int> > detect_numa_nodes() {
+    std::vector<std::vector<int> > nodes;
+    gchar *online = NULL;
+
+    if (g_file_get_contents("/sys/devices/system/node/online", &online, NULL, NULL)) {
+        for (int node : parse_cpu_list(g_strstrip(online))) {
+            gchar *path = g_strdup_printf("/sys/devices/system/node/node%d/cpulist", node);
+            gchar *cpulist = NULL;
+            if (g_file_get_contents(path, &cpulist, NULL, NULL)) {
+                nodes.push_back(parse_cpu_list(g_strstrip(cpulist)));
+                g_free(cpulist);
+            }
+            g_free(path);
+        }
+        g_free(online);
+    }
+
+    // No NUMA information, one node without pinning
+    if (nodes.empty()) {
+        nodes.push_back(std::vector<int>());
+    }
+    return nodes;
+}
+
+Supervisor::Supervisor(const std::vector<CameraConfig>& cameras, const GeneralConfig& general,
+                       int workers, const std::string& board_name)
+    : cameras(cameras), general(general), board_name(board_name) {
+    numa_cpus = detect_numa_nodes();
+
+    int count = workers > 0 ? workers : (int)numa_cpus.size();
+    count = MAX(1, MIN(count, (int)cameras.size()));
+
+    for (int i = 0; i < count; i++) {
+        Worker worker = Worker();
+        worker.index = i;
+        worker.numa_node = i % numa_cpus.size();
+        worker.backoff_us = MIN_RESTART_BACKOFF_US;
+        this->workers.push_back(worker);
+    }
+
+    // Round-robin sharding keeps busy and idle cameras mixed
+    for (gsize i = 0; i < cameras.size(); i++) {
+        this->workers[i % count].cameras.push_back(i);
+    }
+}
+
+int Supervisor::run() {
+    if (!board.create(board_name, cameras, workers.size())) {
+        return 1;
+    }
+
+    signal(SIGINT, supervisor_signal_handler);
+    signal(SIGTERM, supervisor_signal_handler);
+
+    g_print("Supervising %zu cameras in %zu workers (%zu NUMA nodes)\n",
+            cameras.size(), workers.size(), numa_cpus.size());
+    g_print("Status board: %s\n", board_name.c_str());
+
+    for (Worker& worker : workers) {
+        spawn_worker(worker);
+    }
+
+    while (!supervisor_stop) {
+        reap_workers();
+
+        gint64 now = g_get_monotonic_time();
+        for (Worker& worker : workers) {
+            if (worker.pid == 0 && now >= worker.restart_at_us) {
+                spawn_worker(worker);
+            }
+        }
+
+        g_usleep(G_USEC_PER_SEC / 5);
+    }
+
+    g_print("Stopping workers...\n");
+    stop_workers();
+    return 0;
+}
+
+bool Supervisor::spawn_worker(Worker& worker) {
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        g_printerr("Failed to fork worker %d: %s\n", worker.index, g_strerror(errno));
+        worker.restart_at_us = g_get_monotonic_time() + worker.backoff_us;
+        return false;
+    }
+
+    if (pid == 0) {
+        // Worker: never outlive the supervisor
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+
+        const std::vector<int>& cpus = numa_cpus[worker.numa_node];
+        if (!cpus.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int cpu : cpus) {
+                CPU_SET(cpu, &set);
+            }
+            sched_setaffinity(0, sizeof(set), &set);
+        }
+
+        // GStreamer is only initialized after fork, the supervisor
+        // itself never starts any threads
+        gst_init(NULL, NULL);
+        _exit(run_worker(cameras, general, worker.cameras, &board, worker.index));
+    }
+
+    worker.pid = pid;
+    worker.started_us = g_get_monotonic_time();
+    g_print("Worker %d started (pid %d, node %d, %zu cameras)\n",
+            worker.index, pid, worker.numa_node, worker.cameras.size());
+    publish_worker(worker);
+    return true;
+}
+
+void Supervisor::reap_workers() {
+    int status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (Worker& worker : workers) {
+            if (worker.pid != pid) {
+                continue;
+            }
+
+            if (WIFSIGNALED(status)) {
+                g_printerr("Worker %d (pid %d) killed by signal %d\n",
+                           worker.index, pid, WTERMSIG(status));
+            } else {
+                g_printerr("Worker %d (pid %d) exited with status %d\n",
+                           worker.index, pid, WEXITSTATUS(status));
+            }
+
+            gint64 now = g_get_monotonic_time();
+            if (now - worker.started_us > HEALTHY_UPTIME_US) {
+                worker.backoff_us = MIN_RESTART_BACKOFF_US;
+            }
+
+            worker.pid = 0;
+            worker.restarts++;
+            worker.restart_at_us = now + worker.backoff_us;
+            worker.backoff_us = MIN(worker.backoff_us * 2, MAX_RESTART_BACKOFF_US);
+            publish_worker(worker);
+        }
+    }
+}
+
+void Supervisor::publish_worker(const Worker& worker) {
+    WorkerRecord record = WorkerRecord();
+    record.pid = worker.pid;
+    record.numa_node = worker.numa_node;
+    record.alive = worker.pid != 0;
+    record.restarts = worker.restarts;
+    record.started_us = worker.pid ? g_get_real_time() : 0;
+    board.publish_worker(worker.index, record);
+}
+
+void Supervisor::stop_workers() {
+    for (Worker& worker : workers) {
+        if (worker.pid > 0) {
+            kill(worker.pid, SIGTERM);
+        }
+    }
+
+    gint64 deadline = g_get_monotonic_time() + STOP_GRACE_US;
+    for (Worker& worker : workers) {
+        if (worker.pid <= 0) {
+            continue;
+        }
+
+        while (waitpid(worker.pid, NULL, WNOHANG) == 0) {
+            if (g_get_monotonic_time() > deadline) {
+                g_printerr("Worker %d did not stop, killing it\n", worker.index);
+                kill(worker.pid, SIGKILL);
+                waitpid(worker.pid, NULL, 0);
+                break;
+            }
+            g_usleep(G_USEC_PER_SEC / 10);
+        }
+
+        worker.pid = 0;
+        publish_worker(worker);
+    }
+}
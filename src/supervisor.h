@@ -0,0 +1,49 @@
+#ifndef RTSP_DASH_SUPERVISOR_H
+#define RTSP_DASH_SUPERVISOR_H
+
+#include "config.h"
+#include "status-board.h"
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+// Shards cameras across a pool of worker processes so a crashing decoder
+// only takes its own shard down. Workers are pinned to NUMA nodes, are
+// restarted with their camera set when they die and report through a
+// shared status board.
+class Supervisor {
+public:
+    // workers == 0 means one worker per NUMA node
+    Supervisor(const std::vector<CameraConfig>& cameras, const GeneralConfig& general,
+               int workers, const std::string& board_name);
+
+    // Blocks until SIGINT or SIGTERM, returns the process exit code
+    int run();
+
+private:
+    struct Worker {
+        int index;
+        int numa_node;
+        pid_t pid;
+        guint32 restarts;
+        gint64 started_us;
+        gint64 restart_at_us;
+        gint64 backoff_us;
+        std::vector<int> cameras;
+    };
+
+    std::vector<CameraConfig> cameras;
+    GeneralConfig general;
+    std::vector<Worker> workers;
+    std::vector<std::vector<int> > numa_cpus;
+    std::string board_name;
+    StatusBoard board;
+
+    bool spawn_worker(Worker& worker);
+    void reap_workers();
+    void publish_worker(const Worker& worker);
+    void stop_workers();
+};
+
+#endif // RTSP_DASH_SUPERVISOR_H
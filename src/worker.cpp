@@ -0,0 +1,345 @@
+#include "worker.h"
+#include "admission.h"
+#include "lease-store.h"
+#include "mosaic.h"
+#include "streamer.h"
+
+#include <csignal>
+#include <map>
+#include <unistd.h>
+
+static volatile sig_atomic_t worker_stop = 0;
+
+// Signal handler for graceful shutdown
+static void worker_signal_handler(int signal) {
+    worker_stop = 1;
+}
+
+static gpointer streamer_thread(gpointer user_data) {
+    static_cast<RTSPDashStreamer*>(user_data)->run();
+    return NULL;
+}
+
+static void publish_camera(StatusBoard *board, int slot, int worker_index,
+                           RTSPDashStreamer *streamer, bool queued) {
+    StreamCounters counters = streamer->get_counters();
+    CameraRecord record = CameraRecord();
+
+    g_strlcpy(record.camera_id, streamer->get_camera_id().c_str(), sizeof(record.camera_id));
+    record.worker = worker_index;
+    record.pid = getpid();
+    record.state = queued ? CAMERA_STATE_QUEUED :
+                   !streamer->is_running() ? CAMERA_STATE_STOPPED :
+                   counters.connected ? CAMERA_STATE_LIVE :
+                   counters.on_backup ? CAMERA_STATE_BACKUP : CAMERA_STATE_SLATE;
+    record.frames = counters.frames;
+    record.segments = counters.segments;
+    record.warnings = counters.warnings;
+    record.qos_dropped = counters.qos_dropped;
+    record.latency_recalculations = counters.latency_recalculations;
+    record.rtp_loss_rate = counters.rtp_loss_rate;
+    record.rtp_jitter_us = counters.rtp_jitter_us;
+    record.latency_ms = counters.latency_ms;
+    record.rtcp_jitter_us = counters.rtcp_jitter_us;
+    record.rtcp_packets_lost = counters.rtcp_packets_lost;
+    record.keyframe_requests = counters.keyframe_requests;
+    record.transport = counters.transport;
+    record.multicast_joins = counters.multicast_joins;
+    record.multicast_packets_lost = counters.multicast_packets_lost;
+    record.tcp_fallbacks = counters.tcp_fallbacks;
+    record.failovers = counters.failovers;
+    record.last_failover_ms = counters.last_failover_ms;
+    record.branch_restarts = counters.branch_restarts;
+    record.branch_restart_failures = counters.branch_restart_failures;
+    record.decode_skip_level = counters.decode_skip_level;
+    record.decode_skipped = counters.decode_skipped;
+    record.decode_fps = counters.decode_fps;
+    record.cpu_projected = counters.cpu_projected;
+    record.cpu_measured = counters.cpu_measured;
+    record.admissions_refused = counters.admissions_refused;
+
+    AdmissionControl& admission = AdmissionControl::get();
+    record.worker_cpu_projected = admission.projected_total();
+    record.worker_cpu_measured = MAX(admission.measured_total(), 0.0);
+    record.worker_cpu_capacity = admission.capacity();
+    record.updated_us = g_get_real_time();
+
+    board->publish_camera(slot, record);
+}
+
+int run_worker(const std::vector<CameraConfig>& cameras, const GeneralConfig& general,
+               const std::vector<int>& assigned, StatusBoard *board, int worker_index,
+               const MosaicConfig *mosaic) {
+    signal(SIGINT, worker_signal_handler);
+    signal(SIGTERM, worker_signal_handler);
+
+    std::vector<RTSPDashStreamer*> streamers;
+    std::vector<GThread*> threads;
+    std::vector<bool> seen_running;
+    int status = 0;
+
+    MosaicComposer *composer = nullptr;
+    if (mosaic && !mosaic->cameras.empty()) {
+        composer = new MosaicComposer(*mosaic);
+    }
+
+    AdmissionControl::get().set_headroom(general.cpu_headroom);
+
+    // Threads stay NULL while a camera waits for CPU headroom
+    auto start_camera = [&](gsize i) {
+        RTSPDashStreamer *streamer = streamers[i];
+        if (!streamer->initialize() || !streamer->start()) {
+            g_printerr("Failed to start camera %s\n", streamer->get_camera_id().c_str());
+            return false;
+        }
+        threads[i] = g_thread_new(streamer->get_camera_id().c_str(), streamer_thread, streamer);
+        return true;
+    };
+
+    bool queueing = false;
+    for (int index : assigned) {
+        const CameraConfig& camera = cameras[index];
+        g_mkdir_with_parents(camera.output_path.c_str(), 0755);
+
+        RTSPDashStreamer *streamer = new RTSPDashStreamer(camera);
+        streamer->set_utc_timing(general.utc_timing);
+        streamers.push_back(streamer);
+        threads.push_back(nullptr);
+        seen_running.push_back(false);
+        if (composer) {
+            composer->attach(streamer);
+        }
+
+        // Cameras start in order, so one that does not fit queues the rest
+        queueing = queueing || !streamer->admit();
+        if (queueing) {
+            g_printerr("Camera %s queued, it does not fit the CPU headroom\n", camera.id.c_str());
+        } else if (!start_camera(streamers.size() - 1)) {
+            status = 1;
+            break;
+        }
+    }
+
+    if (composer && status == 0 && !composer->start()) {
+        status = 1;
+    }
+
+    // Poll often enough to react to signals quickly, publish once a
+    // second and retry the queued cameras every ten
+    for (guint tick = 0; !worker_stop && status == 0; tick++) {
+        for (gsize i = 0; queueing && tick % 40 == 39 && i < streamers.size(); i++) {
+            if (threads[i]) {
+                continue;
+            }
+            if (!streamers[i]->admit()) {
+                break;
+            }
+            g_print("Camera %s leaves the queue\n", streamers[i]->get_camera_id().c_str());
+            if (!start_camera(i)) {
+                status = 1;
+            }
+            queueing = i + 1 < streamers.size();
+        }
+
+        for (gsize i = 0; i < threads.size(); i++) {
+            if (!threads[i]) {
+                continue;
+            }
+            if (streamers[i]->is_running()) {
+                seen_running[i] = true;
+            } else if (seen_running[i]) {
+                g_printerr("Camera %s stopped unexpectedly\n",
+                           streamers[i]->get_camera_id().c_str());
+                status = 1;
+            }
+        }
+
+        if (board && tick % 4 == 0) {
+            for (gsize i = 0; i < streamers.size(); i++) {
+                publish_camera(board, assigned[i], worker_index, streamers[i], !threads[i]);
+            }
+        }
+
+        g_usleep(G_USEC_PER_SEC / 4);
+    }
+
+    for (gsize i = 0; i < threads.size(); i++) {
+        if (threads[i]) {
+            streamers[i]->stop();
+            g_thread_join(threads[i]);
+        }
+    }
+
+    // The cameras no longer call into their tiles
+    delete composer;
+
+    for (gsize i = 0; i < streamers.size(); i++) {
+        if (board) {
+            publish_camera(board, assigned[i], worker_index, streamers[i], false);
+        }
+        delete streamers[i];
+    }
+
+    return status;
+}
+
+// A node that could not fit a camera claims no more for this long
+static const gint64 FULL_BACKOFF_US = 10 * G_USEC_PER_SEC;
+
+int run_shard_worker(const std::vector<CameraConfig>& cameras, const GeneralConfig& general,
+                     const std::string& node, StatusBoard *board) {
+    signal(SIGINT, worker_signal_handler);
+    signal(SIGTERM, worker_signal_handler);
+
+    LeaseStore leases(general.lease_store, node, general.lease_ttl);
+    AdmissionControl::get().set_headroom(general.cpu_headroom);
+
+    std::vector<std::string> ids;
+    std::map<std::string, int> slots;
+    for (gsize i = 0; i < cameras.size(); i++) {
+        ids.push_back(cameras[i].id);
+        slots[cameras[i].id] = i;
+    }
+
+    struct Owned {
+        RTSPDashStreamer *streamer;
+        GThread *thread;
+        bool seen_running;
+        bool standby; // handed over to us, the previous owner still publishes
+    };
+    std::map<std::string, Owned> owned;
+    gint64 full_until_us = 0;
+
+    // Every node writes its segments to its own subdirectory, so the
+    // previous and the next owner can both stream a camera being handed
+    // over. Only the owner publishes the manifests, which point there.
+    auto start_camera = [&](const std::string& id, bool standby) {
+        const CameraConfig& camera = cameras[slots[id]];
+        g_mkdir_with_parents(camera.output_path.c_str(), 0755);
+        RTSPDashStreamer *streamer = new RTSPDashStreamer(camera);
+        streamer->set_utc_timing(general.utc_timing);
+        streamer->set_segment_subdirectory(node);
+        streamer->set_publishing(!standby);
+        if (!streamer->admit()) {
+            g_printerr("Camera %s does not fit the CPU headroom, left to the other nodes\n",
+                       id.c_str());
+            full_until_us = g_get_monotonic_time() + FULL_BACKOFF_US;
+            delete streamer;
+            return false;
+        }
+        if (!streamer->initialize() || !streamer->start()) {
+            g_printerr("Failed to start camera %s\n", id.c_str());
+            delete streamer;
+            return false;
+        }
+        Owned entry = { streamer, g_thread_new(id.c_str(), streamer_thread, streamer), false, standby };
+        owned[id] = entry;
+        if (standby) {
+            g_print("Camera %s starting on %s to take it over\n", id.c_str(), node.c_str());
+        } else {
+            g_print("Camera %s claimed by %s\n", id.c_str(), node.c_str());
+        }
+        return true;
+    };
+
+    auto stop_camera = [&](const std::string& id) {
+        Owned& entry = owned[id];
+        entry.streamer->stop();
+        g_thread_join(entry.thread);
+        if (board) {
+            publish_camera(board, slots[id], 0, entry.streamer, false);
+        }
+        delete entry.streamer;
+        owned.erase(id);
+    };
+
+    // Poll often enough to react to signals quickly, sync the leases and
+    // publish once a second
+    for (guint tick = 0; !worker_stop; tick++) {
+        gint64 now = g_get_monotonic_time();
+        std::vector<std::string> released;
+        for (auto& entry : owned) {
+            Owned& camera = entry.second;
+            if (camera.streamer->is_running()) {
+                camera.seen_running = true;
+            }
+            // A failed camera is given up rather than ending the worker,
+            // its lease goes to whichever node claims it next
+            if (camera.seen_running && !camera.streamer->is_running()) {
+                g_printerr("Camera %s stopped unexpectedly, releasing it\n", entry.first.c_str());
+                released.push_back(entry.first);
+            }
+        }
+        for (const std::string& id : released) {
+            stop_camera(id);
+        }
+        if (!released.empty()) {
+            leases.release(released);
+        }
+
+        if (tick % 4 == 0) {
+            // Cameras we stand by for are ready to take over once their
+            // first segment is out
+            std::set<std::string> running;
+            std::set<std::string> ready;
+            for (const auto& entry : owned) {
+                running.insert(entry.first);
+                if (entry.second.standby && entry.second.streamer->get_counters().segments > 0) {
+                    ready.insert(entry.first);
+                }
+            }
+            LeaseStore::Changes changes;
+            if (leases.sync(ids, running, ready, now < full_until_us, changes)) {
+                for (const std::string& id : changes.lost) {
+                    g_printerr("Camera %s is owned by another node now\n", id.c_str());
+                    stop_camera(id);
+                }
+                for (const std::string& id : changes.handover) {
+                    g_print("Camera %s handed over\n", id.c_str());
+                    stop_camera(id);
+                }
+                for (const std::string& id : changes.promoted) {
+                    auto camera = owned.find(id);
+                    if (camera != owned.end() && camera->second.standby) {
+                        camera->second.standby = false;
+                        camera->second.streamer->set_publishing(true);
+                        g_print("Camera %s taken over by %s\n", id.c_str(), node.c_str());
+                    }
+                }
+                std::vector<std::string> refused;
+                for (const std::string& id : changes.claimed) {
+                    if (!start_camera(id, false)) {
+                        refused.push_back(id);
+                    }
+                }
+                for (const std::string& id : changes.incoming) {
+                    if (!start_camera(id, true)) {
+                        refused.push_back(id);
+                    }
+                }
+                if (!refused.empty()) {
+                    leases.release(refused);
+                }
+            }
+
+            if (board) {
+                for (const auto& entry : owned) {
+                    publish_camera(board, slots[entry.first], 0, entry.second.streamer, false);
+                }
+            }
+        }
+
+        g_usleep(G_USEC_PER_SEC / 4);
+    }
+
+    std::vector<std::string> remaining;
+    for (const auto& entry : owned) {
+        remaining.push_back(entry.first);
+    }
+    for (const std::string& id : remaining) {
+        stop_camera(id);
+    }
+    leases.leave();
+
+    return 0;
+}
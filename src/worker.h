@@ -0,0 +1,27 @@
+#ifndef RTSP_DASH_WORKER_H
+#define RTSP_DASH_WORKER_H
+
+#include "config.h"
+#include "status-board.h"
+
+#include <vector>
+
+// Runs the cameras listed in assigned (indices into cameras, which are
+// also their status board slots) until SIGINT or SIGTERM. Publishes to
+// board once a second when one is given. Returns the process exit code,
+// non-zero when a camera stopped on its own. With a mosaic the assigned
+// cameras that are part of it feed its tiles.
+int run_worker(const std::vector<CameraConfig>& cameras, const GeneralConfig& general,
+               const std::vector<int>& assigned, StatusBoard *board, int worker_index,
+               const MosaicConfig *mosaic = nullptr);
+
+// Runs the cameras this node holds leases for in the [general]
+// lease-store shared with the other nodes, see LeaseStore, until SIGINT or
+// SIGTERM. Cameras are claimed, handed over and taken from failed nodes
+// as the nodes come and go; board slots are indices into cameras. The
+// segments go to a subdirectory named after node, see
+// RTSPDashStreamer::set_segment_subdirectory().
+int run_shard_worker(const std::vector<CameraConfig>& cameras, const GeneralConfig& general,
+                     const std::string& node, StatusBoard *board);
+
+#endif // RTSP_DASH_WORKER_H